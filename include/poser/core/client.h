@@ -92,15 +92,45 @@ PSC_TcpClientOpts_setProto(PSC_TcpClientOpts *self, PSC_Proto proto)
  * This can be useful for remote services using some load-balancing or
  * round-robin DNS. In this case, it can be avoided to try the same host over
  * and over again.
+ *
+ * The blacklist is shared by all clients on all service threads.
  * @memberof PSC_TcpClientOpts
  * @param self the PSC_TcpClientOpts
  * @param blacklistHits number of hits needed to remove the entry from the
- *                      blacklist again
+ *                      blacklist again, 0 for no limit when a time to live
+ *                      is set with PSC_TcpClientOpts_setBlacklistTtl()
  */
 DECLEXPORT void
 PSC_TcpClientOpts_setBlacklistHits(PSC_TcpClientOpts *self, int blacklistHits)
     CMETHOD;
 
+/** Set a time to live for blacklist entries.
+ * When this is set to a non-zero value, blacklisting is enabled (see
+ * PSC_TcpClientOpts_setBlacklistHits()) and entries are removed again after
+ * the given time, even if the number of hits wasn't reached yet.
+ * @memberof PSC_TcpClientOpts
+ * @param self the PSC_TcpClientOpts
+ * @param seconds time to live for blacklist entries, 0 for no limit
+ */
+DECLEXPORT void
+PSC_TcpClientOpts_setBlacklistTtl(PSC_TcpClientOpts *self, unsigned seconds)
+    CMETHOD;
+
+/** Blacklist whole networks instead of single addresses.
+ * When a remote address is blacklisted, the whole network containing it,
+ * given by the prefix length, is put on the blacklist. The default is to
+ * only blacklist the address itself (a prefix length of 32 for IPv4 and 128
+ * for IPv6).
+ * @memberof PSC_TcpClientOpts
+ * @param self the PSC_TcpClientOpts
+ * @param v4prefix prefix length for IPv4 addresses (max: 32)
+ * @param v6prefix prefix length for IPv6 addresses (max: 128)
+ */
+DECLEXPORT void
+PSC_TcpClientOpts_setBlacklistPrefix(PSC_TcpClientOpts *self,
+	unsigned v4prefix, unsigned v6prefix)
+    CMETHOD;
+
 /** PSC_TcpClientOpts destructor
  * @memberof PSC_TcpClientOpts
  * @param self the PSC_TcpClientOpts
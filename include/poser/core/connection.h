@@ -321,6 +321,69 @@ DECLEXPORT void *
 PSC_Connection_data(const PSC_Connection *self)
     CMETHOD ATTR_PURE;
 
+/** Number of bytes received.
+ * Counts the raw bytes read from the connection. When TLS is enabled, this
+ * counts decrypted payload bytes.
+ * @memberof PSC_Connection
+ * @param self the PSC_Connection
+ * @returns the number of bytes received so far
+ */
+DECLEXPORT uint64_t
+PSC_Connection_bytesReceived(const PSC_Connection *self)
+    CMETHOD ATTR_PURE;
+
+/** Number of bytes sent.
+ * Counts the raw bytes written to the connection. When TLS is enabled, this
+ * counts payload bytes before encryption.
+ * @memberof PSC_Connection
+ * @param self the PSC_Connection
+ * @returns the number of bytes sent so far
+ */
+DECLEXPORT uint64_t
+PSC_Connection_bytesSent(const PSC_Connection *self)
+    CMETHOD ATTR_PURE;
+
+/** Number of messages received.
+ * Counts how often the PSC_Connection_dataReceived() event was fired.
+ * @memberof PSC_Connection
+ * @param self the PSC_Connection
+ * @returns the number of messages received so far
+ */
+DECLEXPORT uint64_t
+PSC_Connection_messagesReceived(const PSC_Connection *self)
+    CMETHOD ATTR_PURE;
+
+/** Number of messages sent.
+ * Counts the send requests queued with PSC_Connection_sendAsync() that were
+ * completely written to the connection.
+ * @memberof PSC_Connection
+ * @param self the PSC_Connection
+ * @returns the number of messages sent so far
+ */
+DECLEXPORT uint64_t
+PSC_Connection_messagesSent(const PSC_Connection *self)
+    CMETHOD ATTR_PURE;
+
+/** High-water mark of the send queue.
+ * @memberof PSC_Connection
+ * @param self the PSC_Connection
+ * @returns the maximum number of send requests that were waiting in the
+ *          send queue at the same time
+ */
+DECLEXPORT unsigned
+PSC_Connection_sendQueueMax(const PSC_Connection *self)
+    CMETHOD ATTR_PURE;
+
+/** Time to first byte.
+ * @memberof PSC_Connection
+ * @param self the PSC_Connection
+ * @returns the time in milliseconds from creating the connection until the
+ *          first data was received, or -1 if nothing was received yet
+ */
+DECLEXPORT long
+PSC_Connection_firstByteMs(const PSC_Connection *self)
+    CMETHOD ATTR_PURE;
+
 /** The data received.
  * Get a pointer to the data received on a connection. This is used when
  * receiving in binary mode. In text mode, it returns NULL.
@@ -0,0 +1,281 @@
+#ifndef POSER_CORE_DATAGRAMSOCKET_H
+#define POSER_CORE_DATAGRAMSOCKET_H
+
+/** declarations for the PSC_DatagramSocket class
+ * @file
+ */
+
+#include <poser/decl.h>
+
+#include <poser/core/proto.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** A UDP socket sending and receiving datagrams.
+ * This class receives datagrams in batches (using recvmmsg() where
+ * available) and fires a single event for each batch. Datagrams sent are
+ * queued and written in a batch (using sendmmsg() where available) at the
+ * end of the current service loop iteration.
+ *
+ * A datagram socket is bound to the service thread that created it. To
+ * spread load over several service threads, create one socket with
+ * PSC_DatagramSocketOpts_reusePort() on each thread, e.g. using
+ * PSC_Service_runOnThread().
+ * @class PSC_DatagramSocket datagramsocket.h <poser/core/datagramsocket.h>
+ */
+C_CLASS_DECL(PSC_DatagramSocket);
+
+/** Options for creating a datagram socket.
+ * @class PSC_DatagramSocketOpts datagramsocket.h <poser/core/datagramsocket.h>
+ */
+C_CLASS_DECL(PSC_DatagramSocketOpts);
+
+/** A datagram received on a PSC_DatagramSocket.
+ * It is only valid while handling the PSC_DatagramSocket_received() event.
+ * @class PSC_Datagram datagramsocket.h <poser/core/datagramsocket.h>
+ */
+C_CLASS_DECL(PSC_Datagram);
+
+/** Event arguments for a batch of datagrams received.
+ * @class PSC_EADatagramsReceived datagramsocket.h <poser/core/datagramsocket.h>
+ */
+C_CLASS_DECL(PSC_EADatagramsReceived);
+
+C_CLASS_DECL(PSC_Event);
+C_CLASS_DECL(PSC_IpAddr);
+
+/** PSC_DatagramSocketOpts constructor.
+ * Creates an options object initialized to default values.
+ * @memberof PSC_DatagramSocketOpts
+ * @param port the port to bind to, 0 for an ephemeral port
+ * @returns a newly created options object
+ */
+DECLEXPORT PSC_DatagramSocketOpts *
+PSC_DatagramSocketOpts_create(int port)
+    ATTR_RETNONNULL;
+
+/** Bind to a specific hostname or address.
+ * If this isn't called, the socket will be bound to any address.
+ * @memberof PSC_DatagramSocketOpts
+ * @param self the PSC_DatagramSocketOpts
+ * @param bindhost hostname or address to bind to
+ */
+DECLEXPORT void
+PSC_DatagramSocketOpts_bind(PSC_DatagramSocketOpts *self,
+	const char *bindhost)
+    CMETHOD ATTR_NONNULL((2));
+
+/** Set a specific protocol (IPv4 or IPv6).
+ * @memberof PSC_DatagramSocketOpts
+ * @param self the PSC_DatagramSocketOpts
+ * @param proto protocol the socket should use
+ */
+DECLEXPORT void
+PSC_DatagramSocketOpts_setProto(PSC_DatagramSocketOpts *self,
+	PSC_Proto proto)
+    CMETHOD;
+
+/** Set the batch size.
+ * This is the maximum number of datagrams received with a single system
+ * call, and the number of datagrams that can be queued for sending. The
+ * default value is 32.
+ * @memberof PSC_DatagramSocketOpts
+ * @param self the PSC_DatagramSocketOpts
+ * @param batch the batch size, must be > 0 and <= 1024
+ */
+DECLEXPORT void
+PSC_DatagramSocketOpts_batchSize(PSC_DatagramSocketOpts *self,
+	unsigned batch)
+    CMETHOD;
+
+/** Set the buffer size.
+ * This is the size of the buffer for a single datagram, in bytes, for both
+ * receiving and sending. Received datagrams exceeding this size are
+ * truncated. The default value is 2 kiB.
+ * @memberof PSC_DatagramSocketOpts
+ * @param self the PSC_DatagramSocketOpts
+ * @param sz the size of the buffer, must be > 0 and <= 65535
+ */
+DECLEXPORT void
+PSC_DatagramSocketOpts_bufSize(PSC_DatagramSocketOpts *self, size_t sz)
+    CMETHOD;
+
+/** Allow multiple sockets to bind to the same address.
+ * This sets SO_REUSEPORT on the socket, so the kernel can distribute
+ * incoming datagrams over multiple sockets, typically one per service thread.
+ * Has no effect on platforms not supporting SO_REUSEPORT.
+ * @memberof PSC_DatagramSocketOpts
+ * @param self the PSC_DatagramSocketOpts
+ */
+DECLEXPORT void
+PSC_DatagramSocketOpts_reusePort(PSC_DatagramSocketOpts *self)
+    CMETHOD;
+
+/** Enable segmentation offload.
+ * When enabled, consecutive datagrams of equal size queued for the same
+ * destination are passed to the kernel as a single buffer (UDP GSO), and the
+ * kernel may coalesce received datagrams (UDP GRO), which are transparently
+ * split again. Has no effect on platforms other than Linux.
+ * @memberof PSC_DatagramSocketOpts
+ * @param self the PSC_DatagramSocketOpts
+ */
+DECLEXPORT void
+PSC_DatagramSocketOpts_offload(PSC_DatagramSocketOpts *self)
+    CMETHOD;
+
+/** PSC_DatagramSocketOpts destructor.
+ * @memberof PSC_DatagramSocketOpts
+ * @param self the PSC_DatagramSocketOpts
+ */
+DECLEXPORT void
+PSC_DatagramSocketOpts_destroy(PSC_DatagramSocketOpts *self);
+
+/** Create a datagram socket.
+ * The socket is bound to the first usable address found and is handled by
+ * the calling service thread.
+ * @memberof PSC_DatagramSocket
+ * @param opts datagram socket options
+ * @returns a newly created datagram socket, or NULL on error
+ */
+DECLEXPORT PSC_DatagramSocket *
+PSC_DatagramSocket_create(const PSC_DatagramSocketOpts *opts)
+    ATTR_NONNULL((1));
+
+/** Datagrams received.
+ * This event fires for each batch of datagrams received. It passes a
+ * PSC_EADatagramsReceived instance as event arguments.
+ * @memberof PSC_DatagramSocket
+ * @param self the PSC_DatagramSocket
+ * @returns the received event
+ */
+DECLEXPORT PSC_Event *
+PSC_DatagramSocket_received(PSC_DatagramSocket *self)
+    CMETHOD ATTR_RETNONNULL ATTR_PURE;
+
+/** Queue a datagram for sending.
+ * The data is copied, so the buffer can be reused immediately. All queued
+ * datagrams are sent at the end of the current service loop iteration.
+ * @memberof PSC_DatagramSocket
+ * @param self the PSC_DatagramSocket
+ * @param addr the destination address
+ * @param port the destination port
+ * @param buf the data to send
+ * @param sz the size of the data, must not exceed the buffer size
+ * @returns 0 on success, -1 on error (e.g. the send queue is full)
+ */
+DECLEXPORT int
+PSC_DatagramSocket_sendTo(PSC_DatagramSocket *self, const PSC_IpAddr *addr,
+	int port, const uint8_t *buf, size_t sz)
+    CMETHOD ATTR_NONNULL((2)) ATTR_NONNULL((4));
+
+/** Queue a reply to a received datagram.
+ * This works like PSC_DatagramSocket_sendTo(), using the sender of the
+ * given datagram as the destination.
+ * @memberof PSC_DatagramSocket
+ * @param self the PSC_DatagramSocket
+ * @param dgram the datagram to reply to
+ * @param buf the data to send
+ * @param sz the size of the data, must not exceed the buffer size
+ * @returns 0 on success, -1 on error (e.g. the send queue is full)
+ */
+DECLEXPORT int
+PSC_DatagramSocket_reply(PSC_DatagramSocket *self, const PSC_Datagram *dgram,
+	const uint8_t *buf, size_t sz)
+    CMETHOD ATTR_NONNULL((2)) ATTR_NONNULL((3));
+
+/** Send all queued datagrams now.
+ * Normally, this is done automatically at the end of the service loop
+ * iteration.
+ * @memberof PSC_DatagramSocket
+ * @param self the PSC_DatagramSocket
+ */
+DECLEXPORT void
+PSC_DatagramSocket_flush(PSC_DatagramSocket *self)
+    CMETHOD;
+
+/** The local port the socket is bound to.
+ * @memberof PSC_DatagramSocket
+ * @param self the PSC_DatagramSocket
+ * @returns the local port
+ */
+DECLEXPORT int
+PSC_DatagramSocket_port(const PSC_DatagramSocket *self)
+    CMETHOD ATTR_PURE;
+
+/** PSC_DatagramSocket destructor.
+ * Queued datagrams that were not sent yet are dropped.
+ * @memberof PSC_DatagramSocket
+ * @param self the PSC_DatagramSocket
+ */
+DECLEXPORT void
+PSC_DatagramSocket_destroy(PSC_DatagramSocket *self);
+
+/** Number of datagrams received.
+ * @memberof PSC_EADatagramsReceived
+ * @param self the PSC_EADatagramsReceived
+ * @returns the number of datagrams in this batch
+ */
+DECLEXPORT size_t
+PSC_EADatagramsReceived_count(const PSC_EADatagramsReceived *self)
+    CMETHOD ATTR_PURE;
+
+/** Get a datagram received.
+ * @memberof PSC_EADatagramsReceived
+ * @param self the PSC_EADatagramsReceived
+ * @param i the index of the datagram, must be less than
+ *          PSC_EADatagramsReceived_count()
+ * @returns the datagram
+ */
+DECLEXPORT const PSC_Datagram *
+PSC_EADatagramsReceived_datagram(const PSC_EADatagramsReceived *self,
+	size_t i)
+    CMETHOD ATTR_RETNONNULL ATTR_PURE;
+
+/** The data of a datagram.
+ * @memberof PSC_Datagram
+ * @param self the PSC_Datagram
+ * @returns a pointer to the data
+ */
+DECLEXPORT const uint8_t *
+PSC_Datagram_buf(const PSC_Datagram *self)
+    CMETHOD ATTR_RETNONNULL ATTR_PURE;
+
+/** The size of a datagram.
+ * @memberof PSC_Datagram
+ * @param self the PSC_Datagram
+ * @returns the size of the data in bytes
+ */
+DECLEXPORT size_t
+PSC_Datagram_size(const PSC_Datagram *self)
+    CMETHOD ATTR_PURE;
+
+/** Check whether a datagram was truncated.
+ * @memberof PSC_Datagram
+ * @param self the PSC_Datagram
+ * @returns 1 if the datagram didn't fit the buffer, 0 otherwise
+ */
+DECLEXPORT int
+PSC_Datagram_truncated(const PSC_Datagram *self)
+    CMETHOD ATTR_PURE;
+
+/** The address of the sender.
+ * The address object is created on first access and is only valid while
+ * the datagram is valid, use PSC_IpAddr_ref() to keep it.
+ * @memberof PSC_Datagram
+ * @param self the PSC_Datagram
+ * @returns the address of the sender, or NULL if not available
+ */
+DECLEXPORT const PSC_IpAddr *
+PSC_Datagram_remoteIpAddr(const PSC_Datagram *self)
+    CMETHOD;
+
+/** The port of the sender.
+ * @memberof PSC_Datagram
+ * @param self the PSC_Datagram
+ * @returns the port of the sender, or -1 if not available
+ */
+DECLEXPORT int
+PSC_Datagram_remotePort(const PSC_Datagram *self)
+    CMETHOD ATTR_PURE;
+
+#endif
@@ -115,14 +115,15 @@ PSC_IpAddr_raw(const PSC_IpAddr *self)
 /** The canonical string representation of the address.
  * Returns the canonical string representation of the address. If the prefix
  * length is less than the full length in bits (32 for IPv4, 128 for IPv6),
- * it is appended after a slash ('/').
+ * it is appended after a slash ('/'). IPv6 addresses are formatted according
+ * to RFC 5952. The string is only created on first access.
  * @memberof PSC_IpAddr
  * @param self the PSC_IpAddr
  * @returns the string representation of the address
  */
 DECLEXPORT const char *
 PSC_IpAddr_string(const PSC_IpAddr *self)
-    CMETHOD ATTR_RETNONNULL ATTR_PURE;
+    CMETHOD ATTR_RETNONNULL;
 
 /** Compare two addresses for equality.
  * @memberof PSC_IpAddr
@@ -80,4 +80,17 @@ PSC_RunOpts_nowait(void);
 DECLEXPORT void
 PSC_RunOpts_workerThreads(int workerThreads);
 
+/** Use a coarse clock for timestamps.
+ * When this is set, the service loop reads a clock that is cheaper to read,
+ * but has a lower resolution (typically a few milliseconds), if the platform
+ * offers one (CLOCK_MONOTONIC_COARSE). It's used for PSC_Service_now(),
+ * PSC_Service_nowMs() and for measuring the load of service threads instead
+ * of the precise clock. Timers still read the precise clock when they are
+ * started or expire.
+ * @memberof PSC_RunOpts
+ * @static
+ */
+DECLEXPORT void
+PSC_RunOpts_coarseClock(void);
+
 #endif
@@ -9,6 +9,7 @@
 #include <poser/core/certinfo.h>
 #include <poser/core/proto.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /** A server listening on a socket and accepting connections.
  * This class will open one or multiple listening sockets and handle incoming
@@ -28,6 +29,7 @@ C_CLASS_DECL(PSC_TcpServerOpts);
 C_CLASS_DECL(PSC_UnixServerOpts);
 
 C_CLASS_DECL(PSC_Connection);
+C_CLASS_DECL(PSC_IpAddr);
 
 /** A callback executed for each accepted client connection
  * @param obj optional object reference for the "owner" object of the callback
@@ -35,6 +37,52 @@ C_CLASS_DECL(PSC_Connection);
  */
 typedef void (*PSC_ClientConnectedCallback)(void *obj, PSC_Connection *conn);
 
+/** Counters kept by a PSC_Server for each service thread.
+ * Traffic counters are summed up from the counters of a PSC_Connection when
+ * it is closed.
+ */
+typedef enum PSC_ServerCounter
+{
+    PSC_SC_ACCEPTED,	    /**< number of accepted connections */
+    PSC_SC_CLOSED,	    /**< number of closed connections */
+    PSC_SC_BYTESRECEIVED,   /**< bytes received on closed connections */
+    PSC_SC_BYTESSENT,	    /**< bytes sent on closed connections */
+    PSC_SC_MSGRECEIVED,	    /**< messages received on closed connections */
+    PSC_SC_MSGSENT,	    /**< messages sent on closed connections */
+    PSC_SC_REJECTED	    /**< connections reset by admission control or
+				 address filtering */
+} PSC_ServerCounter;
+
+/** How to assign new connections to service threads.
+ * See PSC_TcpServerOpts_placement().
+ */
+typedef enum PSC_PlacementPolicy
+{
+    PSC_PP_LEASTCONN,	/**< thread with the fewest active connections */
+    PSC_PP_ROUNDROBIN,	/**< threads in turn */
+    PSC_PP_IPHASH,	/**< thread selected by a hash of the remote address */
+    PSC_PP_LEASTBUSY	/**< thread with the lowest service loop load */
+} PSC_PlacementPolicy;
+
+/** A callback selecting the service thread for a new connection.
+ * @param obj optional object reference passed with the callback
+ * @param addr the remote address of the connection, NULL if not available
+ * @param nthreads the number of service threads
+ * @returns the number of the service thread (0 to @p nthreads - 1), or -1
+ *          to use the thread with the fewest active connections
+ */
+typedef int (*PSC_PlacementHook)(void *obj, const PSC_IpAddr *addr,
+	int nthreads);
+
+/** What to do with new connections when a limit is reached.
+ * See PSC_TcpServerOpts_overloadPolicy().
+ */
+typedef enum PSC_OverloadPolicy
+{
+    PSC_OP_RESET,   /**< accept and immediately reset the connection */
+    PSC_OP_PAUSE    /**< stop accepting until a connection can be admitted */
+} PSC_OverloadPolicy;
+
 /** PSC_TcpServerOpts constructor.
  * Creates an options object initialized to default values.
  * @memberof PSC_TcpServerOpts
@@ -67,6 +115,176 @@ DECLEXPORT void
 PSC_TcpServerOpts_readBufSize(PSC_TcpServerOpts *self, size_t sz)
     CMETHOD;
 
+/** Set the accept batch size.
+ * When a listening socket is ready, up to this number of connections are
+ * accepted at once, and distributed to the service threads in one go. The
+ * default value is 16.
+ * @memberof PSC_TcpServerOpts
+ * @param self the PSC_TcpServerOpts
+ * @param batch the maximum number of connections accepted at once, must be
+ *              > 0 and <= 1024
+ */
+DECLEXPORT void
+PSC_TcpServerOpts_acceptBatch(PSC_TcpServerOpts *self, unsigned batch)
+    CMETHOD;
+
+/** Listen on each service thread separately.
+ * When worker threads are used (see PSC_RunOpts_workerThreads()), this
+ * opens a separate listening socket with SO_REUSEPORT for each of them, so
+ * the kernel distributes incoming connections and every worker thread
+ * accepts and handles its connections locally, without a central acceptor
+ * on the main thread. Listening sockets are moved to the worker threads on
+ * the first incoming connection.
+ *
+ * Optionally, a steering program can be attached (Linux only) selecting the
+ * listening socket by the CPU that received the connection request. This is
+ * only useful when the number of worker threads matches the number of CPUs.
+ * @memberof PSC_TcpServerOpts
+ * @param self the PSC_TcpServerOpts
+ * @param cpusteering non-zero to steer connections by CPU
+ */
+DECLEXPORT void
+PSC_TcpServerOpts_reusePort(PSC_TcpServerOpts *self, int cpusteering)
+    CMETHOD;
+
+/** Set the placement policy.
+ * When worker threads are used (see PSC_RunOpts_workerThreads()), this
+ * decides which service thread handles a new connection. PSC_PP_IPHASH keeps
+ * connections from the same remote address on the same thread, which helps
+ * with per-client state. PSC_PP_LEASTBUSY uses PSC_Service_threadLoad(),
+ * which helps with workloads where connections differ a lot in the CPU
+ * time they need. The default is PSC_PP_LEASTCONN.
+ *
+ * This has no effect with per-thread listeners (see
+ * PSC_TcpServerOpts_reusePort()), where the kernel selects the thread.
+ * When a limit per service thread is configured (see
+ * PSC_TcpServerOpts_maxThreadConnections()), a thread that reached it is
+ * never selected, the thread with the fewest active connections is used
+ * instead.
+ * @memberof PSC_TcpServerOpts
+ * @param self the PSC_TcpServerOpts
+ * @param policy the placement policy
+ */
+DECLEXPORT void
+PSC_TcpServerOpts_placement(PSC_TcpServerOpts *self,
+	PSC_PlacementPolicy policy)
+    CMETHOD;
+
+/** Set a custom placement hook.
+ * The hook is called on the main thread for every new connection and
+ * overrides the placement policy (see PSC_TcpServerOpts_placement()),
+ * with the same restrictions.
+ * @memberof PSC_TcpServerOpts
+ * @param self the PSC_TcpServerOpts
+ * @param obj optional object reference passed to the hook
+ * @param hook the placement hook, NULL to use the placement policy again
+ */
+DECLEXPORT void
+PSC_TcpServerOpts_placementHook(PSC_TcpServerOpts *self, void *obj,
+	PSC_PlacementHook hook)
+    CMETHOD;
+
+/** Limit the number of concurrent connections.
+ * When this number of connections is reached, new connections are handled
+ * according to the overload policy (see
+ * PSC_TcpServerOpts_overloadPolicy()). The default is no limit.
+ * @memberof PSC_TcpServerOpts
+ * @param self the PSC_TcpServerOpts
+ * @param max the maximum number of connections, 0 for no limit
+ */
+DECLEXPORT void
+PSC_TcpServerOpts_maxConnections(PSC_TcpServerOpts *self, size_t max)
+    CMETHOD;
+
+/** Limit the number of concurrent connections per service thread.
+ * Connections are only assigned to service threads below this limit. When
+ * all of them reached it, new connections are handled according to the
+ * overload policy (see PSC_TcpServerOpts_overloadPolicy()). The default is
+ * no limit.
+ * @memberof PSC_TcpServerOpts
+ * @param self the PSC_TcpServerOpts
+ * @param max the maximum number of connections per service thread, 0 for
+ *            no limit
+ */
+DECLEXPORT void
+PSC_TcpServerOpts_maxThreadConnections(PSC_TcpServerOpts *self, size_t max)
+    CMETHOD;
+
+/** Limit the rate of accepting new connections.
+ * New connections exceeding this rate are handled according to the overload
+ * policy (see PSC_TcpServerOpts_overloadPolicy()). Bursts of up to one
+ * second worth of connections are allowed. With per-thread listeners (see
+ * PSC_TcpServerOpts_reusePort()), the rate is split evenly among the service
+ * threads. The default is no limit.
+ * @memberof PSC_TcpServerOpts
+ * @param self the PSC_TcpServerOpts
+ * @param rate the maximum number of connections per second, 0 for no limit
+ */
+DECLEXPORT void
+PSC_TcpServerOpts_maxAcceptRate(PSC_TcpServerOpts *self, unsigned rate)
+    CMETHOD;
+
+/** Limit the number of pending TLS handshakes.
+ * When TLS is enabled, this limits the number of connections that didn't
+ * complete the TLS handshake yet. New connections exceeding it are handled
+ * according to the overload policy (see PSC_TcpServerOpts_overloadPolicy()).
+ * The default is no limit.
+ * @memberof PSC_TcpServerOpts
+ * @param self the PSC_TcpServerOpts
+ * @param max the maximum number of pending TLS handshakes, 0 for no limit
+ */
+DECLEXPORT void
+PSC_TcpServerOpts_maxPendingTls(PSC_TcpServerOpts *self, size_t max)
+    CMETHOD;
+
+/** Block connections from an address or network.
+ * Connections from blocked addresses are reset immediately after accepting
+ * them, before any resources are allocated for them, and counted as
+ * PSC_SC_REJECTED. This can be called multiple times to block several
+ * addresses or networks. Unlike most other options, the blocklist can be
+ * changed at runtime using PSC_Server_configureTcp().
+ * @memberof PSC_TcpServerOpts
+ * @param self the PSC_TcpServerOpts
+ * @param prefix the address to block, its prefix length determines the size
+ *               of the blocked network
+ */
+DECLEXPORT void
+PSC_TcpServerOpts_block(PSC_TcpServerOpts *self, const PSC_IpAddr *prefix)
+    CMETHOD ATTR_NONNULL((2));
+
+/** Add a per-address limit for new connections.
+ * Configures a limit to allow at most @p limit new connections from the same
+ * remote address in @p seconds seconds. IPv6 addresses are counted per /64
+ * network. Connections exceeding it are reset immediately after accepting
+ * them, before any resources are allocated for them, and counted as
+ * PSC_SC_REJECTED. This can be called multiple times to configure several
+ * limits that must all be satisfied, see PSC_RateLimit for details.
+ * @memberof PSC_TcpServerOpts
+ * @param self the PSC_TcpServerOpts
+ * @param seconds number of seconds (min: 1, max: 65535)
+ * @param limit number of connections (min: 1, max: 65535)
+ * @returns 0 on success, -1 on error
+ */
+DECLEXPORT int
+PSC_TcpServerOpts_rateLimit(PSC_TcpServerOpts *self, int seconds, int limit)
+    CMETHOD;
+
+/** Set the overload policy.
+ * This decides what happens to new connections when one of the configured
+ * limits is reached. With PSC_OP_RESET, they are accepted and immediately
+ * reset, which is counted as PSC_SC_REJECTED. With PSC_OP_PAUSE, the
+ * listening sockets are removed from the service loop, so connection
+ * requests queue up in the kernel's backlog, until a new connection can be
+ * admitted again. The default is PSC_OP_RESET.
+ * @memberof PSC_TcpServerOpts
+ * @param self the PSC_TcpServerOpts
+ * @param policy the overload policy
+ */
+DECLEXPORT void
+PSC_TcpServerOpts_overloadPolicy(PSC_TcpServerOpts *self,
+	PSC_OverloadPolicy policy)
+    CMETHOD;
+
 /** Enable TLS for the server.
  * Causes TLS to be enabled for any incoming connection, using a server
  * certificate. Note the certificate is required.
@@ -224,9 +442,11 @@ PSC_Server_createTcp(const PSC_TcpServerOpts *opts, void *owner,
 
 /** Reconfigure a running TCP server.
  * Try to apply a new configuration to an already running server. The port,
- * protocol preference, read buffer size and list of bind addresses cannot
- * be changed at runtime. If the configuration is the same as before, this
- * silently succeeds.
+ * protocol preference, read buffer size, accept batch size, per-thread
+ * listening mode, connection limits, per-address rate limits, overload
+ * policy, placement policy and list of bind addresses cannot be changed at
+ * runtime.
+ * If the configuration is the same as before, this silently succeeds.
  * @memberof PSC_Server
  * @param self the PSC_Server
  * @param opts the new TCP server options
@@ -253,6 +473,38 @@ PSC_Server_createUnix(const PSC_UnixServerOpts *opts, void *owner,
 	void (*shutdownComplete)(void *))
     ATTR_NONNULL((1)) ATTR_NONNULL((3));
 
+/** Hand over listening sockets to a new instance of the program.
+ * This starts a new process executing @p path, and passes the listening
+ * sockets of all TCP servers to it over a UNIX socket. In the new process,
+ * PSC_Server_createTcp() adopts these sockets instead of creating new ones
+ * when the port, protocol preference and list of bind addresses match, so
+ * no connection requests are refused during the restart. With
+ * PSC_TcpServerOpts_reusePort(), the per-thread listeners are handed over
+ * as well, and the new process reuses them for its own service threads,
+ * whatever their number, so connections queued on them aren't lost.
+ *
+ * Once the service loop of the new process runs, it confirms the upgrade,
+ * and this process quits its service loop with PSC_Service_quit(). Handle
+ * PSC_Service_shutdown() to drain existing connections, e.g. with
+ * PSC_Server_shutdown() and a timeout. If the new process fails, this
+ * process just continues to serve.
+ *
+ * All TCP servers must be created in the new process during startup, any
+ * inherited sockets not adopted until then are closed. When running as a
+ * daemon, the new process doesn't detach again and takes over the pidfile
+ * when this process exits. Established connections and UNIX servers are
+ * not handed over.
+ * @memberof PSC_Server
+ * @static
+ * @param path the path of the executable to start
+ * @param argv the arguments for the new process, including the program name
+ *             as the first one, terminated by a NULL pointer
+ * @returns 0 if the new process was started, -1 on error
+ */
+DECLEXPORT int
+PSC_Server_upgrade(const char *path, char *const argv[])
+    ATTR_NONNULL((1)) ATTR_NONNULL((2));
+
 /** Disable the server.
  * This disables accepting new connections while still listening. It's
  * implemented by immediately closing any new connection with a linger timeout
@@ -286,6 +538,23 @@ DECLEXPORT size_t
 PSC_Server_connections(const PSC_Server *self)
     CMETHOD;
 
+/** Get a counter value.
+ * Counters are kept separately for each service thread handling
+ * connections, so updating them is cheap. Reading them from a different
+ * thread may give slightly outdated values.
+ * @memberof PSC_Server
+ * @param self the PSC_Server
+ * @param thrno the service thread number (see PSC_Service_threadNo()), or
+ *              -1 to get the sum over all threads. Without worker threads,
+ *              all counters are kept at thread number 0.
+ * @param counter the counter to read
+ * @returns the counter value
+ */
+DECLEXPORT uint64_t
+PSC_Server_counter(const PSC_Server *self, int thrno,
+	PSC_ServerCounter counter)
+    CMETHOD;
+
 /** Graceful server shutdown.
  * This will stop listening, but defer destruction until all client
  * connections are closed or the given timeout is reached. The server is
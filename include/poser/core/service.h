@@ -6,6 +6,7 @@
  */
 
 #include <poser/decl.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 /** Maximum number of panic handlers that can be registered */
@@ -338,6 +339,40 @@ PSC_Service_workers(void);
 DECLEXPORT int
 PSC_Service_threadNo(void);
 
+/** Get the recent load of a service thread.
+ * The load is the fraction of time the service loop of the thread spent
+ * handling events instead of waiting for them, measured in windows of 100
+ * milliseconds and smoothed over the last few windows.
+ * @memberof PSC_Service
+ * @static
+ * @param threadNo the number of the worker thread, or a negative number for
+ *                 the main thread
+ * @returns the load in per mille (0 - 1000), or 0 if there's no such thread
+ */
+DECLEXPORT unsigned
+PSC_Service_threadLoad(int threadNo);
+
+/** Get a monotonic timestamp.
+ * Inside a running service loop, the timestamp is taken once per loop
+ * iteration, right after waiting for events, so it's cheap to call this
+ * repeatedly while handling events. Otherwise, the clock is read directly.
+ * See also PSC_RunOpts_coarseClock().
+ * @memberof PSC_Service
+ * @static
+ * @returns a monotonic timestamp in nanoseconds
+ */
+DECLEXPORT uint64_t
+PSC_Service_now(void);
+
+/** Get a monotonic timestamp in milliseconds.
+ * This works like PSC_Service_now(), but returns milliseconds.
+ * @memberof PSC_Service
+ * @static
+ * @returns a monotonic timestamp in milliseconds
+ */
+DECLEXPORT uint64_t
+PSC_Service_nowMs(void);
+
 /** Schedule a function for execution on a different thread.
  * The given function is scheduled for execution on the worker thread
  * specified by @p threadNo. If called from the target thread, the function
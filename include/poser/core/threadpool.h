@@ -7,6 +7,12 @@
 
 #include <poser/decl.h>
 
+#include <stddef.h>
+#include <stdint.h>
+
+/** Number of buckets in histograms of PSC_ThreadPoolStats */
+#define PSC_TP_HISTBUCKETS 32
+
 /** A job to be executed on a worker thread.
  * @class PSC_ThreadJob threadpool.h <poser/core/threadpool.h>
  */
@@ -31,12 +37,25 @@ C_CLASS_DECL(PSC_AsyncTask);
  */
 
 /** A thread pool.
- * This class creates a fixed set of worker threads and a queue of
+ * This class creates a fixed set of worker threads and queues of
  * PSC_ThreadJob objects for jobs to be executed on a worker thread. An event
  * will be fired when a job completes. Running jobs can also be canceled.
+ *
+ * Every thread enqueueing jobs gets its own queue for each class of jobs,
+ * which idle worker threads take jobs from. Jobs of the same class enqueued
+ * from the same thread are started in the order they were enqueued.
  * @class PSC_ThreadPool threadpool.h <poser/core/threadpool.h>
  */
 
+/** A snapshot of thread pool statistics.
+ * Durations are measured in microseconds. Histograms use buckets with
+ * exponentially growing limits, see PSC_ThreadPoolStats_bucketLimit().
+ * Async jobs (see PSC_ThreadJob_setAsync()) are counted once for each time
+ * they are run or resumed.
+ * @class PSC_ThreadPoolStats threadpool.h <poser/core/threadpool.h>
+ */
+C_CLASS_DECL(PSC_ThreadPoolStats);
+
 C_CLASS_DECL(PSC_Event);
 
 /** A function to run on a worker thread.
@@ -44,17 +63,95 @@ C_CLASS_DECL(PSC_Event);
  */
 typedef void (*PSC_ThreadProc)(void *arg);
 
+/** A function to call when a job submitted with PSC_ThreadPool_submit()
+ * finished.
+ * @param arg the data the job worked on
+ * @param completed 1 if the job completed, 0 if it was canceled
+ */
+typedef void (*PSC_ThreadJobDone)(void *arg, int completed);
+
+/** A function processing a range of items on a worker thread.
+ * Used with PSC_ThreadPool_parallelFor().
+ * @param arg the data to work on
+ * @param begin index of the first item to process
+ * @param end index after the last item to process
+ */
+typedef void (*PSC_RangeProc)(void *arg, size_t begin, size_t end);
+
+/** A function computing a partial result for a range of items.
+ * Used with PSC_ThreadPool_parallelReduce().
+ * @param arg the data to work on
+ * @param begin index of the first item to process
+ * @param end index after the last item to process
+ * @returns the result for the range
+ */
+typedef void *(*PSC_RangeMapProc)(void *arg, size_t begin, size_t end);
+
+/** A function combining two partial results.
+ * Used with PSC_ThreadPool_parallelReduce(). It must be associative and
+ * commutative, because ranges aren't combined in any specific order. It's
+ * responsible for releasing the partial results if needed.
+ * @param arg the data to work on
+ * @param a a partial result
+ * @param b another partial result
+ * @returns the combined result
+ */
+typedef void *(*PSC_CombineProc)(void *arg, void *a, void *b);
+
+/** A function to call when parallel work finished.
+ * @param arg the data worked on
+ * @param result the combined result for PSC_ThreadPool_parallelReduce(),
+ *               NULL for PSC_ThreadPool_parallelFor()
+ */
+typedef void (*PSC_ParallelDone)(void *arg, void *result);
+
 /** A function to run for completing an asynchronous task.
  * @param task the task to complete
  */
 typedef void (*PSC_AsyncTaskJob)(PSC_AsyncTask *task);
 
+/** What to do with a job enqueued while the queue is full.
+ */
+typedef enum PSC_QueuePolicy
+{
+    PSC_QP_REJECT,  /**< fail to enqueue the job */
+    PSC_QP_GROW,    /**< grow the queue, so it never becomes full */
+    PSC_QP_INLINE,  /**< run the job synchronously on the calling thread */
+    PSC_QP_DEFER    /**< keep the job and enqueue it once there's space */
+} PSC_QueuePolicy;
+
+/** Classes of thread jobs.
+ * Worker threads take jobs of the different classes in weighted round-robin
+ * order, and the number of worker threads busy with jobs of one class can be
+ * limited, see PSC_ThreadOpts_classWeight() and PSC_ThreadOpts_classLimit().
+ */
+typedef enum PSC_ThreadJobClass
+{
+    PSC_JC_DEFAULT,	/**< jobs not assigned to any class */
+    PSC_JC_CRITICAL,	/**< latency-critical jobs */
+    PSC_JC_RESOLVE,	/**< name resolution, used by the library */
+    PSC_JC_BACKGROUND	/**< background work, e.g. async log writing */
+} PSC_ThreadJobClass;
+
+/** Sizes of the private stack of async thread jobs.
+ * Private stacks have a guard page below them, so a stack overflow crashes
+ * the program instead of silently corrupting memory.
+ */
+typedef enum PSC_StackSize
+{
+    PSC_SS_DEFAULT,	/**< 2 MiB */
+    PSC_SS_SMALL,	/**< 64 kiB, for simple jobs without deep recursion */
+    PSC_SS_MEDIUM,	/**< 256 kiB */
+    PSC_SS_LARGE	/**< 8 MiB */
+} PSC_StackSize;
+
 /** Create a new thread job.
  * Creates a new job to be executed on a worker thread. Unless the library was
  * built on a system without POSIX user context switching support, the job may
  * execute on its own private stack with a default size of 2 MiB, allowing
  * a PSC_AsyncTask to release the thread for other work while waiting. To
- * enable this behavior, call PSC_ThreadJob_setAsync(),
+ * enable this behavior, call PSC_ThreadJob_setAsync(), the stack size can
+ * be selected with PSC_ThreadJob_setStackSize().
  * @memberof PSC_ThreadJob
  * @param proc the function to run on the worker thread
  * @param arg the data to work on
@@ -81,6 +178,28 @@ DECLEXPORT void
 PSC_ThreadJob_setAsync(PSC_ThreadJob *self)
     CMETHOD;
 
+/** Set the size of the private stack for the job.
+ * Only used with PSC_ThreadJob_setAsync(). Smaller stacks save memory when
+ * many jobs await a PSC_AsyncTask at the same time. Must be called before
+ * enqueueing the job. Default is PSC_SS_DEFAULT.
+ * @memberof PSC_ThreadJob
+ * @param self the PSC_ThreadJob
+ * @param size the stack size
+ */
+DECLEXPORT void
+PSC_ThreadJob_setStackSize(PSC_ThreadJob *self, PSC_StackSize size)
+    CMETHOD;
+
+/** Set the class of the job.
+ * Must be called before enqueueing the job. Default is PSC_JC_DEFAULT.
+ * @memberof PSC_ThreadJob
+ * @param self the PSC_ThreadJob
+ * @param cls the job class
+ */
+DECLEXPORT void
+PSC_ThreadJob_setClass(PSC_ThreadJob *self, PSC_ThreadJobClass cls)
+    CMETHOD;
+
 /** The job finished.
  * This event fires when the thread job finished, either because it completed
  * or because it was canceled.
@@ -124,6 +243,19 @@ PSC_ThreadJob_destroy(PSC_ThreadJob *self);
 DECLEXPORT int
 PSC_ThreadJob_canceled(void);
 
+/** Get a file descriptor signaling cancellation of the job.
+ * This must only be called from within a PSC_ThreadProc. It returns a file
+ * descriptor that becomes readable once the job is canceled, so a job
+ * waiting for I/O can include it in its call to poll() or similar instead
+ * of periodically checking PSC_ThreadJob_canceled(). The descriptor is
+ * created on first use and owned by the job, it must not be closed.
+ * @memberof PSC_ThreadJob
+ * @static
+ * @returns a readable file descriptor, or -1 on error
+ */
+DECLEXPORT int
+PSC_ThreadJob_cancelFd(void);
+
 /** Check whether PSC_AsyncTask_await() will always block.
  * This method tells at runtime whether awaiting a PSC_AsyncTask will always
  * block the worker thread (which is the case on systems without support for
@@ -148,10 +280,12 @@ DECLEXPORT PSC_AsyncTask *
 PSC_AsyncTask_create(PSC_AsyncTaskJob job);
 
 /** Wait for completion of an async task.
+ * This must only be called from a thread job running on a pool thread,
+ * otherwise it fails and the task is destroyed without being executed.
  * @memberof PSC_AsyncTask
  * @param self the PSC_AsyncTask
  * @param arg an optional argument to pass to the async task
- * @returns the result given to PSC_AsyncTask_complete()
+ * @returns the result given to PSC_AsyncTask_complete(), or NULL on error
  */
 DECLEXPORT void *
 PSC_AsyncTask_await(PSC_AsyncTask *self, void *arg);
@@ -212,7 +346,46 @@ PSC_ThreadOpts_threadsPerCpu(int n);
 DECLEXPORT void
 PSC_ThreadOpts_maxThreads(int n);
 
+/** Size the thread pool dynamically.
+ * The number of threads calculated from the other options becomes the
+ * maximum, and the pool starts with only minThreads worker threads. While
+ * jobs are waiting and no worker thread is idle, another one is started
+ * every spawn delay. Worker threads blocked in PSC_AsyncTask_await() don't
+ * count as busy. Worker threads idle for longer than the idle timeout are
+ * stopped again, but never less than minThreads are kept. This only takes
+ * effect when the pool is initialized by the running service. Default is
+ * 0, which means a fixed number of threads.
+ * @memberof PSC_ThreadOpts
+ * @static
+ * @param minThreads minimum number of threads, must be > 0 to enable
+ *                   dynamic sizing
+ */
+DECLEXPORT void
+PSC_ThreadOpts_elastic(int minThreads);
+
+/** Set the delay for starting another thread.
+ * Only used with PSC_ThreadOpts_elastic(). Another worker thread is started
+ * when the number of waiting jobs didn't decrease for this time. Default is
+ * 100 milliseconds.
+ * @memberof PSC_ThreadOpts
+ * @static
+ * @param ms delay in milliseconds, must be > 0
+ */
+DECLEXPORT void
+PSC_ThreadOpts_spawnDelay(int ms);
+
+/** Set the idle timeout for threads.
+ * Only used with PSC_ThreadOpts_elastic(). Default is 30 seconds.
+ * @memberof PSC_ThreadOpts
+ * @static
+ * @param ms stop worker threads idle for this many milliseconds, must be
+ *           > 0
+ */
+DECLEXPORT void
+PSC_ThreadOpts_idleTimeout(int ms);
+
 /** Set a fixed queue size for waiting thread jobs.
+ * The queue size applies to each thread enqueueing jobs and each job class.
  * @memberof PSC_ThreadOpts
  * @static
  * @param n fixed size of the queue
@@ -246,6 +419,48 @@ PSC_ThreadOpts_maxQueue(int n);
 DECLEXPORT void
 PSC_ThreadOpts_minQueue(int n);
 
+/** Set the policy for jobs enqueued while the queue is full.
+ * With PSC_QP_GROW, the configured queue size is only the initial size.
+ * PSC_QP_INLINE doesn't apply to jobs with PSC_ThreadJob_setAsync(), they
+ * are rejected instead, so jobs that might await a PSC_AsyncTask should
+ * always be marked with it, awaiting a task fails in a job run inline. A
+ * job run inline can't time out. Its finished event still fires later,
+ * after all events of the current service loop iteration were handled.
+ * Jobs kept with PSC_QP_DEFER are enqueued in order before any job enqueued
+ * later from the same thread. Default is PSC_QP_REJECT.
+ * @memberof PSC_ThreadOpts
+ * @static
+ * @param policy the queue overflow policy
+ */
+DECLEXPORT void
+PSC_ThreadOpts_queuePolicy(PSC_QueuePolicy policy);
+
+/** Set the weight of a job class.
+ * When jobs of several classes are waiting, worker threads take them in
+ * proportion to the weights of their classes. Jobs of a class with weight 0
+ * are only taken when no other jobs are waiting. Defaults are 8 for
+ * PSC_JC_CRITICAL, 4 for PSC_JC_DEFAULT, 2 for PSC_JC_RESOLVE and 1 for
+ * PSC_JC_BACKGROUND.
+ * @memberof PSC_ThreadOpts
+ * @static
+ * @param cls the job class
+ * @param weight the weight of the class
+ */
+DECLEXPORT void
+PSC_ThreadOpts_classWeight(PSC_ThreadJobClass cls, int weight);
+
+/** Limit the number of worker threads busy with jobs of a class.
+ * While the limit is reached, further jobs of this class wait in the queue,
+ * even if idle worker threads are available. Default is 0 for all classes,
+ * which means no limit.
+ * @memberof PSC_ThreadOpts
+ * @static
+ * @param cls the job class
+ * @param n maximum number of worker threads running jobs of this class
+ */
+DECLEXPORT void
+PSC_ThreadOpts_classLimit(PSC_ThreadJobClass cls, int n);
+
 /** Initialize the thread pool.
  * This launches the worker threads, according to the configuration from
  * PSC_ThreadOpts.
@@ -264,6 +479,28 @@ PSC_ThreadPool_init(void);
 DECLEXPORT int
 PSC_ThreadPool_active(void);
 
+/** The current number of worker threads.
+ * Without PSC_ThreadOpts_elastic(), this is always the configured number
+ * of threads while the pool is active.
+ * @memberof PSC_ThreadPool
+ * @static
+ * @returns the number of worker threads, 0 if the pool isn't active
+ */
+DECLEXPORT int
+PSC_ThreadPool_size(void);
+
+/** Get statistics of the thread pool.
+ * Takes a snapshot of the statistics collected since the thread pool was
+ * initialized.
+ * @memberof PSC_ThreadPool
+ * @static
+ * @returns a newly created statistics snapshot, must be destroyed with
+ *          PSC_ThreadPoolStats_destroy()
+ */
+DECLEXPORT PSC_ThreadPoolStats *
+PSC_ThreadPool_stats(void)
+    ATTR_RETNONNULL;
+
 /** Enqueue a thread job.
  * If a worker thread is available, the job is started on it directly,
  * otherwise it is put in the queue of waiting jobs.
@@ -272,17 +509,125 @@ PSC_ThreadPool_active(void);
  * @memberof PSC_ThreadPool
  * @static
  * @param job the job to enqueue/start
- * @returns -1 on error (queue overflow), 0 on success
+ * @returns -1 on error (queue of the calling thread full and the job was
+ *          rejected), 0 on success
  */
 DECLEXPORT int
 PSC_ThreadPool_enqueue(PSC_ThreadJob *job)
     ATTR_NONNULL((1));
 
+/** Enqueue several thread jobs at once.
+ * This works like calling PSC_ThreadPool_enqueue() for each job, but makes
+ * all of them available to the worker threads at once and wakes up as many
+ * idle worker threads as needed in one go.
+ *
+ * If a job can't be enqueued, this stops. The pool takes ownership of the
+ * jobs enqueued, the remaining ones stay owned by the caller.
+ * @memberof PSC_ThreadPool
+ * @static
+ * @param jobs the jobs to enqueue
+ * @param n the number of jobs
+ * @returns the number of jobs enqueued
+ */
+DECLEXPORT size_t
+PSC_ThreadPool_enqueueBatch(PSC_ThreadJob **jobs, size_t n)
+    ATTR_NONNULL((1));
+
+/** Submit a lightweight job.
+ * This works like creating a PSC_ThreadJob without a timeout and enqueueing
+ * it, but no finished event is created for the job. Instead, the given
+ * callback is called on the calling thread when the job finished. Job
+ * objects are recycled per thread, so this normally doesn't allocate any
+ * memory.
+ * @memberof PSC_ThreadPool
+ * @static
+ * @param proc the function to run on the worker thread
+ * @param arg the data to work on
+ * @param done optional callback to call when the job finished
+ * @returns -1 on error (queue of the calling thread full and the job was
+ *          rejected), 0 on success
+ */
+DECLEXPORT int
+PSC_ThreadPool_submit(PSC_ThreadProc proc, void *arg, PSC_ThreadJobDone done)
+    ATTR_NONNULL((1));
+
+/** Process a range of items in parallel.
+ * The items from 0 to count - 1 are split into ranges processed on worker
+ * threads. Ranges are taken from what's left in shrinking portions, but are
+ * never smaller than the grain size, so the worker threads finish at about
+ * the same time. When all items are processed, the done callback is called
+ * on the calling thread.
+ *
+ * If the thread pool isn't active or no job could be enqueued, all items
+ * are processed synchronously and the done callback is called before this
+ * function returns.
+ * @memberof PSC_ThreadPool
+ * @static
+ * @param count the number of items
+ * @param grain the minimum number of items processed in one range
+ * @param proc the function processing a range
+ * @param arg the data to work on
+ * @param done optional callback to call when all items were processed
+ * @returns -1 on error (called from a worker thread), 0 on success
+ */
+DECLEXPORT int
+PSC_ThreadPool_parallelFor(size_t count, size_t grain,
+	PSC_RangeProc proc, void *arg, PSC_ParallelDone done)
+    ATTR_NONNULL((3));
+
+/** Compute a result from a range of items in parallel.
+ * This works like PSC_ThreadPool_parallelFor(), but the function processing
+ * a range returns a partial result. Every worker thread combines the
+ * results of the ranges it processed, and the results of all worker threads
+ * are combined on the calling thread and passed to the done callback. If
+ * there are no items, the result is NULL.
+ * @memberof PSC_ThreadPool
+ * @static
+ * @param count the number of items
+ * @param grain the minimum number of items processed in one range
+ * @param map the function computing the result for a range
+ * @param combine the function combining two results
+ * @param arg the data to work on
+ * @param done callback to call with the result
+ * @returns -1 on error (called from a worker thread), 0 on success
+ */
+DECLEXPORT int
+PSC_ThreadPool_parallelReduce(size_t count, size_t grain,
+	PSC_RangeMapProc map, PSC_CombineProc combine, void *arg,
+	PSC_ParallelDone done)
+    ATTR_NONNULL((3)) ATTR_NONNULL((4)) ATTR_NONNULL((6));
+
+/** The queue of the calling thread became full.
+ * This event fires on the thread trying to enqueue a job to its full queue,
+ * before the job is handled according to the configured PSC_QueuePolicy.
+ * It only fires again after PSC_ThreadPool_queueAvailable() fired, so it can
+ * be used to stop reading from connections producing thread jobs.
+ * @memberof PSC_ThreadPool
+ * @static
+ * @returns the queue full event
+ */
+DECLEXPORT PSC_Event *
+PSC_ThreadPool_queueFull(void)
+    ATTR_RETNONNULL ATTR_PURE;
+
+/** The queue of the calling thread has space again.
+ * This event fires on the thread that saw its queue full, once a worker
+ * thread took a job from it and all jobs kept with PSC_QP_DEFER were
+ * enqueued.
+ * @memberof PSC_ThreadPool
+ * @static
+ * @returns the queue available event
+ */
+DECLEXPORT PSC_Event *
+PSC_ThreadPool_queueAvailable(void)
+    ATTR_RETNONNULL ATTR_PURE;
+
 /** Cancel a thread job.
- * If the job is already running, it is sent an interrupting signal and have a
- * flag set that can be checked with PSC_ThreadJob_canceled(). If it is still
- * waiting in the queue, it is just removed and destroyed. In any case, its
- * finished event will fire.
+ * If the job is already running, it has a flag set that can be checked with
+ * PSC_ThreadJob_canceled(), and the file descriptor obtained from
+ * PSC_ThreadJob_cancelFd() becomes readable. Cancellation is cooperative,
+ * the job is never interrupted. If it is still waiting in the queue, it is
+ * just removed and destroyed. In any case, its finished event will fire.
  * @memberof PSC_ThreadPool
  * @static
  * @param job the job to cancel
@@ -299,4 +644,127 @@ PSC_ThreadPool_cancel(PSC_ThreadJob *job)
 DECLEXPORT void
 PSC_ThreadPool_done(void);
 
+/** Number of jobs run.
+ * @memberof PSC_ThreadPoolStats
+ * @param self the PSC_ThreadPoolStats
+ * @returns the number of jobs run on worker threads
+ */
+DECLEXPORT uint64_t
+PSC_ThreadPoolStats_jobs(const PSC_ThreadPoolStats *self)
+    CMETHOD ATTR_PURE;
+
+/** Number of rejected jobs.
+ * @memberof PSC_ThreadPoolStats
+ * @param self the PSC_ThreadPoolStats
+ * @returns the number of jobs that couldn't be enqueued because the queue
+ *          was full
+ */
+DECLEXPORT uint64_t
+PSC_ThreadPoolStats_rejected(const PSC_ThreadPoolStats *self)
+    CMETHOD ATTR_PURE;
+
+/** Number of timed out jobs.
+ * @memberof PSC_ThreadPoolStats
+ * @param self the PSC_ThreadPoolStats
+ * @returns the number of jobs canceled because their timeout expired
+ */
+DECLEXPORT uint64_t
+PSC_ThreadPoolStats_timeouts(const PSC_ThreadPoolStats *self)
+    CMETHOD ATTR_PURE;
+
+/** Number of canceled jobs.
+ * @memberof PSC_ThreadPoolStats
+ * @param self the PSC_ThreadPoolStats
+ * @returns the number of calls to PSC_ThreadPool_cancel()
+ */
+DECLEXPORT uint64_t
+PSC_ThreadPoolStats_canceled(const PSC_ThreadPoolStats *self)
+    CMETHOD ATTR_PURE;
+
+/** Upper limit of a histogram bucket.
+ * Bucket 0 counts durations below 1 microsecond, every further bucket
+ * counts durations of at least the limit of the previous bucket and below
+ * twice that limit. The last bucket counts all longer durations.
+ * @memberof PSC_ThreadPoolStats
+ * @static
+ * @param bucket the bucket, must be less than PSC_TP_HISTBUCKETS
+ * @returns the exclusive upper limit in microseconds, or UINT64_MAX for
+ *          the last bucket
+ */
+DECLEXPORT uint64_t
+PSC_ThreadPoolStats_bucketLimit(unsigned bucket)
+    ATTR_CONST;
+
+/** Histogram of the time jobs waited in the queue.
+ * @memberof PSC_ThreadPoolStats
+ * @param self the PSC_ThreadPoolStats
+ * @param bucket the bucket, must be less than PSC_TP_HISTBUCKETS
+ * @returns the number of jobs that waited for a duration in this bucket
+ */
+DECLEXPORT uint64_t
+PSC_ThreadPoolStats_queueWait(const PSC_ThreadPoolStats *self,
+	unsigned bucket)
+    CMETHOD ATTR_PURE;
+
+/** Total time jobs waited in the queue.
+ * @memberof PSC_ThreadPoolStats
+ * @param self the PSC_ThreadPoolStats
+ * @returns the sum of all queue waiting times in microseconds
+ */
+DECLEXPORT uint64_t
+PSC_ThreadPoolStats_queueWaitTotal(const PSC_ThreadPoolStats *self)
+    CMETHOD ATTR_PURE;
+
+/** Histogram of the time jobs were running.
+ * @memberof PSC_ThreadPoolStats
+ * @param self the PSC_ThreadPoolStats
+ * @param bucket the bucket, must be less than PSC_TP_HISTBUCKETS
+ * @returns the number of jobs that ran for a duration in this bucket
+ */
+DECLEXPORT uint64_t
+PSC_ThreadPoolStats_runTime(const PSC_ThreadPoolStats *self,
+	unsigned bucket)
+    CMETHOD ATTR_PURE;
+
+/** Total time jobs were running.
+ * @memberof PSC_ThreadPoolStats
+ * @param self the PSC_ThreadPoolStats
+ * @returns the sum of all running times in microseconds
+ */
+DECLEXPORT uint64_t
+PSC_ThreadPoolStats_runTimeTotal(const PSC_ThreadPoolStats *self)
+    CMETHOD ATTR_PURE;
+
+/** Number of worker slots.
+ * This is the maximum number of worker threads, see
+ * PSC_ThreadOpts_elastic().
+ * @memberof PSC_ThreadPoolStats
+ * @param self the PSC_ThreadPoolStats
+ * @returns the number of worker slots, 0 if the pool isn't active
+ */
+DECLEXPORT int
+PSC_ThreadPoolStats_workers(const PSC_ThreadPoolStats *self)
+    CMETHOD ATTR_PURE;
+
+/** Recent busy ratio of a worker thread.
+ * This is the fraction of time the worker thread spent running jobs,
+ * measured in windows of 100 milliseconds and smoothed over the last few
+ * windows.
+ * @memberof PSC_ThreadPoolStats
+ * @param self the PSC_ThreadPoolStats
+ * @param worker the worker slot, must be less than
+ *               PSC_ThreadPoolStats_workers()
+ * @returns the busy ratio in per mille (0 - 1000)
+ */
+DECLEXPORT unsigned
+PSC_ThreadPoolStats_busy(const PSC_ThreadPoolStats *self, int worker)
+    CMETHOD ATTR_PURE;
+
+/** PSC_ThreadPoolStats destructor.
+ * @memberof PSC_ThreadPoolStats
+ * @param self the PSC_ThreadPoolStats
+ */
+DECLEXPORT void
+PSC_ThreadPoolStats_destroy(PSC_ThreadPoolStats *self);
+
 #endif
@@ -46,6 +46,21 @@ DECLEXPORT void
 PSC_Timer_setMs(PSC_Timer *self, unsigned ms)
     CMETHOD;
 
+/** Set the timer slack in milliseconds.
+ * Allows the timer to expire up to this amount of time late, so expirations
+ * of many timers can be delivered together in a single wakeup of the service
+ * loop. This is useful for a large number of timeouts that don't need to be
+ * precise. Takes effect the next time the timer is started. The initial
+ * value is 0 (no slack). Only the timerfd implementation (on Linux and
+ * some BSD systems) honors this, all others ignore it.
+ * @memberof PSC_Timer
+ * @param self the PSC_Timer
+ * @param ms slack in milliseconds
+ */
+DECLEXPORT void
+PSC_Timer_setSlack(PSC_Timer *self, unsigned ms)
+    CMETHOD;
+
 /** Start the timer.
  * Starts the timer. An expired event will be fired after the configured.
  * If the timer is already running, stops and restarts it.
@@ -4,6 +4,7 @@
 #include "connection.h"
 #include "ipaddr.h"
 
+#include <poser/core/dictionary.h>
 #include <poser/core/event.h>
 #include <poser/core/log.h>
 #include <poser/core/service.h>
@@ -13,6 +14,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -25,7 +29,7 @@
 #include <openssl/ssl.h>
 #endif
 
-#define BLACKLISTSIZE 32
+#define BLACKLISTCLEAN 64
 
 struct PSC_TcpClientOpts
 {
@@ -41,6 +45,9 @@ struct PSC_TcpClientOpts
     int noverify;
 #endif
     int blacklisthits;
+    unsigned blacklistttl;
+    uint8_t blacklistlen4;
+    uint8_t blacklistlen6;
     int refcnt;
     char remotehost[];
 };
@@ -53,7 +60,7 @@ struct PSC_UnixClientOpts
 
 typedef struct BlacklistEntry
 {
-    PSC_IpAddr *addr;
+    uint64_t expires;
     int hits;
 } BlacklistEntry;
 
@@ -69,7 +76,13 @@ typedef struct ResolveJobData
     PSC_TcpClientOpts *opts;
 } ResolveJobData;
 
-static BlacklistEntry blacklist[BLACKLISTSIZE];
+/* entries are keyed by protocol, prefix length and the masked address,
+ * nlens counts the entries per protocol and prefix length, so a check only
+ * needs one lookup per prefix length actually in use */
+static pthread_mutex_t blacklistlock = PTHREAD_MUTEX_INITIALIZER;
+static PSC_Dictionary *blacklist;
+static unsigned nlens[2][129];
+static unsigned blacklistclean;
 
 #ifdef WITH_TLS
 static SSL_CTX *tls_ctx;
@@ -102,37 +115,123 @@ SOLOCAL void PSC_Connection_unreftlsctx(void)
 }
 #endif
 
-SOLOCAL void PSC_Connection_blacklistAddress(int hits, const PSC_IpAddr *addr)
+static size_t blacklistKey(uint8_t *key, int v6, unsigned len,
+	const uint8_t *raw)
 {
-    for (size_t i = 0; i < BLACKLISTSIZE; ++i)
+    size_t bytes = (len + 7) / 8;
+    key[0] = v6;
+    key[1] = len;
+    memcpy(key + 2, raw, bytes);
+    if (len % 8) key[1 + bytes] &= 0xff << (8 - len % 8);
+    return 2 + bytes;
+}
+
+static void removeEntry(const uint8_t *key, size_t keysz)
+{
+    --nlens[key[0]][key[1]];
+    PSC_Dictionary_set(blacklist, key, keysz, 0, 0);
+}
+
+static int expired(const void *key, size_t keysz, void *obj, const void *arg)
+{
+    (void)keysz;
+
+    const uint8_t *k = key;
+    const BlacklistEntry *e = obj;
+    const uint64_t *now = arg;
+    if (!e->expires || e->expires > *now) return 0;
+    --nlens[k[0]][k[1]];
+    return 1;
+}
+
+SOLOCAL void PSC_Connection_blacklistAddress(int hits, unsigned ttl,
+	unsigned prefixlen, const PSC_IpAddr *addr)
+{
+    if (!hits && !ttl) return;
+    int v6 = PSC_IpAddr_proto(addr) == PSC_P_IPv6;
+    if (prefixlen > PSC_IpAddr_prefixlen(addr))
+    {
+	prefixlen = PSC_IpAddr_prefixlen(addr);
+    }
+    uint8_t key[18];
+    size_t keysz = blacklistKey(key, v6, prefixlen, PSC_IpAddr_raw(addr));
+    uint64_t now = PSC_Service_nowMs() / 1000U;
+
+    pthread_mutex_lock(&blacklistlock);
+    if (!blacklist) blacklist = PSC_Dictionary_create(free, 0);
+    else if (++blacklistclean == BLACKLISTCLEAN)
     {
-	if (blacklist[i].addr) continue;
-	blacklist[i].addr = PSC_IpAddr_ref(addr);
-	blacklist[i].hits = hits;
-	return;
+	blacklistclean = 0;
+	PSC_Dictionary_removeAll(blacklist, expired, &now);
     }
+    BlacklistEntry *e = PSC_Dictionary_get(blacklist, key, keysz);
+    if (!e)
+    {
+	e = PSC_malloc(sizeof *e);
+	PSC_Dictionary_set(blacklist, key, keysz, e, 0);
+	++nlens[v6][prefixlen];
+    }
+    e->expires = ttl ? now + ttl : 0;
+    e->hits = hits;
+    pthread_mutex_unlock(&blacklistlock);
 }
 
-static int blacklistcheck(struct sockaddr *addr)
+static int blacklistcheck(const struct sockaddr *addr)
 {
-    PSC_IpAddr *ip = 0;
-    if (!addr) return 0;
+    int v6;
+    const uint8_t *raw;
+    unsigned maxlen;
+
+    switch (addr->sa_family)
+    {
+	case AF_INET:
+	    v6 = 0;
+	    raw = (const uint8_t *)
+		&((const struct sockaddr_in *)addr)->sin_addr.s_addr;
+	    maxlen = 32;
+	    break;
+
+	case AF_INET6:
+	    v6 = 1;
+	    raw = ((const struct sockaddr_in6 *)addr)->sin6_addr.s6_addr;
+	    maxlen = 128;
+	    break;
+
+	default:
+	    return 1;
+    }
+
     int ok = 1;
-    for (size_t i = 0; i < BLACKLISTSIZE; ++i)
+    uint8_t key[18];
+    uint64_t now = 0;
+    pthread_mutex_lock(&blacklistlock);
+    if (!blacklist) goto done;
+    for (unsigned len = maxlen + 1; ok && len-- > 0;)
     {
-	if (!blacklist[i].addr) continue;
-	if (!ip) ip = PSC_IpAddr_fromSockAddr(addr);
-	if (PSC_IpAddr_equals(ip, blacklist[i].addr))
+	if (!nlens[v6][len]) continue;
+	size_t keysz = blacklistKey(key, v6, len, raw);
+	BlacklistEntry *e = PSC_Dictionary_get(blacklist, key, keysz);
+	if (!e) continue;
+	if (e->expires)
 	{
-	    if (!--blacklist[i].hits)
+	    if (!now) now = PSC_Service_nowMs() / 1000U;
+	    if (e->expires <= now)
 	    {
-		PSC_IpAddr_destroy(blacklist[i].addr);
-		blacklist[i].addr = 0;
+		removeEntry(key, keysz);
+		continue;
 	    }
-	    ok = 0;
 	}
+	if (e->hits && !--e->hits) removeEntry(key, keysz);
+	ok = 0;
     }
-    PSC_IpAddr_destroy(ip);
+    if (!PSC_Dictionary_count(blacklist))
+    {
+	PSC_Dictionary_destroy(blacklist);
+	blacklist = 0;
+	blacklistclean = 0;
+    }
+done:
+    pthread_mutex_unlock(&blacklistlock);
     return ok;
 }
 
@@ -202,7 +301,10 @@ static PSC_Connection *createFromAddrinfo(
 	.tls_noverify = opts->noverify,
 #endif
 	.createmode = CCM_CONNECTING,
-	.blacklisthits = opts->blacklisthits
+	.blacklisthits = opts->blacklisthits,
+	.blacklistttl = opts->blacklistttl,
+	.blacklistlen4 = opts->blacklistlen4,
+	.blacklistlen6 = opts->blacklistlen6
     };
     PSC_Connection *conn = PSC_Connection_create(fd, &copts);
     PSC_Connection_setRemoteAddr(conn, PSC_IpAddr_fromSockAddr(res->ai_addr));
@@ -335,6 +437,8 @@ SOEXPORT PSC_TcpClientOpts *PSC_TcpClientOpts_create(
     memset(self, 0, sizeof *self);
     self->rdbufsz = DEFRDBUFSZ;
     self->port = port;
+    self->blacklistlen4 = 32;
+    self->blacklistlen6 = 128;
     self->refcnt = 1;
     memcpy(self->remotehost, remotehost, remotehostsz);
     return self;
@@ -386,6 +490,20 @@ SOEXPORT void PSC_TcpClientOpts_setBlacklistHits(PSC_TcpClientOpts *self,
     self->blacklisthits = blacklistHits;
 }
 
+SOEXPORT void PSC_TcpClientOpts_setBlacklistTtl(PSC_TcpClientOpts *self,
+	unsigned seconds)
+{
+    self->blacklistttl = seconds;
+}
+
+SOEXPORT void PSC_TcpClientOpts_setBlacklistPrefix(PSC_TcpClientOpts *self,
+	unsigned v4prefix, unsigned v6prefix)
+{
+    if (v4prefix > 32 || v6prefix > 128) return;
+    self->blacklistlen4 = v4prefix;
+    self->blacklistlen6 = v6prefix;
+}
+
 SOEXPORT void PSC_TcpClientOpts_destroy(PSC_TcpClientOpts *self)
 {
     if (!self) return;
@@ -456,6 +574,7 @@ SOEXPORT int PSC_Connection_createTcpClientAsync(const PSC_TcpClientOpts *opts,
     data->opts = (PSC_TcpClientOpts *)opts;
     ++data->opts->refcnt;
     PSC_ThreadJob *resolveJob = PSC_ThreadJob_create(doResolve, data, 0);
+    PSC_ThreadJob_setClass(resolveJob, PSC_JC_RESOLVE);
     PSC_Event_register(PSC_ThreadJob_finished(resolveJob), 0, resolveDone, 0);
     PSC_ThreadPool_enqueue(resolveJob);
     return 0;
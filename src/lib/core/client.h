@@ -12,7 +12,8 @@ PSC_Connection_unreftlsctx(void);
 #endif
 
 void
-PSC_Connection_blacklistAddress(int hits, const PSC_IpAddr *addr)
-    ATTR_NONNULL((2));
+PSC_Connection_blacklistAddress(int hits, unsigned ttl, unsigned prefixlen,
+	const PSC_IpAddr *addr)
+    ATTR_NONNULL((4));
 
 #endif
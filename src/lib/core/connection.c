@@ -26,6 +26,7 @@
 
 #define NWRITERECS 16
 #define CONNTIMEOUT 5000
+#define CONNTIMEOUTSLACK 100
 
 struct PSC_EADataReceived
 {
@@ -68,12 +69,20 @@ struct PSC_Connection
 #ifdef WITH_TLS
     PSC_Timer *tlsConnectTimer;
     SSL *tls;
+    void (*tls_handshakeDone)(void *, PSC_Connection *);
+    void *tls_handshakeObj;
 #endif
     PSC_IpAddr *ipAddr;
     char *addr;
     char *name;
     void *data;
     void (*deleter)(void *);
+    uint64_t bytesReceived;
+    uint64_t bytesSent;
+    uint64_t messagesReceived;
+    uint64_t messagesSent;
+    uint64_t createdMs;
+    long firstByteMs;
     size_t rdbufsz;
     size_t rdbufused;
     size_t rdbufpos;
@@ -96,12 +105,17 @@ struct PSC_Connection
     int tls_noverify;
 #endif
     int blacklisthits;
+    unsigned blacklistttl;
     ConnectionType type;
     uint16_t wrbuflen;
     uint16_t wrbufpos;
     uint8_t deleteScheduled;
     uint8_t nrecs;
     uint8_t nnotify;
+    uint8_t ncopied;
+    uint8_t maxrecs;
+    uint8_t blacklistlen4;
+    uint8_t blacklistlen6;
     char rdtextsave;
     uint8_t wrbuf[WRBUFSZ];
     uint8_t rdbuf[];
@@ -123,6 +137,15 @@ static void tryWrite(void *receiver, void *sender, void *args);
 static const char *locateeol(const char *str) ATTR_NONNULL((1));
 static void raisereceivedevents(PSC_Connection *self) CMETHOD;
 
+static void countReceived(PSC_Connection *self, size_t sz)
+{
+    if (self->firstByteMs < 0)
+    {
+	self->firstByteMs = (long)(PSC_Service_nowMs() - self->createdMs);
+    }
+    self->bytesReceived += sz;
+}
+
 static void connectionTimeout(void *receiver, void *sender, void *args)
 {
     (void)sender;
@@ -176,6 +199,16 @@ static void wantreadwrite(PSC_Connection *self)
 }
 
 #ifdef WITH_TLS
+static void tlsHandshakeFinished(PSC_Connection *self)
+{
+    /* notify the owner exactly once that the handshake isn't pending any
+     * more, either because it completed or because the connection closed */
+    void (*done)(void *, PSC_Connection *) = self->tls_handshakeDone;
+    if (!done) return;
+    self->tls_handshakeDone = 0;
+    done(self->tls_handshakeObj, self);
+}
+
 static void tlsHandshakeTimeout(void *receiver, void *sender, void *args)
 {
     (void)sender;
@@ -189,8 +222,8 @@ static void tlsHandshakeTimeout(void *receiver, void *sender, void *args)
 
 static void dohandshake(PSC_Connection *self)
 {
-    PSC_Log_fmt(PSC_L_DEBUG, "connection: handshake with %s",
-	    PSC_Connection_remoteAddr(self));
+    if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
+	    "connection: handshake with %s", PSC_Connection_remoteAddr(self));
     self->tls_connect_st = 0;
     int rc = self->tls_is_client ?
 	SSL_connect(self->tls) : SSL_accept(self->tls);
@@ -218,10 +251,12 @@ static void dohandshake(PSC_Connection *self)
 		    return;
 		}
 	    }
-	    PSC_Log_fmt(PSC_L_DEBUG, "connection: connected to %s",
+	    if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
+		    "connection: connected to %s",
 		    PSC_Connection_remoteAddr(self));
 	    PSC_Event_raise(&self->connected, 0, 0);
 	}
+	else tlsHandshakeFinished(self);
     }
     else
     {
@@ -249,8 +284,8 @@ static void dohandshake(PSC_Connection *self)
 
 static void dowrite(PSC_Connection *self)
 {
-    PSC_Log_fmt(PSC_L_DEBUG, "connection: writing to %s",
-	    PSC_Connection_remoteAddr(self));
+    if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
+	    "connection: writing to %s", PSC_Connection_remoteAddr(self));
     uint8_t notno = 0;
     if (self->nrecs && !self->wrbuflen)
     {
@@ -268,6 +303,7 @@ static void dowrite(PSC_Connection *self)
 	    self->wrbuflen += chunklen;
 	    rec->wrbufpos += chunklen;
 	    if (rec->wrbufpos != rec->wrbuflen) break;
+	    ++self->ncopied;
 	    if (rec->id)
 	    {
 		self->writenotify[notno].id = rec->id;
@@ -297,6 +333,7 @@ static void dowrite(PSC_Connection *self)
 	{
 	    self->tls_write_st = 0;
 	    self->wrbufpos += writesz;
+	    self->bytesSent += writesz;
 	    for (; notno < self->nnotify
 		    && self->writenotify[notno].wrbufpos <= self->wrbufpos;
 		    ++notno)
@@ -315,6 +352,8 @@ static void dowrite(PSC_Connection *self)
 		self->wrbuflen = 0;
 		self->wrbufpos = 0;
 		self->nnotify = 0;
+		self->messagesSent += self->ncopied;
+		self->ncopied = 0;
 	    }
 	}
 	else
@@ -345,6 +384,7 @@ static void dowrite(PSC_Connection *self)
 	if (rc >= 0)
 	{
 	    self->wrbufpos += rc;
+	    self->bytesSent += rc;
 	    for (; notno < self->nnotify
 		    && self->writenotify[notno].wrbufpos <= self->wrbufpos;
 		    ++notno)
@@ -358,11 +398,13 @@ static void dowrite(PSC_Connection *self)
 		self->wrbuflen = 0;
 		self->wrbufpos = 0;
 		self->nnotify = 0;
+		self->messagesSent += self->ncopied;
+		self->ncopied = 0;
 	    }
 	}
 	else if (errno == EWOULDBLOCK || errno == EAGAIN)
 	{
-	    PSC_Log_fmt(PSC_L_DEBUG,
+	    if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
 		    "connection: not ready for writing to %s",
 		    PSC_Connection_remoteAddr(self));
 	}
@@ -415,13 +457,15 @@ static void writeConnection(void *receiver, void *sender, void *args)
 	}
 	self->connectTimer = 0;
 	wantreadwrite(self);
-	PSC_Log_fmt(PSC_L_DEBUG, "connection: connected to %s",
+	if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
+		"connection: connected to %s",
 		PSC_Connection_remoteAddr(self));
 	PSC_Event_raise(&self->connected, 0, 0);
 	return;
     }
-    PSC_Log_fmt(PSC_L_DEBUG, "connection: ready to write to %s",
-	PSC_Connection_remoteAddr(self));
+    if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
+	    "connection: ready to write to %s",
+	    PSC_Connection_remoteAddr(self));
 #ifdef WITH_TLS
     if (self->tls_connect_st == SSL_ERROR_WANT_WRITE) dohandshake(self);
     else if (self->tls_read_st == SSL_ERROR_WANT_WRITE) doread(self);
@@ -519,6 +563,7 @@ static void raisereceivedevents(PSC_Connection *self)
 	    self->args.buf = rdbuf + self->rdbufpos;
 	    self->args.text = 0;
 	}
+	++self->messagesReceived;
 	PSC_Event_raise(&self->dataReceived, 0, &self->args);
 	self->rdbufpos += len;
 	if (self->rdbufpos == self->rdbufused)
@@ -540,8 +585,8 @@ static void raisereceivedevents(PSC_Connection *self)
 
 static void doread(PSC_Connection *self)
 {
-    PSC_Log_fmt(PSC_L_DEBUG, "connection: reading from %s",
-	    PSC_Connection_remoteAddr(self));
+    if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
+	    "connection: reading from %s", PSC_Connection_remoteAddr(self));
 #ifdef WITH_TLS
     if (self->tls)
     {
@@ -555,11 +600,12 @@ static void doread(PSC_Connection *self)
 	    if (ret > 0)
 	    {
 		self->tls_read_st = 0;
+		countReceived(self, readsz);
 		self->rdbufused += readsz;
 		self->rdbuf[self->rdbufused] = 0;
 		raisereceivedevents(self);
 		if (readsz == wantsz) self->tls_readagain = 1;
-		PSC_Log_fmt(PSC_L_DEBUG,
+		if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
 			"connection: done reading from %s",
 			PSC_Connection_remoteAddr(self));
 	    }
@@ -569,7 +615,7 @@ static void doread(PSC_Connection *self)
 		if (rc == SSL_ERROR_WANT_READ || rc == SSL_ERROR_WANT_WRITE)
 		{
 		    self->tls_read_st = rc;
-		    PSC_Log_fmt(PSC_L_DEBUG,
+		    if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
 			    "connection: reading from %s incomplete: %d",
 			    PSC_Connection_remoteAddr(self), rc);
 		}
@@ -603,6 +649,7 @@ static void doread(PSC_Connection *self)
 		self->rdbufsz - self->rdbufused);
 	if (rc > 0)
 	{
+	    countReceived(self, rc);
 	    self->rdbufused += rc;
 	    rdbuf[self->rdbufused] = 0;
 	    raisereceivedevents(self);
@@ -610,7 +657,7 @@ static void doread(PSC_Connection *self)
 	}
 	else if (errno == EWOULDBLOCK || errno == EAGAIN)
 	{
-	    PSC_Log_fmt(PSC_L_DEBUG,
+	    if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
 		    "connection: ignoring spurious read from %s",
 		    PSC_Connection_remoteAddr(self));
 	}
@@ -636,7 +683,8 @@ static void readConnection(void *receiver, void *sender, void *args)
     (void)args;
 
     PSC_Connection *self = receiver;
-    PSC_Log_fmt(PSC_L_DEBUG, "connection: ready to read from %s",
+    if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
+	    "connection: ready to read from %s",
 	    PSC_Connection_remoteAddr(self));
 
 #ifdef WITH_TLS
@@ -783,6 +831,9 @@ SOLOCAL PSC_Connection *PSC_Connection_create(int fd, const ConnOpts *opts)
 	self->tls = 0;
     }
     self->tlsConnectTimer = 0;
+    self->tls_handshakeDone = self->tls && !self->tls_is_client
+	? opts->tls_handshakeDone : 0;
+    self->tls_handshakeObj = opts->tls_handshakeObj;
     self->tls_connect_st = 0;
     self->tls_read_st = 0;
     self->tls_write_st = 0;
@@ -791,6 +842,9 @@ SOLOCAL PSC_Connection *PSC_Connection_create(int fd, const ConnOpts *opts)
     self->tls_noverify = opts->tls_noverify;
 #endif
     self->blacklisthits = opts->blacklisthits;
+    self->blacklistttl = opts->blacklistttl;
+    self->blacklistlen4 = opts->blacklistlen4;
+    self->blacklistlen6 = opts->blacklistlen6;
     self->type = type;
     self->args.handling = 0;
     self->deleteScheduled = 0;
@@ -798,7 +852,15 @@ SOLOCAL PSC_Connection *PSC_Connection_create(int fd, const ConnOpts *opts)
     self->wrbufpos = 0;
     self->nrecs = 0;
     self->nnotify = 0;
+    self->ncopied = 0;
+    self->maxrecs = 0;
     self->rdtextsave = 0;
+    self->bytesReceived = 0;
+    self->bytesSent = 0;
+    self->messagesReceived = 0;
+    self->messagesSent = 0;
+    self->createdMs = PSC_Service_nowMs();
+    self->firstByteMs = -1;
     if (type != CT_PIPEWR)
     {
 	uint8_t *rdbuf = type == CT_PIPERD ? self->wrbuf : self->rdbuf;
@@ -823,6 +885,7 @@ SOLOCAL PSC_Connection *PSC_Connection_create(int fd, const ConnOpts *opts)
 	    return 0;
 	}
 	PSC_Timer_setMs(self->connectTimer, CONNTIMEOUT);
+	PSC_Timer_setSlack(self->connectTimer, CONNTIMEOUTSLACK);
 	PSC_Event_register(PSC_Timer_expired(self->connectTimer), self,
 		connectionTimeout, 0);
 	PSC_Service_registerWrite(fd);
@@ -842,6 +905,7 @@ SOLOCAL PSC_Connection *PSC_Connection_create(int fd, const ConnOpts *opts)
 	    return 0;
 	}
 	PSC_Timer_setMs(self->tlsConnectTimer, CONNTIMEOUT);
+	PSC_Timer_setSlack(self->tlsConnectTimer, CONNTIMEOUTSLACK);
 	PSC_Event_register(PSC_Timer_expired(self->tlsConnectTimer), self,
 		tlsHandshakeTimeout, 0);
 	PSC_Timer_start(self->tlsConnectTimer, 0);
@@ -974,13 +1038,16 @@ SOEXPORT int PSC_Connection_sendAsync(PSC_Connection *self,
 #endif
     if (self->nrecs == NWRITERECS)
     {
-	PSC_Log_fmt(PSC_L_DEBUG, "connection: send queue overflow to %s",
+	if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
+		"connection: send queue overflow to %s",
 		PSC_Connection_remoteAddr(self));
 	goto done;
     }
     WriteRecord *rec = self->writerecs + self->nrecs++;
-    PSC_Log_fmt(PSC_L_DEBUG, "connection: added send request to %s, "
-	    "queue len: %hhu", PSC_Connection_remoteAddr(self), self->nrecs);
+    if (self->nrecs > self->maxrecs) self->maxrecs = self->nrecs;
+    if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
+	    "connection: added send request to %s, queue len: %hhu",
+	    PSC_Connection_remoteAddr(self), self->nrecs);
     rec->wrbuflen = sz;
     rec->wrbufpos = 0;
     rec->wrbuf = buf;
@@ -1042,10 +1109,17 @@ SOEXPORT int PSC_Connection_confirmDataReceived(PSC_Connection *self)
 SOEXPORT void PSC_Connection_close(PSC_Connection *self, int blacklist)
 {
     if (self->deleteScheduled) return;
-    if (blacklist && self->blacklisthits && self->ipAddr)
+    if (blacklist && (self->blacklisthits || self->blacklistttl)
+	    && self->ipAddr)
     {
-	PSC_Connection_blacklistAddress(self->blacklisthits, self->ipAddr);
+	PSC_Connection_blacklistAddress(self->blacklisthits,
+		self->blacklistttl,
+		PSC_IpAddr_proto(self->ipAddr) == PSC_P_IPv6
+		? self->blacklistlen6 : self->blacklistlen4, self->ipAddr);
     }
+#ifdef WITH_TLS
+    tlsHandshakeFinished(self);
+#endif
     PSC_Event_raise(&self->closed, 0, self->connectTimer ? 0 : self);
     deleteLater(self);
 }
@@ -1063,6 +1137,36 @@ SOEXPORT void *PSC_Connection_data(const PSC_Connection *self)
     return self->data;
 }
 
+SOEXPORT uint64_t PSC_Connection_bytesReceived(const PSC_Connection *self)
+{
+    return self->bytesReceived;
+}
+
+SOEXPORT uint64_t PSC_Connection_bytesSent(const PSC_Connection *self)
+{
+    return self->bytesSent;
+}
+
+SOEXPORT uint64_t PSC_Connection_messagesReceived(const PSC_Connection *self)
+{
+    return self->messagesReceived;
+}
+
+SOEXPORT uint64_t PSC_Connection_messagesSent(const PSC_Connection *self)
+{
+    return self->messagesSent;
+}
+
+SOEXPORT unsigned PSC_Connection_sendQueueMax(const PSC_Connection *self)
+{
+    return self->maxrecs;
+}
+
+SOEXPORT long PSC_Connection_firstByteMs(const PSC_Connection *self)
+{
+    return self->firstByteMs;
+}
+
 static void deleteLater(PSC_Connection *self)
 {
     if (!self) return;
@@ -1108,6 +1212,7 @@ SOLOCAL void PSC_Connection_destroy(PSC_Connection *self)
     {
 #ifdef WITH_TLS
 	if (self->tls) SSL_shutdown(self->tls);
+	tlsHandshakeFinished(self);
 #endif
 	PSC_Event_raise(&self->closed, 0, self->connectTimer ? 0 : self);
 	if (self->rdreg) PSC_Service_unregisterRead(self->fd);
@@ -5,6 +5,7 @@
 
 #include "objectpool.h"
 
+#include <stdint.h>
 #include <sys/socket.h>
 
 #ifdef WITH_TLS
@@ -44,11 +45,16 @@ typedef struct ConnOpts
     X509 *tls_cert;
     EVP_PKEY *tls_key;
     const char *tls_hostname;
+    void (*tls_handshakeDone)(void *obj, PSC_Connection *conn);
+    void *tls_handshakeObj;
     TlsMode tls_mode;
     int tls_noverify;
 #endif
     ConnectionCreateMode createmode;
     int blacklisthits;
+    unsigned blacklistttl;
+    uint8_t blacklistlen4;
+    uint8_t blacklistlen6;
 } ConnOpts;
 
 size_t
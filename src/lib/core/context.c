@@ -0,0 +1,61 @@
+#include "context.h"
+
+#if defined(HAVE_FASTCTX)
+#  include "fastctx.h"
+
+#  include <poser/decl.h>
+#  include <stdint.h>
+#  include <stdlib.h>
+
+SOLOCAL void Context_init(Context *self, void *stack, size_t sz,
+	void (*entry)(void))
+{
+    uint64_t *frame = (uint64_t *)(((uintptr_t)stack + sz) & ~(uintptr_t)15);
+    frame -= FASTCTX_FRAMESZ;
+    for (int i = 0; i < FASTCTX_FRAMESZ; ++i) frame[i] = 0;
+#ifdef FASTCTX_FPCTL
+    frame[FASTCTX_FPCTL] = FASTCTX_FPCTLINIT;
+#endif
+    frame[FASTCTX_ENTRY] = (uintptr_t)entry;
+    frame[FASTCTX_RET] = (uintptr_t)psc__fastctx_start;
+    self->sp = frame;
+}
+
+SOLOCAL void Context_switch(Context *self, Context *to)
+{
+    psc__fastctx_switch(&self->sp, to->sp);
+}
+
+SOLOCAL void Context_jump(Context *to)
+{
+    void *sp;
+    psc__fastctx_switch(&sp, to->sp);
+    abort();
+}
+
+#elif defined(HAVE_UCONTEXT)
+#  include <poser/decl.h>
+
+SOLOCAL void Context_init(Context *self, void *stack, size_t sz,
+	void (*entry)(void))
+{
+    getcontext(self);
+    self->uc_stack.ss_sp = stack;
+    self->uc_stack.ss_size = sz;
+    self->uc_link = 0;
+    makecontext(self, entry, 0);
+}
+
+SOLOCAL void Context_switch(Context *self, Context *to)
+{
+    swapcontext(self, to);
+}
+
+SOLOCAL void Context_jump(Context *to)
+{
+    setcontext(to);
+}
+
+#else
+typedef int posercore___dummy;
+#endif
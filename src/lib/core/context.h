@@ -0,0 +1,26 @@
+#ifndef POSER_CORE_INT_CONTEXT_H
+#define POSER_CORE_INT_CONTEXT_H
+
+#include <stddef.h>
+
+#undef HAVE_CONTEXT
+#if defined(HAVE_FASTCTX)
+#  define HAVE_CONTEXT
+typedef struct Context
+{
+    void *sp;
+} Context;
+#elif defined(HAVE_UCONTEXT)
+#  define HAVE_CONTEXT
+#  include <ucontext.h>
+typedef ucontext_t Context;
+#endif
+
+#ifdef HAVE_CONTEXT
+void Context_init(Context *self, void *stack, size_t sz,
+	void (*entry)(void));
+void Context_switch(Context *self, Context *to);
+void Context_jump(Context *to);
+#endif
+
+#endif
@@ -1,5 +1,5 @@
-posercore_PRECHECK=		ACCEPT4 ARC4R GETRANDOM MADVISE MADVFREE \
-				MANON MANONYMOUS MSTACK TLS_C11 TLS_GNU \
+posercore_PRECHECK=		ACCEPT4 ARC4R FUTEX GETRANDOM MADVISE MADVFREE \
+				MANON MANONYMOUS MMSG MSTACK TLS_C11 TLS_GNU \
 				UCONTEXT XXHX86
 ACCEPT4_FUNC=			accept4
 ACCEPT4_CFLAGS=			-D_GNU_SOURCE
@@ -19,6 +19,8 @@ BTINT_ARGS=			void *const *, int, int
 BTSZT_FUNC=			backtrace_symbols_fd
 BTSZT_HEADERS=			execinfo.h
 BTSZT_ARGS=			void *const *, size_t, int
+FUTEX_FLAG=			SYS_futex
+FUTEX_HEADERS=			sys/syscall.h linux/futex.h
 GETRANDOM_FUNC=			getrandom
 GETRANDOM_HEADERS=		sys/random.h
 GETRANDOM_RETURN=		ssize_t
@@ -36,6 +38,9 @@ MANON_HEADERS=			sys/mman.h
 MANONYMOUS_FLAG=		MAP_ANONYMOUS
 MANONYMOUS_CFLAGS=		-D_DEFAULT_SOURCE
 MANONYMOUS_HEADERS=		sys/mman.h
+MMSG_TYPE=			struct mmsghdr
+MMSG_CFLAGS=			-D_GNU_SOURCE
+MMSG_HEADERS=			sys/types.h sys/socket.h
 MSTACK_FLAG=			MAP_STACK
 MSTACK_CFLAGS=			-D_DEFAULT_SOURCE
 MSTACK_HEADERS=			sys/mman.h
@@ -47,6 +52,11 @@ XXHX86_FUNC=			XXH_featureTest
 XXHX86_CFLAGS=			-I./$(posercore_SRCDIR)/contrib/xxHash
 XXHX86_HEADERS=			xxh_x86dispatch.c
 XXHX86_ARGS=			void
+FASTCTX_FUNC=			psc__fastctx_switch
+FASTCTX_CFLAGS=			-I./$(posercore_SRCDIR)
+FASTCTX_HEADERS=		fastctx.h
+FASTCTX_ARGS=			void **, void *
+FASTCTX_RETURN=			void
 EVENTFD_FUNC=			eventfd
 EVENTFD_HEADERS=		sys/eventfd.h
 EVENTFD_ARGS=			unsigned, int
@@ -80,6 +90,10 @@ ifneq ($(WITHOUT_EVENTFD),1)
 posercore_PRECHECK+=		EVENTFD
 endif
 
+ifneq ($(WITHOUT_FASTCTX),1)
+posercore_PRECHECK+=		FASTCTX
+endif
+
 ifneq ($(WITHOUT_EVPORTS),1)
 posercore_PRECHECK+=		EVPORTS
 endif
@@ -104,7 +118,11 @@ posercore_MODULES=		base64 \
 				certinfo \
 				client \
 				connection \
+				$(if $(filter 1,$(posercore_HAVE_UCONTEXT) \
+					$(posercore_HAVE_FASTCTX)), \
+					context) \
 				daemon \
+				datagramsocket \
 				dictionary \
 				event \
 				hash \
@@ -123,7 +141,8 @@ posercore_MODULES=		base64 \
 				server \
 				service \
 				sharedobj \
-				$(if $(filter 1,$(posercore_HAVE_UCONTEXT)), \
+				$(if $(filter 1,$(posercore_HAVE_UCONTEXT) \
+					$(posercore_HAVE_FASTCTX)), \
 					stackmgr) \
 				stringbuilder \
 				threadpool \
@@ -138,6 +157,7 @@ posercore_HEADERS_INSTALL=	core \
 				core/client \
 				core/connection \
 				core/daemon \
+				core/datagramsocket \
 				core/dictionary \
 				core/event \
 				core/hash \
@@ -307,12 +327,13 @@ endef
 $(warning $(posercore_warn_accept4))
 endif
 
-ifneq ($(posercore_HAVE_UCONTEXT),1)
+ifeq ($(filter 1,$(posercore_HAVE_UCONTEXT) $(posercore_HAVE_FASTCTX)),)
 define posercore_warn_ucontext
 **WARNING**
 
-User context switching (<ucontext.h>) not detected. Awaiting a PSC_AsyncTask
-will therefore block the thread doing this until the task is completed.
+User context switching (neither <ucontext.h> nor a native implementation for
+this platform) not detected. Awaiting a PSC_AsyncTask will therefore block
+the thread doing this until the task is completed.
 
 This might affect performance of applications using this feature.
 
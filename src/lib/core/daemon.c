@@ -1,8 +1,8 @@
 #define _DEFAULT_SOURCE
 
+#include "daemon.h"
 #include "runopts.h"
 
-#include <poser/core/daemon.h>
 #include <poser/core/log.h>
 
 #include <errno.h>
@@ -14,6 +14,9 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+static const char *upgradepidfile;
+static FILE *upgradepf;
+
 static FILE *openpidfile(const char *pidfile) ATTR_NONNULL((1));
 static int waitpflock(FILE *pf, const char *pidfile)
     ATTR_NONNULL((1)) ATTR_NONNULL((2));
@@ -133,6 +136,23 @@ SOEXPORT int PSC_Daemon_run(PSC_Daemon_main dmain, void *data)
     PSC_RunOpts *opts = runOpts();
     if (!opts->daemonize) return dmain(data);
 
+    if (getenv(UPGRADEENV))
+    {
+	/* started by a running daemon handing over its listening sockets,
+	 * so already detached, and the pidfile is still locked by the old
+	 * instance until it exits */
+	upgradepidfile = opts->pidfile;
+	rc = dmain(data);
+	if (upgradepf)
+	{
+	    fclose(upgradepf);
+	    upgradepf = 0;
+	    unlink(opts->pidfile);
+	}
+	upgradepidfile = 0;
+	return rc;
+    }
+
     if (opts->pidfile && !(pf = openpidfile(opts->pidfile))) goto done;
 
     int pfd[2];
@@ -271,6 +291,14 @@ done:
     return rc;
 }
 
+SOLOCAL void PSC_Daemon_takePidfile(void)
+{
+    if (!upgradepidfile || upgradepf) return;
+    if (!(upgradepf = openpidfile(upgradepidfile))) return;
+    fprintf(upgradepf, "%d\n", (int)getpid());
+    fflush(upgradepf);
+}
+
 SOEXPORT void PSC_Daemon_launched(void)
 {
     dup2(STDIN_FILENO, STDERR_FILENO);
@@ -0,0 +1,10 @@
+#ifndef POSER_CORE_INT_DAEMON_H
+#define POSER_CORE_INT_DAEMON_H
+
+#include <poser/core/daemon.h>
+
+#define UPGRADEENV "POSER_UPGRADE_FD"
+
+void PSC_Daemon_takePidfile(void);
+
+#endif
@@ -0,0 +1,750 @@
+#define _GNU_SOURCE
+
+#include "event.h"
+#include "ipaddr.h"
+
+#include <poser/core/datagramsocket.h>
+#include <poser/core/log.h>
+#include <poser/core/service.h>
+#include <poser/core/util.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define DEFBATCH 32
+#define MAXBATCH 1024
+#define DEFBUFSZ 2048
+#define MAXBUFSZ 65535
+
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+#  define HAVE_UDPOFFLOAD
+#  define GROBUFSZ 65535
+#  define GSOMAXSEGS 64
+/* stay below the maximum UDP payload for both IPv4 and IPv6 */
+#  define GSOMAXSZ 65000
+#endif
+
+#ifdef HAVE_MMSG
+typedef struct mmsghdr MsgRec;
+#else
+typedef struct MsgRec
+{
+    struct msghdr msg_hdr;
+    unsigned msg_len;
+} MsgRec;
+#endif
+
+typedef union CtlBuf
+{
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+} CtlBuf;
+
+struct PSC_DatagramSocketOpts
+{
+    char *bindhost;
+    size_t bufsz;
+    PSC_Proto proto;
+    unsigned batch;
+    int port;
+    int reuseport;
+    int offload;
+};
+
+struct PSC_Datagram
+{
+    PSC_IpAddr *ipAddr;
+    const uint8_t *buf;
+    const struct sockaddr_storage *addr;
+    size_t size;
+    socklen_t addrlen;
+    int truncated;
+};
+
+struct PSC_EADatagramsReceived
+{
+    PSC_Datagram *dgrams;
+    size_t count;
+};
+
+typedef struct SendRec
+{
+    struct sockaddr_storage addr;
+    size_t off;
+    size_t len;
+    socklen_t addrlen;
+} SendRec;
+
+struct PSC_DatagramSocket
+{
+    PSC_Event received;
+    PSC_EADatagramsReceived args;
+    uint8_t *rdbuf;
+    MsgRec *rdmsg;
+    struct iovec *rdiov;
+    struct sockaddr_storage *rdaddr;
+    CtlBuf *rdctl;
+    PSC_Datagram *dgrams;
+    uint8_t *wrbuf;
+    SendRec *wrrecs;
+    MsgRec *wrmsg;
+    struct iovec *wriov;
+    CtlBuf *wrctl;
+    unsigned *wrcnt;
+    size_t rdslotsz;
+    size_t bufsz;
+    size_t dgcapa;
+    size_t wrused;
+    unsigned batch;
+    unsigned nwr;
+    unsigned wrpos;
+    int family;
+    int fd;
+    int port;
+    int gro;
+    int gso;
+    int wrreg;
+    int handling;
+    int destroyed;
+};
+
+static void readSocket(void *receiver, void *sender, void *args);
+static void writeSocket(void *receiver, void *sender, void *args);
+static void flushSocket(void *receiver, void *sender, void *args);
+
+SOEXPORT PSC_DatagramSocketOpts *PSC_DatagramSocketOpts_create(int port)
+{
+    PSC_DatagramSocketOpts *self = PSC_malloc(sizeof *self);
+    memset(self, 0, sizeof *self);
+    self->bufsz = DEFBUFSZ;
+    self->proto = PSC_P_ANY;
+    self->batch = DEFBATCH;
+    self->port = port;
+    return self;
+}
+
+SOEXPORT void PSC_DatagramSocketOpts_bind(PSC_DatagramSocketOpts *self,
+	const char *bindhost)
+{
+    free(self->bindhost);
+    self->bindhost = PSC_copystr(bindhost);
+}
+
+SOEXPORT void PSC_DatagramSocketOpts_setProto(PSC_DatagramSocketOpts *self,
+	PSC_Proto proto)
+{
+    self->proto = proto;
+}
+
+SOEXPORT void PSC_DatagramSocketOpts_batchSize(PSC_DatagramSocketOpts *self,
+	unsigned batch)
+{
+    if (!batch || batch > MAXBATCH) return;
+    self->batch = batch;
+}
+
+SOEXPORT void PSC_DatagramSocketOpts_bufSize(PSC_DatagramSocketOpts *self,
+	size_t sz)
+{
+    if (!sz || sz > MAXBUFSZ) return;
+    self->bufsz = sz;
+}
+
+SOEXPORT void PSC_DatagramSocketOpts_reusePort(PSC_DatagramSocketOpts *self)
+{
+    self->reuseport = 1;
+}
+
+SOEXPORT void PSC_DatagramSocketOpts_offload(PSC_DatagramSocketOpts *self)
+{
+    self->offload = 1;
+}
+
+SOEXPORT void PSC_DatagramSocketOpts_destroy(PSC_DatagramSocketOpts *self)
+{
+    if (!self) return;
+    free(self->bindhost);
+    free(self);
+}
+
+static int recvbatch(int fd, MsgRec *msgs, unsigned n)
+{
+#ifdef HAVE_MMSG
+    return recvmmsg(fd, msgs, n, 0, 0);
+#else
+    unsigned i = 0;
+    for (; i < n; ++i)
+    {
+	ssize_t rc = recvmsg(fd, &msgs[i].msg_hdr, 0);
+	if (rc < 0) break;
+	msgs[i].msg_len = rc;
+    }
+    return i ? (int)i : -1;
+#endif
+}
+
+static int sendbatch(int fd, MsgRec *msgs, unsigned n)
+{
+#ifdef HAVE_MMSG
+    return sendmmsg(fd, msgs, n, 0);
+#else
+    unsigned i = 0;
+    for (; i < n; ++i)
+    {
+	ssize_t rc = sendmsg(fd, &msgs[i].msg_hdr, 0);
+	if (rc < 0) break;
+	msgs[i].msg_len = rc;
+    }
+    return i ? (int)i : -1;
+#endif
+}
+
+static int createSocket(const PSC_DatagramSocketOpts *opts, int *family)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE|AI_ADDRCONFIG|AI_NUMERICSERV;
+    char portstr[6];
+    snprintf(portstr, 6, "%d", opts->port);
+
+    struct addrinfo *res0 = 0;
+    if (getaddrinfo(opts->bindhost, portstr, &hints, &res0) < 0 || !res0)
+    {
+	PSC_Log_errfmt(PSC_L_ERROR,
+		"datagramsocket: cannot get address info for `%s'",
+		opts->bindhost ? opts->bindhost : "*");
+	return -1;
+    }
+
+    /* When binding to any address, prefer a dual-stack IPv6 socket */
+    int dualstack = !opts->bindhost && opts->proto == PSC_P_ANY;
+    int fd = -1;
+    int opt_true = 1;
+    for (int pass = !dualstack; fd < 0 && pass < 2; ++pass)
+    {
+	for (struct addrinfo *res = res0; res; res = res->ai_next)
+	{
+	    if (res->ai_family != AF_INET
+		    && res->ai_family != AF_INET6) continue;
+	    if (opts->proto == PSC_P_IPv4
+		    && res->ai_family != AF_INET) continue;
+	    if (opts->proto == PSC_P_IPv6
+		    && res->ai_family != AF_INET6) continue;
+	    if (!pass && res->ai_family != AF_INET6) continue;
+#ifdef HAVE_ACCEPT4
+	    fd = socket(res->ai_family,
+		    res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    res->ai_protocol);
+#else
+	    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+#endif
+	    if (fd < 0)
+	    {
+		PSC_Log_err(PSC_L_ERROR,
+			"datagramsocket: cannot create socket");
+		continue;
+	    }
+#ifndef HAVE_ACCEPT4
+	    fcntl(fd, F_SETFD, FD_CLOEXEC);
+	    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+	    if (!PSC_Service_isValidFd(fd, "datagramsocket"))
+	    {
+		close(fd);
+		fd = -1;
+		break;
+	    }
+#ifdef SO_REUSEPORT
+	    if (opts->reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+			&opt_true, sizeof opt_true) < 0)
+	    {
+		PSC_Log_err(PSC_L_WARNING,
+			"datagramsocket: cannot set SO_REUSEPORT");
+	    }
+#endif
+#ifdef IPV6_V6ONLY
+	    if (res->ai_family == AF_INET6)
+	    {
+		int v6only = !dualstack;
+		setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY,
+			&v6only, sizeof v6only);
+	    }
+#else
+	    (void)opt_true;
+#endif
+	    if (bind(fd, res->ai_addr, res->ai_addrlen) < 0)
+	    {
+		PSC_Log_err(PSC_L_ERROR,
+			"datagramsocket: cannot bind to specified address");
+		close(fd);
+		fd = -1;
+		continue;
+	    }
+	    *family = res->ai_family;
+	    break;
+	}
+    }
+    freeaddrinfo(res0);
+    return fd;
+}
+
+SOEXPORT PSC_DatagramSocket *PSC_DatagramSocket_create(
+	const PSC_DatagramSocketOpts *opts)
+{
+    int family = AF_UNSPEC;
+    int fd = createSocket(opts, &family);
+    if (fd < 0)
+    {
+	PSC_Log_msg(PSC_L_ERROR, "datagramsocket: could not create socket");
+	return 0;
+    }
+
+    PSC_DatagramSocket *self = PSC_malloc(sizeof *self);
+    memset(self, 0, sizeof *self);
+    PSC_Event_initStatic(&self->received, self);
+    self->bufsz = opts->bufsz;
+    self->rdslotsz = opts->bufsz;
+    self->batch = opts->batch;
+    self->family = family;
+    self->fd = fd;
+    self->port = opts->port;
+
+    struct sockaddr_storage local;
+    socklen_t locallen = sizeof local;
+    if (getsockname(fd, (struct sockaddr *)&local, &locallen) == 0)
+    {
+	if (local.ss_family == AF_INET) self->port = ntohs(
+		((struct sockaddr_in *)&local)->sin_port);
+	else if (local.ss_family == AF_INET6) self->port = ntohs(
+		((struct sockaddr_in6 *)&local)->sin6_port);
+    }
+
+#ifdef HAVE_UDPOFFLOAD
+    if (opts->offload)
+    {
+	int opt_true = 1;
+	int opt_false = 0;
+	if (setsockopt(fd, IPPROTO_UDP, UDP_GRO,
+		    &opt_true, sizeof opt_true) == 0)
+	{
+	    self->gro = 1;
+	    self->rdslotsz = GROBUFSZ;
+	}
+	if (setsockopt(fd, IPPROTO_UDP, UDP_SEGMENT,
+		    &opt_false, sizeof opt_false) == 0)
+	{
+	    self->gso = 1;
+	}
+	if (!self->gro || !self->gso)
+	{
+	    PSC_Log_msg(PSC_L_INFO, "datagramsocket: UDP segmentation "
+		    "offload not fully supported by the kernel");
+	}
+    }
+#endif
+
+    self->rdbuf = PSC_malloc(self->batch * self->rdslotsz);
+    self->rdmsg = PSC_malloc(self->batch * sizeof *self->rdmsg);
+    self->rdiov = PSC_malloc(self->batch * sizeof *self->rdiov);
+    self->rdaddr = PSC_malloc(self->batch * sizeof *self->rdaddr);
+    self->rdctl = PSC_malloc(self->batch * sizeof *self->rdctl);
+    self->dgcapa = self->batch;
+    self->dgrams = PSC_malloc(self->dgcapa * sizeof *self->dgrams);
+    self->wrbuf = PSC_malloc(self->batch * self->bufsz);
+    self->wrrecs = PSC_malloc(self->batch * sizeof *self->wrrecs);
+    self->wrmsg = PSC_malloc(self->batch * sizeof *self->wrmsg);
+    self->wriov = PSC_malloc(self->batch * sizeof *self->wriov);
+    self->wrctl = PSC_malloc(self->batch * sizeof *self->wrctl);
+    self->wrcnt = PSC_malloc(self->batch * sizeof *self->wrcnt);
+
+    memset(self->rdmsg, 0, self->batch * sizeof *self->rdmsg);
+    for (unsigned i = 0; i < self->batch; ++i)
+    {
+	self->rdiov[i].iov_base = self->rdbuf + i * self->rdslotsz;
+	self->rdiov[i].iov_len = self->rdslotsz;
+	self->rdmsg[i].msg_hdr.msg_iov = self->rdiov + i;
+	self->rdmsg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    PSC_Event_register(PSC_Service_readyRead(), self, readSocket, fd);
+    PSC_Event_register(PSC_Service_readyWrite(), self, writeSocket, fd);
+    PSC_Event_register(PSC_Service_eventsDone(), self, flushSocket, 0);
+    PSC_Service_registerRead(fd);
+
+    PSC_Log_fmt(PSC_L_INFO, "datagramsocket: bound to port %d", self->port);
+    return self;
+}
+
+static void addDatagram(PSC_DatagramSocket *self, const uint8_t *buf,
+	size_t size, unsigned slot, int truncated)
+{
+    if (self->args.count == self->dgcapa)
+    {
+	self->dgcapa *= 2;
+	self->dgrams = PSC_realloc(self->dgrams,
+		self->dgcapa * sizeof *self->dgrams);
+    }
+    PSC_Datagram *dgram = self->dgrams + self->args.count++;
+    dgram->ipAddr = 0;
+    dgram->buf = buf;
+    dgram->addr = self->rdaddr + slot;
+    dgram->size = size;
+    dgram->addrlen = self->rdmsg[slot].msg_hdr.msg_namelen;
+    dgram->truncated = truncated;
+}
+
+static void readSocket(void *receiver, void *sender, void *args)
+{
+    (void)sender;
+    (void)args;
+
+    PSC_DatagramSocket *self = receiver;
+    for (unsigned i = 0; i < self->batch; ++i)
+    {
+	struct msghdr *hdr = &self->rdmsg[i].msg_hdr;
+	hdr->msg_name = self->rdaddr + i;
+	hdr->msg_namelen = sizeof *self->rdaddr;
+	hdr->msg_control = self->gro ? self->rdctl + i : 0;
+	hdr->msg_controllen = self->gro ? sizeof *self->rdctl : 0;
+	hdr->msg_flags = 0;
+    }
+
+    errno = 0;
+    int rc = recvbatch(self->fd, self->rdmsg, self->batch);
+    if (rc < 0)
+    {
+	if (errno != EWOULDBLOCK && errno != EAGAIN)
+	{
+	    PSC_Log_err(PSC_L_WARNING,
+		    "datagramsocket: error receiving datagrams");
+	}
+	return;
+    }
+
+    self->args.count = 0;
+    for (unsigned i = 0; i < (unsigned)rc; ++i)
+    {
+	struct msghdr *hdr = &self->rdmsg[i].msg_hdr;
+	const uint8_t *buf = self->rdiov[i].iov_base;
+	size_t len = self->rdmsg[i].msg_len;
+	int truncated = !!(hdr->msg_flags & MSG_TRUNC);
+	size_t segsz = len;
+#ifdef HAVE_UDPOFFLOAD
+	if (self->gro) for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+		cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg))
+	{
+	    if (cmsg->cmsg_level == IPPROTO_UDP
+		    && cmsg->cmsg_type == UDP_GRO)
+	    {
+		int gsosz;
+		memcpy(&gsosz, CMSG_DATA(cmsg), sizeof gsosz);
+		if (gsosz > 0) segsz = gsosz;
+		break;
+	    }
+	}
+#endif
+	if (!len) addDatagram(self, buf, 0, i, truncated);
+	else for (size_t off = 0; off < len; off += segsz)
+	{
+	    size_t sz = len - off;
+	    if (sz > segsz) sz = segsz;
+	    addDatagram(self, buf + off, sz, i, truncated);
+	}
+    }
+
+    PSC_Log_fmt(PSC_L_DEBUG, "datagramsocket: received %zu datagrams",
+	    self->args.count);
+    self->args.dgrams = self->dgrams;
+    self->handling = 1;
+    PSC_Event_raise(&self->received, 0, &self->args);
+    self->handling = 0;
+    for (size_t i = 0; i < self->args.count; ++i)
+    {
+	PSC_IpAddr_destroy(self->dgrams[i].ipAddr);
+    }
+    self->args.count = 0;
+    if (self->destroyed)
+    {
+	self->destroyed = 0;
+	PSC_DatagramSocket_destroy(self);
+    }
+}
+
+static void dosend(PSC_DatagramSocket *self)
+{
+    while (self->wrpos < self->nwr)
+    {
+	unsigned nmsg = 0;
+	for (unsigned i = self->wrpos; i < self->nwr; ++nmsg)
+	{
+	    SendRec *rec = self->wrrecs + i;
+	    size_t len = rec->len;
+	    unsigned n = 1;
+#ifdef HAVE_UDPOFFLOAD
+	    if (self->gso) while (i + n < self->nwr && n < GSOMAXSEGS)
+	    {
+		const SendRec *next = rec + n;
+		if (rec[n-1].len != rec->len) break;
+		if (next->len > rec->len) break;
+		if (len + next->len > GSOMAXSZ) break;
+		if (next->addrlen != rec->addrlen) break;
+		if (memcmp(&next->addr, &rec->addr, rec->addrlen)) break;
+		len += next->len;
+		++n;
+	    }
+#endif
+	    struct msghdr *hdr = &self->wrmsg[nmsg].msg_hdr;
+	    memset(hdr, 0, sizeof *hdr);
+	    self->wriov[nmsg].iov_base = self->wrbuf + rec->off;
+	    self->wriov[nmsg].iov_len = len;
+	    hdr->msg_name = &rec->addr;
+	    hdr->msg_namelen = rec->addrlen;
+	    hdr->msg_iov = self->wriov + nmsg;
+	    hdr->msg_iovlen = 1;
+#ifdef HAVE_UDPOFFLOAD
+	    if (n > 1)
+	    {
+		hdr->msg_control = self->wrctl + nmsg;
+		hdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+		cmsg->cmsg_level = IPPROTO_UDP;
+		cmsg->cmsg_type = UDP_SEGMENT;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+		uint16_t gsosz = rec->len;
+		memcpy(CMSG_DATA(cmsg), &gsosz, sizeof gsosz);
+	    }
+#endif
+	    self->wrcnt[nmsg] = n;
+	    i += n;
+	}
+
+	errno = 0;
+	int rc = sendbatch(self->fd, self->wrmsg, nmsg);
+	if (rc < 0)
+	{
+	    if (errno == EWOULDBLOCK || errno == EAGAIN)
+	    {
+		if (!self->wrreg)
+		{
+		    PSC_Service_registerWrite(self->fd);
+		    self->wrreg = 1;
+		}
+		goto compact;
+	    }
+	    PSC_Log_err(PSC_L_WARNING,
+		    "datagramsocket: error sending datagram, dropping it");
+	    rc = 1;
+	}
+	for (int i = 0; i < rc; ++i) self->wrpos += self->wrcnt[i];
+    }
+
+    self->nwr = 0;
+    self->wrpos = 0;
+    self->wrused = 0;
+    if (self->wrreg)
+    {
+	PSC_Service_unregisterWrite(self->fd);
+	self->wrreg = 0;
+    }
+    return;
+
+compact:
+    if (!self->wrpos) return;
+    size_t off = self->wrrecs[self->wrpos].off;
+    memmove(self->wrbuf, self->wrbuf + off, self->wrused - off);
+    self->wrused -= off;
+    self->nwr -= self->wrpos;
+    memmove(self->wrrecs, self->wrrecs + self->wrpos,
+	    self->nwr * sizeof *self->wrrecs);
+    for (unsigned i = 0; i < self->nwr; ++i) self->wrrecs[i].off -= off;
+    self->wrpos = 0;
+}
+
+static void writeSocket(void *receiver, void *sender, void *args)
+{
+    (void)sender;
+    (void)args;
+
+    dosend(receiver);
+}
+
+static void flushSocket(void *receiver, void *sender, void *args)
+{
+    (void)sender;
+    (void)args;
+
+    PSC_DatagramSocket *self = receiver;
+    if (self->nwr && !self->wrreg) dosend(self);
+}
+
+static int enqueue(PSC_DatagramSocket *self, const struct sockaddr *addr,
+	socklen_t addrlen, const uint8_t *buf, size_t sz)
+{
+    if (sz > self->bufsz)
+    {
+	PSC_Log_fmt(PSC_L_DEBUG, "datagramsocket: datagram of %zu bytes "
+		"exceeds buffer size", sz);
+	return -1;
+    }
+    if (self->nwr == self->batch && !self->wrreg) dosend(self);
+    if (self->nwr == self->batch)
+    {
+	PSC_Log_msg(PSC_L_DEBUG, "datagramsocket: send queue overflow");
+	return -1;
+    }
+    SendRec *rec = self->wrrecs + self->nwr++;
+    memcpy(&rec->addr, addr, addrlen);
+    rec->addrlen = addrlen;
+    rec->off = self->wrused;
+    rec->len = sz;
+    memcpy(self->wrbuf + self->wrused, buf, sz);
+    self->wrused += sz;
+    return 0;
+}
+
+SOEXPORT PSC_Event *PSC_DatagramSocket_received(PSC_DatagramSocket *self)
+{
+    return &self->received;
+}
+
+SOEXPORT int PSC_DatagramSocket_sendTo(PSC_DatagramSocket *self,
+	const PSC_IpAddr *addr, int port, const uint8_t *buf, size_t sz)
+{
+    struct sockaddr_storage ss;
+    socklen_t sslen;
+    if (PSC_IpAddr_sockAddr(addr, (struct sockaddr *)&ss) < 0) return -1;
+    if (ss.ss_family == AF_INET && self->family == AF_INET6)
+    {
+	struct sockaddr_in sain;
+	memcpy(&sain, &ss, sizeof sain);
+	struct sockaddr_in6 *sain6 = (struct sockaddr_in6 *)&ss;
+	memset(sain6, 0, sizeof *sain6);
+	sain6->sin6_family = AF_INET6;
+	sain6->sin6_addr.s6_addr[10] = 0xff;
+	sain6->sin6_addr.s6_addr[11] = 0xff;
+	memcpy(sain6->sin6_addr.s6_addr + 12, &sain.sin_addr.s_addr, 4);
+    }
+    if (ss.ss_family != self->family) return -1;
+    if (ss.ss_family == AF_INET)
+    {
+	((struct sockaddr_in *)&ss)->sin_port = htons(port);
+	sslen = sizeof (struct sockaddr_in);
+    }
+    else
+    {
+	((struct sockaddr_in6 *)&ss)->sin6_port = htons(port);
+	sslen = sizeof (struct sockaddr_in6);
+    }
+    return enqueue(self, (struct sockaddr *)&ss, sslen, buf, sz);
+}
+
+SOEXPORT int PSC_DatagramSocket_reply(PSC_DatagramSocket *self,
+	const PSC_Datagram *dgram, const uint8_t *buf, size_t sz)
+{
+    if (!dgram->addrlen) return -1;
+    return enqueue(self, (const struct sockaddr *)dgram->addr,
+	    dgram->addrlen, buf, sz);
+}
+
+SOEXPORT void PSC_DatagramSocket_flush(PSC_DatagramSocket *self)
+{
+    if (self->nwr) dosend(self);
+}
+
+SOEXPORT int PSC_DatagramSocket_port(const PSC_DatagramSocket *self)
+{
+    return self->port;
+}
+
+SOEXPORT void PSC_DatagramSocket_destroy(PSC_DatagramSocket *self)
+{
+    if (!self) return;
+    if (self->handling)
+    {
+	self->destroyed = 1;
+	return;
+    }
+    PSC_Event_unregister(PSC_Service_eventsDone(), self, flushSocket, 0);
+    PSC_Event_unregister(PSC_Service_readyWrite(), self,
+	    writeSocket, self->fd);
+    PSC_Event_unregister(PSC_Service_readyRead(), self,
+	    readSocket, self->fd);
+    if (self->wrreg) PSC_Service_unregisterWrite(self->fd);
+    PSC_Service_unregisterRead(self->fd);
+    close(self->fd);
+    PSC_Event_destroyStatic(&self->received);
+    free(self->wrcnt);
+    free(self->wrctl);
+    free(self->wriov);
+    free(self->wrmsg);
+    free(self->wrrecs);
+    free(self->wrbuf);
+    free(self->dgrams);
+    free(self->rdctl);
+    free(self->rdaddr);
+    free(self->rdiov);
+    free(self->rdmsg);
+    free(self->rdbuf);
+    free(self);
+}
+
+SOEXPORT size_t PSC_EADatagramsReceived_count(
+	const PSC_EADatagramsReceived *self)
+{
+    return self->count;
+}
+
+SOEXPORT const PSC_Datagram *PSC_EADatagramsReceived_datagram(
+	const PSC_EADatagramsReceived *self, size_t i)
+{
+    return self->dgrams + i;
+}
+
+SOEXPORT const uint8_t *PSC_Datagram_buf(const PSC_Datagram *self)
+{
+    return self->buf;
+}
+
+SOEXPORT size_t PSC_Datagram_size(const PSC_Datagram *self)
+{
+    return self->size;
+}
+
+SOEXPORT int PSC_Datagram_truncated(const PSC_Datagram *self)
+{
+    return self->truncated;
+}
+
+SOEXPORT const PSC_IpAddr *PSC_Datagram_remoteIpAddr(
+	const PSC_Datagram *self)
+{
+    if (!self->ipAddr && self->addrlen)
+    {
+	((PSC_Datagram *)self)->ipAddr = PSC_IpAddr_fromSockAddr(
+		(const struct sockaddr *)self->addr);
+    }
+    return self->ipAddr;
+}
+
+SOEXPORT int PSC_Datagram_remotePort(const PSC_Datagram *self)
+{
+    if (!self->addrlen) return -1;
+    if (self->addr->ss_family == AF_INET) return ntohs(
+	    ((const struct sockaddr_in *)self->addr)->sin_port);
+    if (self->addr->ss_family == AF_INET6) return ntohs(
+	    ((const struct sockaddr_in6 *)self->addr)->sin6_port);
+    return -1;
+}
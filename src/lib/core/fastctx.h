@@ -0,0 +1,125 @@
+#ifndef POSER_CORE_INT_FASTCTX_H
+#define POSER_CORE_INT_FASTCTX_H
+
+/* Minimal user context switching, only saving the registers preserved
+ * across function calls and never touching the signal mask. This header
+ * defines the functions, so it must only be included once. The FASTCTX
+ * precheck fails on platforms not supported here. */
+
+#if !defined(__ELF__) || !defined(__GNUC__) \
+	|| !(defined(__x86_64__) || defined(__aarch64__))
+#  error Fast context switching not supported on this platform
+#endif
+
+/* Saves the current context on its stack, stores the stack pointer in
+ * *from and continues with the context saved at stack pointer to. */
+void psc__fastctx_switch(void **from, void *to);
+
+/* Entry point of a new context, calls the function found in a callee-saved
+ * register (r12 / x19), which must never return. */
+void psc__fastctx_start(void);
+
+#if defined(__x86_64__)
+__asm__(
+	".text\n"
+	".globl psc__fastctx_switch\n"
+	".hidden psc__fastctx_switch\n"
+	".type psc__fastctx_switch, @function\n"
+	".p2align 4\n"
+	"psc__fastctx_switch:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size psc__fastctx_switch, .-psc__fastctx_switch\n"
+	".globl psc__fastctx_start\n"
+	".hidden psc__fastctx_start\n"
+	".type psc__fastctx_start, @function\n"
+	".p2align 4\n"
+	"psc__fastctx_start:\n"
+	"	xorl %ebp, %ebp\n"
+	"	andq $-16, %rsp\n"
+	"	callq *%r12\n"
+	"	ud2\n"
+	".size psc__fastctx_start, .-psc__fastctx_start\n"
+);
+
+/* Initial frame: FPU control words, r15 - r12, rbx, rbp, return address */
+#define FASTCTX_FRAMESZ 9
+#define FASTCTX_FPCTL 0
+#define FASTCTX_FPCTLINIT (0x1f80ULL | (0x037fULL << 32))
+#define FASTCTX_ENTRY 4
+#define FASTCTX_RET 7
+
+#elif defined(__aarch64__)
+__asm__(
+	".text\n"
+	".globl psc__fastctx_switch\n"
+	".hidden psc__fastctx_switch\n"
+	".type psc__fastctx_switch, %function\n"
+	".p2align 4\n"
+	"psc__fastctx_switch:\n"
+	"	sub sp, sp, #160\n"
+	"	stp x19, x20, [sp, #0]\n"
+	"	stp x21, x22, [sp, #16]\n"
+	"	stp x23, x24, [sp, #32]\n"
+	"	stp x25, x26, [sp, #48]\n"
+	"	stp x27, x28, [sp, #64]\n"
+	"	stp x29, x30, [sp, #80]\n"
+	"	stp d8, d9, [sp, #96]\n"
+	"	stp d10, d11, [sp, #112]\n"
+	"	stp d12, d13, [sp, #128]\n"
+	"	stp d14, d15, [sp, #144]\n"
+	"	mov x2, sp\n"
+	"	str x2, [x0]\n"
+	"	mov sp, x1\n"
+	"	ldp x19, x20, [sp, #0]\n"
+	"	ldp x21, x22, [sp, #16]\n"
+	"	ldp x23, x24, [sp, #32]\n"
+	"	ldp x25, x26, [sp, #48]\n"
+	"	ldp x27, x28, [sp, #64]\n"
+	"	ldp x29, x30, [sp, #80]\n"
+	"	ldp d8, d9, [sp, #96]\n"
+	"	ldp d10, d11, [sp, #112]\n"
+	"	ldp d12, d13, [sp, #128]\n"
+	"	ldp d14, d15, [sp, #144]\n"
+	"	add sp, sp, #160\n"
+	"	ret\n"
+	".size psc__fastctx_switch, .-psc__fastctx_switch\n"
+	".globl psc__fastctx_start\n"
+	".hidden psc__fastctx_start\n"
+	".type psc__fastctx_start, %function\n"
+	".p2align 4\n"
+	"psc__fastctx_start:\n"
+	"	mov x29, #0\n"
+	"	mov x30, #0\n"
+	"	blr x19\n"
+	"	brk #0\n"
+	".size psc__fastctx_start, .-psc__fastctx_start\n"
+);
+
+/* Initial frame: x19 - x30, d8 - d15 */
+#define FASTCTX_FRAMESZ 20
+#define FASTCTX_ENTRY 0
+#define FASTCTX_RET 11
+
+#endif
+
+#endif
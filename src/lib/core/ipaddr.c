@@ -26,13 +26,22 @@
 #  include <pthread.h>
 #endif
 
+enum strstate
+{
+    SS_NONE,
+    SS_BUSY,
+    SS_DONE
+};
+
 struct PSC_IpAddr
 {
 #ifdef IPA_NO_ATOMICS
     pthread_mutex_t reflock;
     unsigned refcnt;
+    int strstate;
 #else
     atomic_uint refcnt;
+    atomic_int strstate;
 #endif
     PSC_Proto proto;
     unsigned prefixlen;
@@ -100,57 +109,98 @@ static int parsev6(uint8_t *data, const char *buf)
     return 0;
 }
 
+static char *fmtdec(char *str, unsigned val)
+{
+    char digits[10];
+    int n = 0;
+    do
+    {
+	digits[n++] = '0' + val % 10;
+	val /= 10;
+    } while (val);
+    while (n) *str++ = digits[--n];
+    return str;
+}
+
+static char *fmthex(char *str, unsigned word)
+{
+    static const char digits[] = "0123456789abcdef";
+    int shift = 12;
+    while (shift && !(word >> shift)) shift -= 4;
+    for (; shift >= 0; shift -= 4) *str++ = digits[(word >> shift) & 0xf];
+    return str;
+}
+
 static void toString(PSC_IpAddr *self)
 {
-    int len = 0;
+    char *str = self->str;
     if (self->proto == PSC_P_IPv4)
     {
-	len = sprintf(self->str, "%hhu.%hhu.%hhu.%hhu",
-		self->data[12], self->data[13],
-		self->data[14], self->data[15]);
-	if (len < 0) len = 0;
-	if (self->prefixlen < 32) sprintf(self->str + len,
-		"/%u", self->prefixlen);
+	for (int i = 12; i < 16; ++i)
+	{
+	    if (i > 12) *str++ = '.';
+	    str = fmtdec(str, self->data[i]);
+	}
+	if (self->prefixlen < 32)
+	{
+	    *str++ = '/';
+	    str = fmtdec(str, self->prefixlen);
+	}
     }
     else
     {
+	/* compress the first longest run of at least two zero words */
 	unsigned word[8];
-	int gap = 0;
-	int gaplen = 0;
+	int gap = -1;
+	int gaplen = 1;
 	for (int i = 0; i < 8; ++i)
 	{
-	    if (!(word[i] = (self->data[2*i] << 8) | self->data[2*i+1]))
+	    word[i] = (self->data[2*i] << 8) | self->data[2*i+1];
+	}
+	for (int i = 0; i < 8;)
+	{
+	    if (word[i])
 	    {
-		if (i > gap + gaplen)
-		{
-		    gap = i;
-		    gaplen = 1;
-		}
-		else ++gaplen;
+		++i;
+		continue;
 	    }
+	    int j = i;
+	    while (j < 8 && !word[j]) ++j;
+	    if (j - i > gaplen)
+	    {
+		gap = i;
+		gaplen = j - i;
+	    }
+	    i = j;
 	}
-	int needcolon = 0;
 	for (int i = 0; i < 8;)
 	{
-	    if (i == gap && gaplen > 0)
+	    if (i == gap)
 	    {
-		self->str[len++] = ':';
-		self->str[len++] = ':';
-		self->str[len] = 0;
-		needcolon = 0;
+		*str++ = ':';
+		*str++ = ':';
 		i += gaplen;
 		continue;
 	    }
-	    if (needcolon) self->str[len++] = ':';
-	    needcolon = 1;
-	    int rc = sprintf(self->str + len, "%x", word[i]);
-	    if (rc < 0) self->str[len] = 0;
-	    else len += rc;
-	    ++i;
+	    if (i && i != gap + gaplen) *str++ = ':';
+	    str = fmthex(str, word[i++]);
+	}
+	if (self->prefixlen < 128)
+	{
+	    *str++ = '/';
+	    str = fmtdec(str, self->prefixlen);
 	}
-	if (self->prefixlen < 128) sprintf(self->str+len,
-		"/%u", self->prefixlen);
     }
+    *str = 0;
+}
+
+static void initStr(PSC_IpAddr *self)
+{
+#ifdef IPA_NO_ATOMICS
+    self->strstate = SS_NONE;
+#else
+    atomic_store_explicit(&self->strstate, SS_NONE, memory_order_relaxed);
+#endif
 }
 
 SOLOCAL PSC_IpAddr *PSC_IpAddr_fromSockAddr(const struct sockaddr *addr)
@@ -199,7 +249,7 @@ SOLOCAL PSC_IpAddr *PSC_IpAddr_fromSockAddr(const struct sockaddr *addr)
     self->prefixlen = prefixlen;
     self->port = port;
     memcpy(self->data, data, 16);
-    toString(self);
+    initStr(self);
 
     return self;
 }
@@ -254,7 +304,7 @@ SOEXPORT PSC_IpAddr *PSC_IpAddr_create(const char *str)
     self->prefixlen = prefixlen;
     self->port = -1;
     memcpy(self->data, data, 16);
-    toString(self);
+    initStr(self);
 
     return self;
 }
@@ -305,7 +355,7 @@ SOEXPORT PSC_IpAddr *PSC_IpAddr_tov4(const PSC_IpAddr *self,
     mapped->port = -1;
     memset(mapped->data, 0, 12);
     memcpy(mapped->data+12, self->data+12, 4);
-    toString(mapped);
+    initStr(mapped);
 
     return mapped;
 }
@@ -328,9 +378,10 @@ SOEXPORT PSC_IpAddr *PSC_IpAddr_tov6(const PSC_IpAddr *self,
 #endif
     mapped->proto = PSC_P_IPv6;
     mapped->prefixlen = self->prefixlen + 96;
+    mapped->port = -1;
     memcpy(mapped->data, prefix->data, 12);
     memcpy(mapped->data+12, self->data+12, 4);
-    toString(mapped);
+    initStr(mapped);
 
     return mapped;
 }
@@ -383,6 +434,33 @@ SOEXPORT const void *PSC_IpAddr_raw(const PSC_IpAddr *self)
 
 SOEXPORT const char *PSC_IpAddr_string(const PSC_IpAddr *self)
 {
+    PSC_IpAddr *mut = (PSC_IpAddr *)self;
+#ifdef IPA_NO_ATOMICS
+    pthread_mutex_lock(&mut->reflock);
+    if (mut->strstate != SS_DONE)
+    {
+	toString(mut);
+	mut->strstate = SS_DONE;
+    }
+    pthread_mutex_unlock(&mut->reflock);
+#else
+    int state = atomic_load_explicit(&mut->strstate, memory_order_acquire);
+    if (state == SS_DONE) return self->str;
+    state = SS_NONE;
+    if (atomic_compare_exchange_strong_explicit(&mut->strstate, &state,
+		SS_BUSY, memory_order_acq_rel, memory_order_acquire))
+    {
+	toString(mut);
+	atomic_store_explicit(&mut->strstate, SS_DONE, memory_order_release);
+    }
+    else
+    {
+	/* another thread is formatting the string, this is quick */
+	while (atomic_load_explicit(&mut->strstate, memory_order_acquire)
+		!= SS_DONE)
+	    ;
+    }
+#endif
     return self->str;
 }
 
@@ -121,6 +121,7 @@ SOEXPORT int PSC_Log_enabled(PSC_LogLevel level)
 static void enqueueLogJob(void *arg)
 {
     PSC_ThreadJob *job = PSC_ThreadJob_create(logmsgJobProc, arg, 4000);
+    PSC_ThreadJob_setClass(job, PSC_JC_BACKGROUND);
     PSC_ThreadPool_enqueue(job);
 }
 
@@ -22,18 +22,33 @@ static long pagesz;
 #endif
 
 C_CLASS_DECL(ObjPoolHdr);
+C_CLASS_DECL(FreeObj);
+
+#define NOSLOT ((size_t)-1)
+
+/* Every chunk has a slot in a directory, its index is stored in the id of
+ * each object, so the chunk of an object is found without searching.
+ * Free objects are linked in a list per chunk, and all chunks having free
+ * objects are linked in a list of the pool, so allocating and freeing
+ * never needs to scan. Objects never used yet are taken from the end of a
+ * chunk, so pages of a fresh chunk aren't touched before they're needed.
+ * A chunk becoming completely free is released, the last one released is
+ * kept (with its pages given back to the OS) for a while for reuse. */
+typedef struct ChunkSlot
+{
+    ObjPoolHdr *hdr;
+    size_t nextfree;
+} ChunkSlot;
 
 struct ObjectPool
 {
     size_t objsz;
     size_t objsperchunk;
-    size_t nobj;
-    size_t nfree;
     size_t chunksz;
-    size_t firstfree;
-    size_t lastused;
-    ObjPoolHdr *first;
-    ObjPoolHdr *last;
+    ChunkSlot *slots;
+    size_t nslots;
+    size_t freeslot;
+    ObjPoolHdr *partial;
     ObjPoolHdr *keep;
     unsigned keepcnt;
 };
@@ -42,7 +57,17 @@ struct ObjPoolHdr
 {
     ObjPoolHdr *prev;
     ObjPoolHdr *next;
+    FreeObj *freelist;
     size_t nfree;
+    size_t ninit;
+    size_t slot;
+};
+
+/* Layout of a free object, overlaying PoolObj */
+struct FreeObj
+{
+    size_t id;
+    FreeObj *next;
 };
 
 #ifdef POOL_MFLAGS
@@ -68,59 +93,37 @@ SOLOCAL ObjectPool *ObjectPool_create(size_t objSz, size_t objsPerChunk)
 	self->objsperchunk += extra / objSz;
     }
 #endif
-    self->firstfree = POOLOBJ_USEDMASK;
-    self->lastused = POOLOBJ_USEDMASK;
+    self->freeslot = NOSLOT;
     return self;
 }
 
-void *ObjectPool_alloc(ObjectPool *self)
+static void freeChunk(ObjectPool *self, ObjPoolHdr *hdr)
 {
-    if (self->keep) ++self->keepcnt;
-    if (!(self->firstfree & POOLOBJ_USEDMASK))
-    {
-	size_t chunkno = self->firstfree / self->objsperchunk;
-	ObjPoolHdr *hdr = self->first;
-	for (size_t i = 0; i < chunkno; ++i) hdr = hdr->next;
-	char *p = (char *)hdr + sizeof *hdr +
-	    (self->firstfree % self->objsperchunk) * self->objsz;
-	((PoolObj *)p)->id = self->firstfree | POOLOBJ_USEDMASK;
-	((PoolObj *)p)->pool = self;
-	if ((self->lastused & POOLOBJ_USEDMASK)
-		|| self->firstfree > self->lastused)
-	{
-	    self->lastused = self->firstfree;
-	}
-	--hdr->nfree;
-	if (--self->nfree)
-	{
-	    size_t nextfree;
-	    char *f;
-	    if (hdr->nfree)
-	    {
-		f = p + self->objsz;
-		nextfree = self->firstfree + 1;
-	    }
-	    else
-	    {
-		while (!hdr->nfree)
-		{
-		    ++chunkno;
-		    hdr = hdr->next;
-		}
-		f = (char *)hdr + sizeof *hdr;
-		nextfree = chunkno * self->objsperchunk;
-	    }
-	    while (((PoolObj *)f)->id & POOLOBJ_USEDMASK)
-	    {
-		f += self->objsz;
-		++nextfree;
-	    }
-	    self->firstfree = nextfree;
-	}
-	else self->firstfree = POOLOBJ_USEDMASK;
-	return p;
-    }
+#ifdef POOL_MFLAGS
+    munmap(hdr, self->chunksz);
+#else
+    (void)self;
+    free(hdr);
+#endif
+}
+
+static void linkPartial(ObjectPool *self, ObjPoolHdr *hdr)
+{
+    hdr->prev = 0;
+    hdr->next = self->partial;
+    if (self->partial) self->partial->prev = hdr;
+    self->partial = hdr;
+}
+
+static void unlinkPartial(ObjectPool *self, ObjPoolHdr *hdr)
+{
+    if (hdr->prev) hdr->prev->next = hdr->next;
+    else self->partial = hdr->next;
+    if (hdr->next) hdr->next->prev = hdr->prev;
+}
 
+static ObjPoolHdr *newChunk(ObjectPool *self)
+{
     ObjPoolHdr *hdr;
     if (self->keep)
     {
@@ -136,59 +139,89 @@ void *ObjectPool_alloc(ObjectPool *self)
 	hdr = PSC_malloc(self->chunksz);
 #endif
     }
-    hdr->prev = self->last;
-    hdr->next = 0;
-    hdr->nfree = self->objsperchunk - 1;
-    self->nfree += hdr->nfree;
-    self->firstfree = self->nobj + 1;
-    char *p = (char *)hdr + sizeof *hdr;
-    ((PoolObj *)p)->id = self->nobj | POOLOBJ_USEDMASK;
-    ((PoolObj *)p)->pool = self;
-    self->nobj += self->objsperchunk;
-    if (self->last) self->last->next = hdr;
-    else self->first = hdr;
-    self->last = hdr;
-    return p;
+    if (self->freeslot == NOSLOT)
+    {
+	size_t nslots = self->nslots ? 2 * self->nslots : 8;
+	self->slots = PSC_realloc(self->slots, nslots * sizeof *self->slots);
+	for (size_t i = self->nslots; i < nslots; ++i)
+	{
+	    self->slots[i].hdr = 0;
+	    self->slots[i].nextfree = i + 1 < nslots ? i + 1 : NOSLOT;
+	}
+	self->freeslot = self->nslots;
+	self->nslots = nslots;
+    }
+    hdr->slot = self->freeslot;
+    self->freeslot = self->slots[hdr->slot].nextfree;
+    self->slots[hdr->slot].hdr = hdr;
+    hdr->freelist = 0;
+    hdr->nfree = self->objsperchunk;
+    hdr->ninit = 0;
+    linkPartial(self, hdr);
+    return hdr;
+}
+
+static void releaseChunk(ObjectPool *self, ObjPoolHdr *hdr)
+{
+    unlinkPartial(self, hdr);
+    self->slots[hdr->slot].hdr = 0;
+    self->slots[hdr->slot].nextfree = self->freeslot;
+    self->freeslot = hdr->slot;
+    if (self->keep) freeChunk(self, self->keep);
+    self->keep = hdr;
+    self->keepcnt = 16;
+#if defined(POOL_MFLAGS) && defined(HAVE_MADVISE) && defined(HAVE_MADVFREE)
+    madvise(hdr, self->chunksz, MADV_FREE);
+#endif
+}
+
+void *ObjectPool_alloc(ObjectPool *self)
+{
+    if (self->keep) ++self->keepcnt;
+    ObjPoolHdr *hdr = self->partial;
+    if (!hdr) hdr = newChunk(self);
+    PoolObj *obj;
+    if (hdr->freelist)
+    {
+	obj = (PoolObj *)hdr->freelist;
+	hdr->freelist = hdr->freelist->next;
+    }
+    else obj = (PoolObj *)((char *)hdr + sizeof *hdr
+	    + hdr->ninit++ * self->objsz);
+    obj->id = hdr->slot | POOLOBJ_USEDMASK;
+    obj->pool = self;
+    if (!--hdr->nfree) unlinkPartial(self, hdr);
+    return obj;
 }
 
 SOLOCAL void ObjectPool_destroy(ObjectPool *self, void (*objdestroy)(void *))
 {
     if (!self) return;
 
-#ifdef POOL_MFLAGS
-    if (self->keep) munmap(self->keep, self->chunksz);
-#else
-    free(self->keep);
-#endif
+    if (self->keep) freeChunk(self, self->keep);
 
-    for (ObjPoolHdr *hdr = self->first, *next = 0; hdr; hdr = next)
+    for (size_t i = 0; i < self->nslots; ++i)
     {
-	next = hdr->next;
+	ObjPoolHdr *hdr = self->slots[i].hdr;
+	if (!hdr) continue;
 	if (objdestroy)
 	{
 	    size_t used = self->objsperchunk - hdr->nfree;
-	    if (used)
+	    char *p = (char *)hdr + sizeof *hdr;
+	    while (used)
 	    {
-		char *p = (char *)hdr + sizeof *hdr;
-		while (used)
+		if (((PoolObj *)p)->id & POOLOBJ_USEDMASK)
 		{
-		    while (!(((PoolObj *)p)->id & POOLOBJ_USEDMASK))
-		    {
-			p += self->objsz;
-		    }
 		    objdestroy(p);
 		    --used;
-		    p += self->objsz;
 		}
+		p += self->objsz;
 	    }
 	}
-#ifdef POOL_MFLAGS
-	munmap(hdr, self->chunksz);
-#else
-	free(hdr);
-#endif
+	freeChunk(self, hdr);
     }
 
+    free(self->slots);
     free(self);
 }
 
@@ -200,77 +233,15 @@ SOLOCAL void PoolObj_free(void *obj)
 
     if (self->keep && !--self->keepcnt)
     {
-#ifdef POOL_MFLAGS
-	munmap(self->keep, self->chunksz);
-#else
-	free(self->keep);
-#endif
+	freeChunk(self, self->keep);
 	self->keep = 0;
     }
 
-    po->id &= ~POOLOBJ_USEDMASK;
-    if ((self->firstfree & POOLOBJ_USEDMASK)
-	    || po->id < self->firstfree) self->firstfree = po->id;
-    ++self->nfree;
-
-    size_t chunkno = po->id / self->objsperchunk;
-    ObjPoolHdr *hdr = self->first;
-    for (size_t i = 0; i < chunkno; ++i) hdr = hdr->next;
-    ++hdr->nfree;
-
-    if (po->id != self->lastused) return;
-
-    size_t lastchunk = chunkno;
-    while (hdr && hdr->nfree == self->objsperchunk)
-    {
-	--lastchunk;
-	self->last = hdr->prev;
-	self->nfree -= self->objsperchunk;
-	self->nobj -= self->objsperchunk;
-	if (self->keep)
-	{
-#ifdef POOL_MFLAGS
-	    munmap(self->keep, self->chunksz);
-#else
-	    free(self->keep);
-#endif
-	}
-	self->keep = hdr;
-	self->keepcnt = 16;
-#if defined(POOL_MFLAGS) && defined(HAVE_MADVISE) && defined(HAVE_MADVFREE)
-	madvise(self->keep, self->chunksz, MADV_FREE);
-#endif
-	hdr = self->last;
-	if (hdr) hdr->next = 0;
-    }
-
-    if (lastchunk & POOLOBJ_USEDMASK)
-    {
-	self->lastused = POOLOBJ_USEDMASK;
-	self->firstfree = POOLOBJ_USEDMASK;
-	return;
-    }
-
-    char *p = obj;
-    if (lastchunk < chunkno)
-    {
-	self->lastused = (chunkno + 1) * self->objsperchunk - 1;
-	p = (char *)hdr + sizeof hdr + self->lastused * self->objsz;
-    }
-    while (!(((PoolObj *)p)->id & POOLOBJ_USEDMASK))
-    {
-	p -= self->objsz;
-	--self->lastused;
-    }
-
-#if defined(POOL_MFLAGS) && defined(HAVE_MADVISE) && defined(HAVE_MADVFREE)
-    size_t usedbytes = (p - (char *)hdr) + self->objsz;
-    size_t usedpg = usedbytes / pagesz + !!(usedbytes % pagesz) * pagesz;
-    size_t freebytes = self->chunksz - (usedpg * pagesz);
-    if (freebytes)
-    {
-	madvise((char *)hdr + usedpg * pagesz, freebytes, MADV_FREE);
-    }
-#endif
+    ObjPoolHdr *hdr = self->slots[po->id & POOLOBJ_IDMASK].hdr;
+    FreeObj *fo = obj;
+    fo->id = hdr->slot;
+    fo->next = hdr->freelist;
+    hdr->freelist = fo;
+    if (!hdr->nfree++) linkPartial(self, hdr);
+    if (hdr->nfree == self->objsperchunk) releaseChunk(self, hdr);
 }
-
@@ -3,6 +3,7 @@
 #include <poser/core/ratelimit.h>
 
 #include <poser/core/dictionary.h>
+#include <poser/core/service.h>
 #include <poser/core/util.h>
 #include <pthread.h>
 #include <stdint.h>
@@ -119,9 +120,9 @@ static int expired(const void *key, size_t keysz, void *obj, const void *arg)
     return isexpired;
 }
 
-static int checkLimit(Limit *self, Entry *e, struct timespec *ts)
+static int checkLimit(Limit *self, Entry *e, uint64_t secs)
 {
-    uint16_t now = ts->tv_sec / self->res;
+    uint16_t now = secs / self->res;
 #ifndef RLIM_NO_ATOMICS
     while (atomic_flag_test_and_set_explicit(&e->lock, memory_order_acq_rel)) ;
 #endif
@@ -156,8 +157,7 @@ static int checkLimit(Limit *self, Entry *e, struct timespec *ts)
 int PSC_RateLimit_check(PSC_RateLimit *self, const void *key, size_t keysz)
 {
     int ok = 1;
-    struct timespec ts;
-    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) return 0;
+    uint64_t secs = PSC_Service_nowMs() / 1000U;
     if (!--self->cleancount)
     {
 	struct expiredarg *ea = PSC_malloc(sizeof *ea
@@ -166,7 +166,7 @@ int PSC_RateLimit_check(PSC_RateLimit *self, const void *key, size_t keysz)
 	ea->nlimits = self->nlimits;
 	for (size_t i = 0; i < self->nlimits; ++i)
 	{
-	    ea->now[i] = ts.tv_sec / self->limits[i].res;
+	    ea->now[i] = secs / self->limits[i].res;
 	}
 	PSC_Dictionary_removeAll(self->entries, expired, ea);
 	free(ea);
@@ -190,7 +190,7 @@ int PSC_RateLimit_check(PSC_RateLimit *self, const void *key, size_t keysz)
 	memset(entries(ne), 0, self->nlimits * sizeof *entries(ne));
 	for (size_t i = 0; i < self->nlimits; ++i)
 	{
-	    entries(ne)[i].last = ts.tv_sec / self->limits[i].res;
+	    entries(ne)[i].last = secs / self->limits[i].res;
 	}
 	PSC_Dictionary_set(self->entries, key, keysz, ne, 0);
 	e = PSC_Dictionary_get(self->entries, key, keysz);
@@ -200,7 +200,7 @@ int PSC_RateLimit_check(PSC_RateLimit *self, const void *key, size_t keysz)
 #endif
     for (size_t i = 0; i < self->nlimits; ++i)
     {
-	if (!checkLimit(self->limits + i, entries(e) + i, &ts)) ok = 0;
+	if (!checkLimit(self->limits + i, entries(e) + i, secs)) ok = 0;
     }
 #ifdef RLIM_NO_ATOMICS
     pthread_mutex_unlock(&e->lock);
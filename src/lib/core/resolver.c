@@ -125,6 +125,7 @@ SOEXPORT int PSC_Resolver_resolve(PSC_Resolver *self, int forceAsync)
     if (PSC_ThreadPool_active())
     {
 	self->job = PSC_ThreadJob_create(resolveProc, self, 0);
+	PSC_ThreadJob_setClass(self->job, PSC_JC_RESOLVE);
 	PSC_Event_register(PSC_ThreadJob_finished(self->job), self,
 		resolveDone, 0);
 	if (PSC_ThreadPool_enqueue(self->job) < 0)
@@ -52,3 +52,9 @@ SOEXPORT void PSC_RunOpts_workerThreads(int workerThreads)
     if (!initialized) PSC_RunOpts_init(0);
     opts.workerThreads = workerThreads;
 }
+
+SOEXPORT void PSC_RunOpts_coarseClock(void)
+{
+    if (!initialized) PSC_RunOpts_init(0);
+    opts.coarseClock = 1;
+}
@@ -13,6 +13,7 @@ typedef struct PSC_RunOpts
     int daemonize;
     int waitLaunched;
     int logEnabled;
+    int coarseClock;
 } PSC_RunOpts;
 
 PSC_RunOpts *runOpts(void) ATTR_RETNONNULL;
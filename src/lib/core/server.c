@@ -2,12 +2,15 @@
 
 #include "certinfo.h"
 #include "connection.h"
+#include "daemon.h"
 #include "ipaddr.h"
 #include "sharedobj.h"
 
+#include <poser/core/dictionary.h>
 #include <poser/core/event.h>
 #include <poser/core/hash.h>
 #include <poser/core/log.h>
+#include <poser/core/ratelimit.h>
 #include <poser/core/service.h>
 #include <poser/core/server.h>
 #include <poser/core/timer.h>
@@ -15,6 +18,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <semaphore.h>
@@ -33,15 +37,35 @@
 #  include <openssl/ssl.h>
 #endif
 
+#undef SRV_PLAINCOUNTERS
+#undef SRV_COUNTERLOCK
 #ifdef NO_SHAREDOBJ
+#  define SRV_PLAINCOUNTERS
 #  include <pthread.h>
+#elif ATOMIC_LLONG_LOCK_FREE != 2
+#  define SRV_PLAINCOUNTERS
+#  define SRV_COUNTERLOCK
+#  include <pthread.h>
+#endif
+
+#ifdef __linux__
+#  include <linux/filter.h>
 #endif
 
+extern char **environ;
+
 #ifndef MAXSOCKS
 #define MAXSOCKS 64
 #endif
 
 #define BINDCHUNK 8
+#define BLOCKCHUNK 16
+
+#define DEFACCEPTBATCH 16
+#define MAXACCEPTBATCH 1024
+
+#define RETRYMS 100
+#define BUSYPENALTY 20
 
 #ifdef WITH_TLS
 enum ccertmode
@@ -62,15 +86,30 @@ struct PSC_TcpServerOpts
     void *validatorObj;
     PSC_CertValidator validator;
 #endif
+    PSC_IpAddr **blocked;
+    int *ratelimits;
     size_t bh_capa;
     size_t bh_count;
+    size_t bl_capa;
+    size_t bl_count;
+    size_t rl_count;
     size_t rdbufsz;
     PSC_Proto proto;
 #ifdef WITH_TLS
     int tls;
     enum ccertmode tls_client_cert;
 #endif
+    size_t maxconn;
+    size_t maxthrconn;
+    size_t maxtlspending;
+    void *placementObj;
+    PSC_PlacementHook placementHook;
+    PSC_PlacementPolicy placement;
+    PSC_OverloadPolicy overload;
+    unsigned maxrate;
+    unsigned acceptbatch;
     int port;
+    int reuseport;
 };
 
 struct PSC_UnixServerOpts
@@ -85,8 +124,29 @@ struct PSC_UnixServerOpts
 static char hostbuf[NI_MAXHOST];
 static char servbuf[NI_MAXSERV];
 
-static struct sockaddr_in sain;
-static struct sockaddr_in6 sain6;
+typedef struct UpgradeMsg
+{
+    uint64_t bhash;
+    int32_t port;
+    int32_t proto;
+    uint32_t nfds;
+    uint32_t more;
+    uint8_t st[MAXSOCKS];
+    uint8_t spare[MAXSOCKS];
+} UpgradeMsg;
+
+typedef struct InheritedListeners
+{
+    UpgradeMsg msg;
+    int fds[MAXSOCKS];
+} InheritedListeners;
+
+static PSC_Server *tcpservers;
+static InheritedListeners *inherited;
+static size_t ninherited;
+static PSC_Timer *upgradeTimer;
+static int inheritedLoaded;
+static int upgradefd = -1;
 
 #ifdef WITH_TLS
 static int have_ctx_idx;
@@ -111,6 +171,18 @@ typedef struct TlsConfig
 } TlsConfig;
 #endif
 
+typedef struct Blocklist
+{
+#ifndef NO_SHAREDOBJ
+    SharedObj base;
+#endif
+    PSC_Dictionary *prefixes;
+    unsigned nv4lens;
+    unsigned nv6lens;
+    uint8_t v4lens[33];
+    uint8_t v6lens[129];
+} Blocklist;
+
 enum saddrt
 {
     ST_UNIX,
@@ -121,17 +193,49 @@ enum saddrt
 typedef struct SockInfo
 {
     int fd;
+    int thr;
+    int spare;
     enum saddrt st;
 } SockInfo;
 
-typedef struct AcceptRecord
+typedef struct ListenerCmd
+{
+    PSC_Server *srv;
+    sem_t *done;
+    size_t nfds;
+    int fds[];
+} ListenerCmd;
+
+typedef struct AcceptRecord AcceptRecord;
+struct AcceptRecord
 {
+    AcceptRecord *next;
     PSC_Server *srv;
     PSC_IpAddr *addr;
     const char *path;
     ConnOpts opts;
     int fd;
-} AcceptRecord;
+};
+
+typedef struct AcceptBatch
+{
+    AcceptRecord *first;
+    AcceptRecord *last;
+    size_t count;
+    size_t load;
+    unsigned busy;
+} AcceptBatch;
+
+typedef struct AcceptGate
+{
+    PSC_Timer *resumeTimer;
+    uint64_t lastMs;
+    uint64_t tokens;
+    unsigned rate;
+    int paused;
+} AcceptGate;
+
+#define NCOUNTERS (PSC_SC_REJECTED + 1)
 
 typedef struct ThreadRecord
 {
@@ -139,45 +243,79 @@ typedef struct ThreadRecord
     size_t nactive;
 #else
     atomic_size_t nactive;
+#endif
+#ifdef SRV_PLAINCOUNTERS
+    uint64_t counters[NCOUNTERS];
+#else
+    _Atomic uint64_t counters[NCOUNTERS];
 #endif
     ObjectPool *pool;
+    AcceptGate gate;
 } ThreadRecord;
 
 struct PSC_Server
 {
+    PSC_Server *next;
     void *owner;
     PSC_ClientConnectedCallback clientConnected;
     void (*shutdownComplete)(void *);
     PSC_Timer *shutdownTimer;
     ThreadRecord *clients;
+    AcceptBatch *batches;
+    void *placementObj;
+    PSC_PlacementHook placementHook;
+    PSC_Hash *iphash;
+    PSC_RateLimit *ratelimit;
+    int *ratelimits;
     char *path;
 #ifdef NO_SHAREDOBJ
+    Blocklist *blocklist;
+    pthread_mutex_t bllock;
 #  ifdef WITH_TLS
     TlsConfig *tlscfg;
     pthread_mutex_t tlslock;
 #  endif
     pthread_mutex_t lock;
     size_t nconn;
+#  ifdef WITH_TLS
+    size_t ntlspending;
+#  endif
 #else
+    Blocklist *_Atomic blocklist;
 #  ifdef WITH_TLS
     TlsConfig *_Atomic tlscfg;
+    atomic_size_t ntlspending;
 #  endif
     atomic_size_t nconn;
+#  ifdef SRV_COUNTERLOCK
+    pthread_mutex_t countlock;
+#  endif
 #endif
+    AcceptGate gate;
     sem_t allclosed;
     uint64_t bhash;
     size_t nsocks;
+    size_t nratelimits;
     size_t rdbufsz;
+    size_t maxconn;
+    size_t maxthrconn;
+    size_t maxtlspending;
     PSC_Proto proto;
+    PSC_PlacementPolicy placement;
+    PSC_OverloadPolicy overload;
     int port;
     int disabled;
+    unsigned maxrate;
+    unsigned acceptbatch;
     int nthr;
     int nextthr;
-    SockInfo socks[];
+    int reuseport;
+    SockInfo *socks;
 };
 
 static void acceptConnection(void *receiver, void *sender, void *args);
 static void removeConnection(void *receiver, void *sender, void *args);
+static void resumeListeners(void *receiver, void *sender, void *args);
 
 #ifdef WITH_TLS
 static int ctxverifycallback(int preverify_ok, X509_STORE_CTX *ctx)
@@ -213,22 +351,59 @@ done:
 }
 #endif
 
+static void countConnection(PSC_Server *self, ThreadRecord *thr,
+	PSC_Connection *conn)
+{
+    uint64_t val[NCOUNTERS] = { 0 };
+    val[PSC_SC_CLOSED] = 1;
+    val[PSC_SC_BYTESRECEIVED] = PSC_Connection_bytesReceived(conn);
+    val[PSC_SC_BYTESSENT] = PSC_Connection_bytesSent(conn);
+    val[PSC_SC_MSGRECEIVED] = PSC_Connection_messagesReceived(conn);
+    val[PSC_SC_MSGSENT] = PSC_Connection_messagesSent(conn);
+
+    /* counters are only ever written from the owning service thread, so
+     * a relaxed load and store is enough for atomicity towards readers.
+     * Without lock-free 64bit atomics, they're protected by a mutex (the
+     * server lock, already held here without shared object support). */
+#ifdef SRV_COUNTERLOCK
+    pthread_mutex_lock(&self->countlock);
+#else
+    (void)self;
+#endif
+    for (int i = PSC_SC_CLOSED; i <= PSC_SC_MSGSENT; ++i)
+    {
+#ifdef SRV_PLAINCOUNTERS
+	thr->counters[i] += val[i];
+#else
+	atomic_store_explicit(&thr->counters[i], val[i]
+		+ atomic_load_explicit(&thr->counters[i],
+		    memory_order_relaxed), memory_order_relaxed);
+#endif
+    }
+#ifdef SRV_COUNTERLOCK
+    pthread_mutex_unlock(&self->countlock);
+#endif
+}
+
 static void removeConnection(void *receiver, void *sender, void *args)
 {
     (void)sender;
-    (void)args;
 
     PSC_Server *self = receiver;
+    PSC_Connection *conn = args;
 
     int thrno = PSC_Service_threadNo();
+    ThreadRecord *thr = self->clients + (thrno < 0 ? 0 : thrno);
 #ifdef NO_SHAREDOBJ
     pthread_mutex_lock(&self->lock);
     if (thrno >= 0) --self->clients[thrno].nactive;
+    if (conn) countConnection(self, thr, conn);
     if (!--self->nconn) sem_post(&self->allclosed);
     pthread_mutex_unlock(&self->lock);
 #else
     if (thrno >= 0) atomic_fetch_sub_explicit(&self->clients[thrno].nactive,
 	    1, memory_order_acq_rel);
+    if (conn) countConnection(self, thr, conn);
     if (atomic_fetch_sub_explicit(&self->nconn, 1, memory_order_acq_rel) == 1)
     {
 	sem_post(&self->allclosed);
@@ -236,6 +411,22 @@ static void removeConnection(void *receiver, void *sender, void *args)
 #endif
 }
 
+#ifdef WITH_TLS
+static void tlsHandshakeDone(void *obj, PSC_Connection *conn)
+{
+    (void)conn;
+
+    PSC_Server *self = obj;
+#  ifdef NO_SHAREDOBJ
+    pthread_mutex_lock(&self->lock);
+    --self->ntlspending;
+    pthread_mutex_unlock(&self->lock);
+#  else
+    atomic_fetch_sub_explicit(&self->ntlspending, 1, memory_order_acq_rel);
+#  endif
+}
+#endif
+
 static void doaccept(void *arg)
 {
     AcceptRecord *rec = arg;
@@ -248,6 +439,19 @@ static void doaccept(void *arg)
 #  endif
     rec->opts.tls_ctx = tlscfg->tls_ctx;
     rec->opts.tls_mode = tlscfg->tls != TL_NONE ? TM_SERVER : TM_NONE;
+    if (rec->opts.tls_mode == TM_SERVER && rec->srv->maxtlspending)
+    {
+	rec->opts.tls_handshakeDone = tlsHandshakeDone;
+	rec->opts.tls_handshakeObj = rec->srv;
+#  ifdef NO_SHAREDOBJ
+	pthread_mutex_lock(&rec->srv->lock);
+	++rec->srv->ntlspending;
+	pthread_mutex_unlock(&rec->srv->lock);
+#  else
+	atomic_fetch_add_explicit(&rec->srv->ntlspending, 1,
+		memory_order_acq_rel);
+#  endif
+    }
 #endif
     PSC_Connection *newconn = PSC_Connection_create(rec->fd, &rec->opts);
 #ifdef WITH_TLS
@@ -273,11 +477,23 @@ static void doaccept(void *arg)
 	}
 	goto done;
     }
+    int thrno = PSC_Service_threadNo();
+    ThreadRecord *thr = rec->srv->clients + (thrno < 0 ? 0 : thrno);
 #ifdef NO_SHAREDOBJ
     pthread_mutex_lock(&rec->srv->lock);
+    ++thr->counters[PSC_SC_ACCEPTED];
     if (!rec->srv->nconn++) sem_wait(&rec->srv->allclosed);
     pthread_mutex_unlock(&rec->srv->lock);
 #else
+#  ifdef SRV_COUNTERLOCK
+    pthread_mutex_lock(&rec->srv->countlock);
+    ++thr->counters[PSC_SC_ACCEPTED];
+    pthread_mutex_unlock(&rec->srv->countlock);
+#  else
+    atomic_store_explicit(&thr->counters[PSC_SC_ACCEPTED],
+	    atomic_load_explicit(&thr->counters[PSC_SC_ACCEPTED],
+		memory_order_relaxed) + 1, memory_order_relaxed);
+#  endif
     if (atomic_fetch_add_explicit(&rec->srv->nconn, 1,
 		memory_order_acq_rel) == 0)
     {
@@ -294,131 +510,833 @@ static void doaccept(void *arg)
     {
 	PSC_Connection_setRemoteAddr(newconn, rec->addr);
     }
-    PSC_Log_fmt(PSC_L_DEBUG, "server: client connected from %s",
+    if (PSC_Log_enabled(PSC_L_DEBUG)) PSC_Log_fmt(PSC_L_DEBUG,
+	    "server: client connected from %s",
 	    PSC_Connection_remoteAddr(newconn));
     rec->srv->clientConnected(rec->srv->owner, newconn);
 done:
     free(rec);
 }
 
-static void acceptConnection(void *receiver, void *sender, void *args)
+static int createListener(int family, const struct sockaddr *addr,
+	socklen_t addrlen, int reuseport)
 {
-    (void)sender;
-    (void)args;
+#ifdef HAVE_ACCEPT4
+    int fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+#else
+    int fd = socket(family, SOCK_STREAM, 0);
+#endif
+    if (fd < 0)
+    {
+	PSC_Log_err(PSC_L_ERROR, "server: cannot create socket");
+	return -1;
+    }
+#ifndef HAVE_ACCEPT4
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    if (!PSC_Service_isValidFd(fd, "server"))
+    {
+	close(fd);
+	return -2;
+    }
 
-    PSC_Server *self = receiver;
-    int *sockfd = args;
-    enum saddrt st = ST_UNIX;
-    for (size_t n = 0; n < self->nsocks; ++n)
+    int opt_true = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
+		&opt_true, sizeof opt_true) < 0)
     {
-	if (self->socks[n].fd == *sockfd)
+	PSC_Log_err(PSC_L_ERROR, "server: cannot set socket option");
+	close(fd);
+	return -1;
+    }
+    if (reuseport)
+    {
+#ifdef SO_REUSEPORT
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+		    &opt_true, sizeof opt_true) < 0)
 	{
-	    st = self->socks[n].st;
-	    break;
+	    PSC_Log_err(PSC_L_ERROR, "server: cannot set SO_REUSEPORT");
+	    close(fd);
+	    return -1;
 	}
+#else
+	PSC_Log_msg(PSC_L_ERROR, "server: SO_REUSEPORT not supported");
+	close(fd);
+	return -1;
+#endif
     }
-    socklen_t salen;
-    struct sockaddr *sa = 0;
-    socklen_t *sl = 0;
-    if (st == ST_INET)
+#ifdef IPV6_V6ONLY
+    if (family == AF_INET6)
     {
-	sa = (struct sockaddr *)&sain;
-	salen = sizeof sain;
-	sl = &salen;
+	setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &opt_true, sizeof opt_true);
     }
-    else if (st == ST_INET6)
+#endif
+    if (bind(fd, addr, addrlen) < 0)
     {
-	sa = (struct sockaddr *)&sain6;
-	salen = sizeof sain6;
-	sl = &salen;
+	PSC_Log_err(PSC_L_ERROR, "server: cannot bind to specified address");
+	close(fd);
+	return -1;
     }
-#ifdef HAVE_ACCEPT4
-    int connfd = accept4(*sockfd, sa, sl, SOCK_NONBLOCK|SOCK_CLOEXEC);
+    if (listen(fd, 128) < 0)
+    {
+	PSC_Log_err(PSC_L_ERROR, "server: cannot listen on socket");
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
+
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+static void steerByCpu(int fd, unsigned n)
+{
+    struct sock_filter code[] = {
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU),
+	BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, n),
+	BPF_STMT(BPF_RET | BPF_A, 0)
+    };
+    struct sock_fprog prog = {
+	.len = sizeof code / sizeof *code,
+	.filter = code
+    };
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+		&prog, sizeof prog) < 0)
+    {
+	PSC_Log_err(PSC_L_WARNING,
+		"server: cannot attach CPU steering program");
+    }
+}
+#endif
+
+static void initGate(AcceptGate *gate, unsigned rate)
+{
+    gate->resumeTimer = 0;
+    gate->lastMs = PSC_Service_nowMs();
+    gate->tokens = (uint64_t)rate * 1000U;
+    gate->rate = rate;
+    gate->paused = 0;
+}
+
+static AcceptGate *gateFor(PSC_Server *self, int thrno)
+{
+    return thrno < 0 ? &self->gate : &self->clients[thrno].gate;
+}
+
+static size_t admissionBudget(PSC_Server *self, AcceptGate *gate,
+	int thrno, unsigned *waitms)
+{
+    size_t budget = self->acceptbatch;
+    *waitms = RETRYMS;
+#ifdef NO_SHAREDOBJ
+    pthread_mutex_lock(&self->lock);
+#endif
+    if (self->maxconn || self->maxthrconn)
+    {
+	/* connections assigned to a service thread are counted in nactive
+	 * before they are actually created there, so summing these up
+	 * includes connections still in flight */
+	size_t total = 0;
+	size_t thrfree = 0;
+	if (self->nthr > 0) for (int i = 0; i < self->nthr; ++i)
+	{
+#ifdef NO_SHAREDOBJ
+	    size_t load = self->clients[i].nactive;
+#else
+	    size_t load = atomic_load_explicit(&self->clients[i].nactive,
+		    memory_order_relaxed);
+#endif
+	    total += load;
+	    if ((thrno < 0 || thrno == i) && load < self->maxthrconn)
+	    {
+		thrfree += self->maxthrconn - load;
+	    }
+	}
+	else
+	{
+#ifdef NO_SHAREDOBJ
+	    total = self->nconn;
 #else
-    int connfd = accept(*sockfd, sa, sl);
+	    total = atomic_load_explicit(&self->nconn, memory_order_relaxed);
 #endif
-    if (connfd < 0)
+	    if (total < self->maxthrconn) thrfree = self->maxthrconn - total;
+	}
+	if (self->maxthrconn && thrfree < budget) budget = thrfree;
+	if (self->maxconn)
+	{
+	    size_t connfree = total < self->maxconn
+		? self->maxconn - total : 0;
+	    if (connfree < budget) budget = connfree;
+	}
+    }
+#ifdef WITH_TLS
+    if (self->maxtlspending)
     {
-	PSC_Log_err(PSC_L_WARNING, "server: failed to accept connection");
-	return;
+#  ifdef NO_SHAREDOBJ
+	size_t pending = self->ntlspending;
+#  else
+	size_t pending = atomic_load_explicit(&self->ntlspending,
+		memory_order_relaxed);
+#  endif
+	size_t tlsfree = pending < self->maxtlspending
+	    ? self->maxtlspending - pending : 0;
+	if (tlsfree < budget) budget = tlsfree;
     }
-#ifndef HAVE_ACCEPT4
-    fcntl(connfd, F_SETFD, FD_CLOEXEC);
-    fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL, 0) | O_NONBLOCK);
 #endif
-    if (self->disabled || !PSC_Service_isValidFd(connfd, "server"))
+#ifdef NO_SHAREDOBJ
+    pthread_mutex_unlock(&self->lock);
+#endif
+    if (gate->rate)
+    {
+	/* token bucket, one connection costs 1000 tokens and every
+	 * millisecond adds as many tokens as connections per second are
+	 * allowed, bursts are limited to one second */
+	uint64_t now = PSC_Service_nowMs();
+	uint64_t burst = (uint64_t)gate->rate * 1000U;
+	gate->tokens += (now - gate->lastMs) * gate->rate;
+	if (gate->tokens > burst) gate->tokens = burst;
+	gate->lastMs = now;
+	size_t avail = gate->tokens / 1000U;
+	if (avail <= budget)
+	{
+	    budget = avail;
+	    *waitms = (1000U - gate->tokens % 1000U + gate->rate - 1)
+		/ gate->rate;
+	}
+    }
+    return budget;
+}
+
+static void pauseListeners(PSC_Server *self, AcceptGate *gate, int thrno,
+	unsigned waitms)
+{
+    if (gate->paused) return;
+    if (!gate->resumeTimer)
+    {
+	if (!(gate->resumeTimer = PSC_Timer_create()))
+	{
+	    PSC_Log_msg(PSC_L_WARNING, "server: cannot create timer for "
+		    "pausing listeners, keeping them active.");
+	    return;
+	}
+	PSC_Event_register(PSC_Timer_expired(gate->resumeTimer), self,
+		resumeListeners, 0);
+    }
+    for (size_t i = 0; i < self->nsocks; ++i)
+    {
+	if (self->socks[i].thr != thrno) continue;
+	PSC_Service_unregisterRead(self->socks[i].fd);
+	gate->paused = 1;
+    }
+    if (!gate->paused) return;
+    PSC_Log_msg(PSC_L_DEBUG, "server: limit reached, pausing listeners");
+    PSC_Timer_setMs(gate->resumeTimer, waitms);
+    PSC_Timer_start(gate->resumeTimer, 0);
+}
+
+static void resumeListeners(void *receiver, void *sender, void *args)
+{
+    (void)sender;
+    (void)args;
+
+    PSC_Server *self = receiver;
+    int thrno = PSC_Service_threadNo();
+    AcceptGate *gate = gateFor(self, thrno);
+    unsigned waitms;
+    if (!admissionBudget(self, gate, thrno, &waitms))
     {
-	struct linger l = { 1, 0 };
-	setsockopt(connfd, SOL_SOCKET, SO_LINGER, &l, sizeof l);
-	close(connfd);
-	if (self->disabled) PSC_Log_msg(PSC_L_DEBUG,
-		"server: rejected connection while disabled");
+	PSC_Timer_setMs(gate->resumeTimer, waitms);
+	PSC_Timer_start(gate->resumeTimer, 0);
 	return;
     }
+    gate->paused = 0;
+    for (size_t i = 0; i < self->nsocks; ++i)
+    {
+	if (self->socks[i].thr != thrno) continue;
+	PSC_Service_registerRead(self->socks[i].fd);
+    }
+    PSC_Log_msg(PSC_L_DEBUG, "server: resuming listeners");
+}
+
+static void destroyGate(AcceptGate *gate)
+{
+    PSC_Timer_destroy(gate->resumeTimer);
+    gate->resumeTimer = 0;
+    gate->paused = 0;
+}
+
+static ListenerCmd *createListenerCmd(PSC_Server *self, int thr,
+	sem_t *done)
+{
+    size_t nfds = 0;
+    for (size_t i = 0; i < self->nsocks; ++i)
+    {
+	if (self->socks[i].thr == thr) ++nfds;
+    }
+    if (!nfds) return 0;
+    ListenerCmd *cmd = PSC_malloc(sizeof *cmd + nfds * sizeof *cmd->fds);
+    cmd->srv = self;
+    cmd->done = done;
+    cmd->nfds = 0;
+    for (size_t i = 0; i < self->nsocks; ++i)
+    {
+	if (self->socks[i].thr == thr)
+	{
+	    cmd->fds[cmd->nfds++] = self->socks[i].fd;
+	}
+    }
+    return cmd;
+}
+
+static void registerListeners(void *arg)
+{
+    ListenerCmd *cmd = arg;
+    for (size_t i = 0; i < cmd->nfds; ++i)
+    {
+	PSC_Event_register(PSC_Service_readyRead(), cmd->srv,
+		acceptConnection, cmd->fds[i]);
+	PSC_Service_registerRead(cmd->fds[i]);
+    }
+    free(cmd);
+}
+
+static void closeListenersCmd(void *arg)
+{
+    ListenerCmd *cmd = arg;
+    AcceptGate *gate = gateFor(cmd->srv, PSC_Service_threadNo());
+    for (size_t i = 0; i < cmd->nfds; ++i)
+    {
+	if (!gate->paused) PSC_Service_unregisterRead(cmd->fds[i]);
+	PSC_Event_unregister(PSC_Service_readyRead(), cmd->srv,
+		acceptConnection, cmd->fds[i]);
+	close(cmd->fds[i]);
+    }
+    destroyGate(gate);
+    if (cmd->done) sem_post(cmd->done);
+    free(cmd);
+}
+
+static void closeListeners(PSC_Server *self)
+{
+    ListenerCmd *cmd = createListenerCmd(self, -1, 0);
+    if (cmd) closeListenersCmd(cmd);
+    if (self->reuseport && self->nthr > 0)
+    {
+	/* per-thread listeners must be unregistered on their own thread,
+	 * wait for this to complete so no thread accepts any more */
+	sem_t done;
+	sem_init(&done, 0, 0);
+	int nwait = 0;
+	for (int thr = 0; thr < self->nthr; ++thr)
+	{
+	    if (!(cmd = createListenerCmd(self, thr, &done))) continue;
+	    if (thr < PSC_Service_workers())
+	    {
+		PSC_Service_runOnThread(thr, closeListenersCmd, cmd);
+		++nwait;
+	    }
+	    else
+	    {
+		for (size_t i = 0; i < cmd->nfds; ++i) close(cmd->fds[i]);
+		free(cmd);
+	    }
+	}
+	while (nwait--) sem_wait(&done);
+	sem_destroy(&done);
+    }
+    self->nsocks = 0;
+}
+
+/* Find an unassigned spare listener (a per-thread listener inherited from
+ * a previous instance) bound to the given address */
+static int findSpare(PSC_Server *self, size_t nsocks,
+	const struct sockaddr_storage *ss, socklen_t sslen)
+{
+    for (size_t i = 0; i < nsocks; ++i)
+    {
+	if (!self->socks[i].spare || self->socks[i].thr >= 0) continue;
+	struct sockaddr_storage sss;
+	socklen_t ssslen = sizeof sss;
+	if (getsockname(self->socks[i].fd,
+		    (struct sockaddr *)&sss, &ssslen) < 0) continue;
+	if (ssslen == sslen && !memcmp(&sss, ss, sslen)) return (int)i;
+    }
+    return -1;
+}
+
+static void distributeListeners(PSC_Server *self)
+{
+    size_t ninit = self->nsocks;
+    size_t nbase = 0;
+    for (size_t i = 0; i < ninit; ++i) if (!self->socks[i].spare) ++nbase;
+    self->socks = PSC_realloc(self->socks, (ninit
+		+ nbase * (self->nthr - 1)) * sizeof *self->socks);
+    size_t nsocks = ninit;
+    for (size_t i = 0; i < ninit; ++i)
+    {
+	PSC_Service_unregisterRead(self->socks[i].fd);
+	PSC_Event_unregister(PSC_Service_readyRead(), self, acceptConnection,
+		self->socks[i].fd);
+	if (self->socks[i].spare) continue;
+	self->socks[i].thr = 0;
+
+	struct sockaddr_storage ss;
+	socklen_t sslen = sizeof ss;
+	if (getsockname(self->socks[i].fd, (struct sockaddr *)&ss, &sslen) < 0)
+	{
+	    PSC_Log_err(PSC_L_ERROR, "server: cannot get listening address");
+	    continue;
+	}
+	unsigned ngroup = 1;
+	for (int thr = 1; thr < self->nthr; ++thr)
+	{
+	    int spare = findSpare(self, ninit, &ss, sslen);
+	    if (spare >= 0)
+	    {
+		self->socks[spare].thr = thr;
+		++ngroup;
+		continue;
+	    }
+	    int fd = createListener(ss.ss_family,
+		    (struct sockaddr *)&ss, sslen, 1);
+	    if (fd < 0) continue;
+	    self->socks[nsocks].fd = fd;
+	    self->socks[nsocks].thr = thr;
+	    self->socks[nsocks].spare = 0;
+	    self->socks[nsocks++].st = self->socks[i].st;
+	    ++ngroup;
+	}
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+	if (self->reuseport > 1) steerByCpu(self->socks[i].fd, ngroup);
+#endif
+    }
+
+    /* inherited listeners not needed with the current number of threads
+     * might still have connections queued, so keep serving them */
+    int nextthr = 0;
+    for (size_t i = 0; i < ninit; ++i)
+    {
+	if (self->socks[i].thr >= 0) continue;
+	self->socks[i].thr = nextthr;
+	if (++nextthr == self->nthr) nextthr = 0;
+    }
+    self->nsocks = nsocks;
+    PSC_Log_fmt(PSC_L_INFO, "server: listening on %zu sockets in %d "
+	    "service threads", nsocks, self->nthr);
+    for (int thr = 0; thr < self->nthr; ++thr)
+    {
+	ListenerCmd *cmd = createListenerCmd(self, thr, 0);
+	if (cmd) PSC_Service_runOnThread(thr, registerListeners, cmd);
+    }
+}
 
-    if (self->nthr < 0)
+static void doacceptBatch(void *arg)
+{
+    AcceptRecord *rec = arg;
+    while (rec)
     {
-	if ((self->nthr = PSC_Service_workers())) self->nextthr = 0;
-	int npools = self->nthr;
-	if (npools < 1) npools = 1;
-	self->clients = PSC_malloc(npools * sizeof *self->clients);
-	for (int i = 0; i < npools; ++i)
+	AcceptRecord *next = rec->next;
+	doaccept(rec);
+	rec = next;
+    }
+}
+
+static void initClients(PSC_Server *self)
+{
+    if ((self->nthr = PSC_Service_workers())) self->nextthr = 0;
+    int npools = self->nthr;
+    if (npools < 1) npools = 1;
+    self->clients = PSC_malloc(npools * sizeof *self->clients);
+    self->batches = PSC_malloc(npools * sizeof *self->batches);
+    for (int i = 0; i < npools; ++i)
+    {
+	self->clients[i].nactive = 0;
+	for (int j = 0; j < NCOUNTERS; ++j)
 	{
-	    self->clients[i].nactive = 0;
-	    self->clients[i].pool = ObjectPool_create(
-		    PSC_Connection_size(self->rdbufsz), 1024);
+	    self->clients[i].counters[j] = 0;
 	}
+	self->clients[i].pool = ObjectPool_create(
+		PSC_Connection_size(self->rdbufsz), 1024);
+	initGate(&self->clients[i].gate, self->maxrate && self->nthr
+		? (self->maxrate + self->nthr - 1) / self->nthr : 0);
+	self->batches[i].first = 0;
+	self->batches[i].last = 0;
+	self->batches[i].count = 0;
+    }
+    if (self->reuseport && self->nthr) distributeListeners(self);
+}
+
+static int leastConnections(PSC_Server *self)
+{
+    int thrno = self->nextthr;
+    size_t minactive = self->batches[thrno].load;
+    for (int i = 1; i < self->nthr; ++i)
+    {
+	int ithr = (self->nextthr + i) % self->nthr;
+	if (self->batches[ithr].load < minactive)
+	{
+	    minactive = self->batches[ithr].load;
+	    thrno = ithr;
+	}
+    }
+    self->nextthr = thrno;
+    return thrno;
+}
+
+static int leastBusy(PSC_Server *self)
+{
+    int thrno = 0;
+    for (int i = 1; i < self->nthr; ++i)
+    {
+	AcceptBatch *batch = self->batches + i;
+	AcceptBatch *best = self->batches + thrno;
+	if (batch->busy < best->busy || (batch->busy == best->busy
+		    && batch->load < best->load)) thrno = i;
+    }
+    /* the load is only measured periodically, so add a penalty for each
+     * connection assigned to spread a batch over similarly busy threads */
+    self->batches[thrno].busy += BUSYPENALTY;
+    return thrno;
+}
+
+static int placeConnection(PSC_Server *self, const AcceptRecord *rec)
+{
+    int thrno = -1;
+    if (self->placementHook)
+    {
+	thrno = self->placementHook(self->placementObj, rec->addr,
+		self->nthr);
+    }
+    else switch (self->placement)
+    {
+	case PSC_PP_ROUNDROBIN:
+	    thrno = self->nextthr;
+	    self->nextthr = (thrno + 1) % self->nthr;
+	    break;
+
+	case PSC_PP_IPHASH:
+	    if (!rec->addr) break;
+	    thrno = PSC_Hash_bytes(self->iphash, PSC_IpAddr_raw(rec->addr),
+		    PSC_IpAddr_proto(rec->addr) == PSC_P_IPv4 ? 4 : 16)
+		% (unsigned)self->nthr;
+	    break;
+
+	case PSC_PP_LEASTBUSY:
+	    thrno = leastBusy(self);
+	    break;
+
+	default:
+	    break;
     }
+    if (thrno < 0 || thrno >= self->nthr || (self->maxthrconn
+		&& self->batches[thrno].load >= self->maxthrconn))
+    {
+	thrno = leastConnections(self);
+    }
+    return thrno;
+}
 
-    if (self->nthr)
+static void assignThreads(PSC_Server *self, AcceptRecord *recs)
+{
+    /* take a snapshot of the load once for the whole batch and assign
+     * each connection according to the placement policy */
+#ifdef NO_SHAREDOBJ
+    pthread_mutex_lock(&self->lock);
+#endif
+    for (int i = 0; i < self->nthr; ++i)
     {
-	int nextthr = self->nextthr;
 #ifdef NO_SHAREDOBJ
-	pthread_mutex_lock(&self->lock);
-	size_t minactive = self->clients[nextthr].nactive;
+	self->batches[i].load = self->clients[i].nactive;
+#else
+	self->batches[i].load = atomic_load_explicit(
+		&self->clients[i].nactive, memory_order_relaxed);
+#endif
+    }
+#ifdef NO_SHAREDOBJ
+    pthread_mutex_unlock(&self->lock);
+#endif
+    if (!self->placementHook && self->placement == PSC_PP_LEASTBUSY)
+    {
+	for (int i = 0; i < self->nthr; ++i)
+	{
+	    self->batches[i].busy = PSC_Service_threadLoad(i);
+	}
+    }
+    while (recs)
+    {
+	AcceptRecord *rec = recs;
+	recs = rec->next;
+	rec->next = 0;
+	AcceptBatch *batch = self->batches + placeConnection(self, rec);
+	++batch->load;
+	++batch->count;
+	if (batch->last) batch->last->next = rec;
+	else batch->first = rec;
+	batch->last = rec;
+    }
+#ifdef NO_SHAREDOBJ
+    pthread_mutex_lock(&self->lock);
+#endif
+    for (int i = 0; i < self->nthr; ++i)
+    {
+	if (!self->batches[i].count) continue;
+#ifdef NO_SHAREDOBJ
+	self->clients[i].nactive += self->batches[i].count;
 #else
-	size_t minactive = atomic_load_explicit(
-		&self->clients[nextthr].nactive, memory_order_relaxed);
+	atomic_fetch_add_explicit(&self->clients[i].nactive,
+		self->batches[i].count, memory_order_acq_rel);
 #endif
-	for (int i = 1; i < self->nthr; ++i)
+    }
+#ifdef NO_SHAREDOBJ
+    pthread_mutex_unlock(&self->lock);
+#endif
+}
+
+static size_t blockKey(uint8_t *key, PSC_Proto proto, unsigned len,
+	const uint8_t *raw)
+{
+    size_t bytes = (len + 7) / 8;
+    key[0] = proto;
+    key[1] = len;
+    memcpy(key + 2, raw, bytes);
+    if (len % 8) key[1 + bytes] &= 0xff << (8 - len % 8);
+    return 2 + bytes;
+}
+
+static int addressBlocked(const Blocklist *self, const struct sockaddr *sa)
+{
+    PSC_Proto proto;
+    const uint8_t *raw;
+    const uint8_t *lens;
+    unsigned nlens;
+
+    switch (sa->sa_family)
+    {
+	case AF_INET:
+	    proto = PSC_P_IPv4;
+	    raw = (const uint8_t *)
+		&((const struct sockaddr_in *)sa)->sin_addr.s_addr;
+	    lens = self->v4lens;
+	    nlens = self->nv4lens;
+	    break;
+
+	case AF_INET6:
+	    proto = PSC_P_IPv6;
+	    raw = ((const struct sockaddr_in6 *)sa)->sin6_addr.s6_addr;
+	    lens = self->v6lens;
+	    nlens = self->nv6lens;
+	    break;
+
+	default:
+	    return 0;
+    }
+
+    /* one lookup per distinct prefix length in the blocklist */
+    uint8_t key[18];
+    for (unsigned i = 0; i < nlens; ++i)
+    {
+	size_t keysz = blockKey(key, proto, lens[i], raw);
+	if (PSC_Dictionary_get(self->prefixes, key, keysz)) return 1;
+    }
+    return 0;
+}
+
+static int rateLimited(PSC_RateLimit *self, const struct sockaddr *sa)
+{
+    switch (sa->sa_family)
+    {
+	case AF_INET:
+	    return !PSC_RateLimit_check(self,
+		    &((const struct sockaddr_in *)sa)->sin_addr.s_addr, 4);
+
+	case AF_INET6:
+	    /* count whole /64 networks, a single IPv6 client typically
+	     * controls at least one of them */
+	    return !PSC_RateLimit_check(self,
+		    ((const struct sockaddr_in6 *)sa)->sin6_addr.s6_addr, 8);
+
+	default:
+	    return 0;
+    }
+}
+
+static void resetConnection(int fd)
+{
+    struct linger l = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof l);
+    close(fd);
+}
+
+static void acceptConnection(void *receiver, void *sender, void *args)
+{
+    (void)sender;
+
+    PSC_Server *self = receiver;
+    int *sockfd = args;
+    enum saddrt st = ST_UNIX;
+    for (size_t n = 0; n < self->nsocks; ++n)
+    {
+	if (self->socks[n].fd == *sockfd)
 	{
-	    int thrno = (nextthr + i) % self->nthr;
+	    st = self->socks[n].st;
+	    break;
+	}
+    }
+
+    int thrno = PSC_Service_threadNo();
+    if (thrno < 0 && self->nthr < 0) initClients(self);
+
+    AcceptGate *gate = gateFor(self, thrno);
+    unsigned waitms;
+    size_t budget = admissionBudget(self, gate, thrno, &waitms);
+
 #ifdef NO_SHAREDOBJ
-	    size_t iactive = self->clients[thrno].nactive;
+    pthread_mutex_lock(&self->bllock);
+    Blocklist *blocklist = self->blocklist;
 #else
-	    size_t iactive = atomic_load_explicit(
-		    &self->clients[thrno].nactive, memory_order_relaxed);
+    Blocklist *blocklist = SOM_reserve((void *_Atomic *)&self->blocklist);
 #endif
-	    if (iactive < minactive)
+
+    AcceptRecord *first = 0;
+    AcceptRecord *last = 0;
+    size_t naccepted = 0;
+    size_t nrejected = 0;
+    size_t nfiltered = 0;
+    for (unsigned i = 0; i < self->acceptbatch; ++i)
+    {
+	if (naccepted == budget && self->overload == PSC_OP_PAUSE)
+	{
+	    pauseListeners(self, gate, thrno, waitms);
+	    break;
+	}
+	struct sockaddr_storage ss;
+	socklen_t salen = sizeof ss;
+	struct sockaddr *sa = 0;
+	socklen_t *sl = 0;
+	if (st != ST_UNIX)
+	{
+	    sa = (struct sockaddr *)&ss;
+	    sl = &salen;
+	}
+#ifdef HAVE_ACCEPT4
+	int connfd = accept4(*sockfd, sa, sl, SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
+	int connfd = accept(*sockfd, sa, sl);
+#endif
+	if (connfd < 0)
+	{
+	    if (errno != EAGAIN && errno != EWOULDBLOCK)
 	    {
-		minactive = iactive;
-		nextthr = thrno;
+		PSC_Log_err(PSC_L_WARNING,
+			"server: failed to accept connection");
 	    }
+	    break;
 	}
+#ifndef HAVE_ACCEPT4
+	fcntl(connfd, F_SETFD, FD_CLOEXEC);
+	fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+	int overloaded = naccepted == budget;
+	if (self->disabled || overloaded
+		|| !PSC_Service_isValidFd(connfd, "server"))
+	{
+	    resetConnection(connfd);
+	    if (self->disabled) PSC_Log_msg(PSC_L_DEBUG,
+		    "server: rejected connection while disabled");
+	    else if (overloaded) ++nrejected;
+	    continue;
+	}
+	if (sa && ((blocklist && addressBlocked(blocklist, sa))
+		    || (self->ratelimit && rateLimited(self->ratelimit, sa))))
+	{
+	    resetConnection(connfd);
+	    ++nfiltered;
+	    continue;
+	}
+
+	AcceptRecord *rec = PSC_malloc(sizeof *rec);
+	memset(rec, 0, sizeof *rec);
+	rec->srv = self;
+	if (sa) rec->addr = PSC_IpAddr_fromSockAddr(sa);
+	rec->path = self->path;
+	rec->opts.rdbufsz = self->rdbufsz;
+	rec->opts.createmode = CCM_NORMAL;
+	rec->fd = connfd;
+	if (last) last->next = rec;
+	else first = rec;
+	last = rec;
+	++naccepted;
+    }
+#ifdef NO_SHAREDOBJ
+    pthread_mutex_unlock(&self->bllock);
+#else
+    SOM_release();
+#endif
+    if (gate->rate) gate->tokens -= (uint64_t)naccepted * 1000U;
+    if (nrejected || nfiltered)
+    {
+	ThreadRecord *thr = self->clients + (thrno < 0 ? 0 : thrno);
 #ifdef NO_SHAREDOBJ
-	++self->clients[nextthr].nactive;
+	pthread_mutex_lock(&self->lock);
+	thr->counters[PSC_SC_REJECTED] += nrejected + nfiltered;
 	pthread_mutex_unlock(&self->lock);
+#elif defined(SRV_COUNTERLOCK)
+	pthread_mutex_lock(&self->countlock);
+	thr->counters[PSC_SC_REJECTED] += nrejected + nfiltered;
+	pthread_mutex_unlock(&self->countlock);
 #else
-	atomic_fetch_add_explicit(&self->clients[nextthr].nactive, 1,
-		memory_order_acq_rel);
+	atomic_fetch_add_explicit(&thr->counters[PSC_SC_REJECTED],
+		nrejected + nfiltered, memory_order_relaxed);
 #endif
-	self->nextthr = nextthr;
+	if (nrejected) PSC_Log_fmt(PSC_L_DEBUG, "server: limit reached, "
+		"rejected %zu connections", nrejected);
+	if (nfiltered) PSC_Log_fmt(PSC_L_DEBUG, "server: rejected %zu "
+		"connections from blocked or rate-limited addresses",
+		nfiltered);
     }
+    if (!naccepted) return;
 
-    int poolno = self->nextthr;
-    if (poolno < 0) poolno = 0;
+    if (thrno >= 0)
+    {
+	/* accepted on a per-thread listener, handle on this thread */
+#ifdef NO_SHAREDOBJ
+	pthread_mutex_lock(&self->lock);
+	self->clients[thrno].nactive += naccepted;
+	pthread_mutex_unlock(&self->lock);
+#else
+	atomic_fetch_add_explicit(&self->clients[thrno].nactive, naccepted,
+		memory_order_acq_rel);
+#endif
+	for (AcceptRecord *rec = first; rec; rec = rec->next)
+	{
+	    rec->opts.pool = self->clients[thrno].pool;
+	}
+	doacceptBatch(first);
+	return;
+    }
 
-    AcceptRecord *rec = PSC_malloc(sizeof *rec);
-    memset(rec, 0, sizeof *rec);
-    rec->srv = self;
-    rec->addr = PSC_IpAddr_fromSockAddr(sa);
-    rec->path = self->path;
-    rec->opts.pool = self->clients[poolno].pool;
-    rec->opts.rdbufsz = self->rdbufsz;
-    rec->opts.createmode = CCM_NORMAL;
-    rec->fd = connfd;
+    if (!self->nthr)
+    {
+	for (AcceptRecord *rec = first; rec; rec = rec->next)
+	{
+	    rec->opts.pool = self->clients->pool;
+	}
+	doacceptBatch(first);
+	return;
+    }
 
-    PSC_Service_runOnThread(self->nextthr, doaccept, rec);
+    assignThreads(self, first);
+    for (int i = 0; i < self->nthr; ++i)
+    {
+	AcceptBatch *batch = self->batches + i;
+	if (!batch->count) continue;
+	for (AcceptRecord *rec = batch->first; rec; rec = rec->next)
+	{
+	    rec->opts.pool = self->clients[i].pool;
+	}
+	PSC_Service_runOnThread(i, doacceptBatch, batch->first);
+	batch->first = 0;
+	batch->last = 0;
+	batch->count = 0;
+    }
 }
 
 static int bindcmp(const void *a, const void *b)
@@ -428,20 +1346,75 @@ static int bindcmp(const void *a, const void *b)
     return strcmp(*ba, *bb);
 }
 
-static uint64_t bindhash(size_t nbinds, char **binds)
+static uint64_t bindhash(size_t nbinds, char **binds)
+{
+    if (!nbinds) return 0;
+    char **blist = PSC_malloc((nbinds+1) * sizeof *blist);
+    memcpy(blist, binds, nbinds * sizeof *blist);
+    blist[nbinds] = 0;
+    qsort(blist, nbinds, sizeof *blist, bindcmp);
+    char *bjoined = PSC_joinstr(":", blist);
+    free(blist);
+    PSC_Hash *hasher = PSC_Hash_create(0, 0);
+    uint64_t hash = PSC_Hash_string(hasher, bjoined);
+    PSC_Hash_destroy(hasher);
+    free(bjoined);
+    return hash;
+}
+
+static void destroyBlocklist(void *obj)
+{
+    if (!obj) return;
+    Blocklist *self = obj;
+    PSC_Dictionary_destroy(self->prefixes);
+    free(self);
+}
+
+static Blocklist *createBlocklist(const PSC_TcpServerOpts *opts)
+{
+    if (!opts->bl_count) return 0;
+#ifdef NO_SHAREDOBJ
+    Blocklist *self = PSC_malloc(sizeof *self);
+#else
+    Blocklist *self = SharedObj_create(sizeof *self, destroyBlocklist);
+#endif
+    self->prefixes = PSC_Dictionary_create(PSC_DICT_NODELETE, 0);
+    self->nv4lens = 0;
+    self->nv6lens = 0;
+    uint8_t key[18];
+    for (size_t i = 0; i < opts->bl_count; ++i)
+    {
+	const PSC_IpAddr *prefix = opts->blocked[i];
+	PSC_Proto proto = PSC_IpAddr_proto(prefix);
+	unsigned len = PSC_IpAddr_prefixlen(prefix);
+	uint8_t *lens = self->v4lens;
+	unsigned *nlens = &self->nv4lens;
+	if (proto == PSC_P_IPv6)
+	{
+	    lens = self->v6lens;
+	    nlens = &self->nv6lens;
+	}
+	unsigned j = 0;
+	while (j < *nlens && lens[j] != len) ++j;
+	if (j == *nlens) lens[(*nlens)++] = len;
+	size_t keysz = blockKey(key, proto, len, PSC_IpAddr_raw(prefix));
+	PSC_Dictionary_set(self->prefixes, key, keysz, self, 0);
+    }
+    return self;
+}
+
+static PSC_RateLimit *createRateLimit(const PSC_TcpServerOpts *opts)
 {
-    if (!nbinds) return 0;
-    char **blist = PSC_malloc((nbinds+1) * sizeof *blist);
-    memcpy(blist, binds, nbinds * sizeof *blist);
-    blist[nbinds] = 0;
-    qsort(blist, nbinds, sizeof *blist, bindcmp);
-    char *bjoined = PSC_joinstr(":", blist);
-    free(blist);
-    PSC_Hash *hasher = PSC_Hash_create(0, 0);
-    uint64_t hash = PSC_Hash_string(hasher, bjoined);
-    PSC_Hash_destroy(hasher);
-    free(bjoined);
-    return hash;
+    if (!opts->rl_count) return 0;
+    PSC_RateLimitOpts *rlopts = PSC_RateLimitOpts_create();
+    for (size_t i = 0; i < opts->rl_count; ++i)
+    {
+	PSC_RateLimitOpts_addLimit(rlopts, opts->ratelimits[2*i],
+		opts->ratelimits[2*i + 1]);
+    }
+    PSC_RateLimit *ratelimit = PSC_RateLimit_create(rlopts);
+    PSC_RateLimitOpts_destroy(rlopts);
+    return ratelimit;
 }
 
 #ifdef WITH_TLS
@@ -600,15 +1573,39 @@ static PSC_Server *PSC_Server_create(const PSC_TcpServerOpts *opts,
     TlsConfig *tlscfg = initTls(opts);
     if (!tlscfg) goto error;
 #endif
-    PSC_Server *self = PSC_malloc(sizeof *self + nsocks * sizeof *socks);
+    PSC_Server *self = PSC_malloc(sizeof *self);
+    self->next = 0;
     self->owner = owner;
     self->clientConnected = clientConnected;
     self->shutdownComplete = shutdownComplete;
     self->shutdownTimer = 0;
     self->clients = 0;
+    self->batches = 0;
+    self->placementObj = opts->placementObj;
+    self->placementHook = opts->placementHook;
+    self->iphash = opts->placement == PSC_PP_IPHASH
+	? PSC_Hash_create(0, 0) : 0;
+    self->ratelimit = createRateLimit(opts);
+    self->nratelimits = opts->rl_count;
+    self->ratelimits = 0;
+    if (opts->rl_count)
+    {
+	self->ratelimits = PSC_malloc(2 * opts->rl_count
+		* sizeof *self->ratelimits);
+	memcpy(self->ratelimits, opts->ratelimits,
+		2 * opts->rl_count * sizeof *self->ratelimits);
+    }
     self->path = path;
 #ifdef NO_SHAREDOBJ
     pthread_mutex_init(&self->lock, 0);
+    pthread_mutex_init(&self->bllock, 0);
+    self->blocklist = createBlocklist(opts);
+#else
+    atomic_store_explicit(&self->blocklist, createBlocklist(opts),
+	    memory_order_release);
+#  ifdef SRV_COUNTERLOCK
+    pthread_mutex_init(&self->countlock, 0);
+#  endif
 #endif
     sem_init(&self->allclosed, 0, 1);
     self->bhash = bindhash(opts->bh_count, opts->bindhosts);
@@ -618,17 +1615,29 @@ static PSC_Server *PSC_Server_create(const PSC_TcpServerOpts *opts,
     atomic_store_explicit(&self->nconn, 0, memory_order_release);
 #endif
     self->rdbufsz = opts->rdbufsz;
+    self->maxconn = opts->maxconn;
+    self->maxthrconn = opts->maxthrconn;
+    self->maxtlspending = opts->maxtlspending;
     self->proto = opts->proto;
+    self->placement = opts->placement;
+    self->overload = opts->overload;
     self->port = opts->port;
     self->disabled = 0;
+    self->maxrate = opts->maxrate;
+    initGate(&self->gate, opts->maxrate);
     self->nthr = -1;
     self->nextthr = -1;
+    self->reuseport = opts->reuseport;
+    self->acceptbatch = opts->acceptbatch ? opts->acceptbatch
+	: DEFACCEPTBATCH;
 #ifdef WITH_TLS
 #  ifdef NO_SHAREDOBJ
     pthread_mutex_init(&self->tlslock, 0);
     self->tlscfg = tlscfg;
+    self->ntlspending = 0;
 #  else
     atomic_store_explicit(&self->tlscfg, tlscfg, memory_order_release);
+    atomic_store_explicit(&self->ntlspending, 0, memory_order_release);
 #  endif
     if (tlscfg->tls_ctx && tlscfg->validator)
     {
@@ -636,9 +1645,11 @@ static PSC_Server *PSC_Server_create(const PSC_TcpServerOpts *opts,
     }
 #endif
     self->nsocks = nsocks;
+    self->socks = PSC_malloc(nsocks * sizeof *self->socks);
     memcpy(self->socks, socks, nsocks * sizeof *socks);
     for (size_t i = 0; i < nsocks; ++i)
     {
+	self->socks[i].thr = -1;
 	PSC_Event_register(PSC_Service_readyRead(), self,
 		acceptConnection, socks[i].fd);
 	PSC_Service_registerRead(socks[i].fd);
@@ -672,6 +1683,89 @@ SOEXPORT void PSC_TcpServerOpts_bind(PSC_TcpServerOpts *self,
     self->bindhosts[self->bh_count++] = PSC_copystr(bindhost);
 }
 
+SOEXPORT void PSC_TcpServerOpts_reusePort(PSC_TcpServerOpts *self,
+	int cpusteering)
+{
+    self->reuseport = cpusteering ? 2 : 1;
+}
+
+SOEXPORT void PSC_TcpServerOpts_acceptBatch(PSC_TcpServerOpts *self,
+	unsigned batch)
+{
+    if (!batch || batch > MAXACCEPTBATCH) return;
+    self->acceptbatch = batch;
+}
+
+SOEXPORT void PSC_TcpServerOpts_placement(PSC_TcpServerOpts *self,
+	PSC_PlacementPolicy policy)
+{
+    self->placement = policy;
+}
+
+SOEXPORT void PSC_TcpServerOpts_placementHook(PSC_TcpServerOpts *self,
+	void *obj, PSC_PlacementHook hook)
+{
+    self->placementObj = obj;
+    self->placementHook = hook;
+}
+
+SOEXPORT void PSC_TcpServerOpts_maxConnections(PSC_TcpServerOpts *self,
+	size_t max)
+{
+    self->maxconn = max;
+}
+
+SOEXPORT void PSC_TcpServerOpts_maxThreadConnections(
+	PSC_TcpServerOpts *self, size_t max)
+{
+    self->maxthrconn = max;
+}
+
+SOEXPORT void PSC_TcpServerOpts_maxAcceptRate(PSC_TcpServerOpts *self,
+	unsigned rate)
+{
+    self->maxrate = rate;
+}
+
+SOEXPORT void PSC_TcpServerOpts_maxPendingTls(PSC_TcpServerOpts *self,
+	size_t max)
+{
+    self->maxtlspending = max;
+}
+
+SOEXPORT void PSC_TcpServerOpts_overloadPolicy(PSC_TcpServerOpts *self,
+	PSC_OverloadPolicy policy)
+{
+    self->overload = policy;
+}
+
+SOEXPORT void PSC_TcpServerOpts_block(PSC_TcpServerOpts *self,
+	const PSC_IpAddr *prefix)
+{
+    if (self->bl_count == self->bl_capa)
+    {
+	self->bl_capa += BLOCKCHUNK;
+	self->blocked = PSC_realloc(self->blocked,
+		self->bl_capa * sizeof *self->blocked);
+    }
+    self->blocked[self->bl_count++] = PSC_IpAddr_ref(prefix);
+}
+
+SOEXPORT int PSC_TcpServerOpts_rateLimit(PSC_TcpServerOpts *self,
+	int seconds, int limit)
+{
+    if (seconds < 1 || seconds > 0xffff || limit < 1 || limit > 0xffff)
+    {
+	return -1;
+    }
+    self->ratelimits = PSC_realloc(self->ratelimits,
+	    2 * (self->rl_count + 1) * sizeof *self->ratelimits);
+    self->ratelimits[2 * self->rl_count] = seconds;
+    self->ratelimits[2 * self->rl_count + 1] = limit;
+    ++self->rl_count;
+    return 0;
+}
+
 SOEXPORT void PSC_TcpServerOpts_readBufSize(PSC_TcpServerOpts *self,
 	size_t sz)
 {
@@ -749,6 +1843,12 @@ SOEXPORT void PSC_TcpServerOpts_destroy(PSC_TcpServerOpts *self)
     if (!self) return;
     for (size_t i = 0; i < self->bh_count; ++i) free(self->bindhosts[i]);
     free(self->bindhosts);
+    for (size_t i = 0; i < self->bl_count; ++i)
+    {
+	PSC_IpAddr_destroy(self->blocked[i]);
+    }
+    free(self->blocked);
+    free(self->ratelimits);
 #ifdef WITH_TLS
     free(self->cafile);
     free(self->certfile);
@@ -794,12 +1894,349 @@ SOEXPORT void PSC_UnixServerOpts_destroy(PSC_UnixServerOpts *self)
     free(self);
 }
 
-SOEXPORT PSC_Server *PSC_Server_createTcp(const PSC_TcpServerOpts *opts,
-	void *owner, PSC_ClientConnectedCallback clientConnected,
-	void (*shutdownComplete)(void *))
+static void upgradeDone(void *receiver, void *sender, void *args)
+{
+    (void)receiver;
+    (void)sender;
+    (void)args;
+
+    char dummy;
+    ssize_t rc = read(upgradefd, &dummy, 1);
+    if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (rc > 0) return;
+
+    /* the old instance exited, so it can't own the pidfile any more */
+    PSC_Service_unregisterRead(upgradefd);
+    PSC_Event_unregister(PSC_Service_readyRead(), 0, upgradeDone, upgradefd);
+    close(upgradefd);
+    upgradefd = -1;
+    PSC_Log_msg(PSC_L_INFO, "server: previous instance exited");
+    PSC_Daemon_takePidfile();
+}
+
+static void upgradeReady(void *receiver, void *sender, void *args)
+{
+    (void)receiver;
+    (void)sender;
+    (void)args;
+
+    PSC_Timer_destroy(upgradeTimer);
+    upgradeTimer = 0;
+    for (size_t i = 0; i < ninherited; ++i)
+    {
+	if (!inherited[i].msg.nfds) continue;
+	PSC_Log_fmt(PSC_L_WARNING, "server: closing %u unused inherited "
+		"listening sockets for port %d",
+		(unsigned)inherited[i].msg.nfds, (int)inherited[i].msg.port);
+	for (uint32_t j = 0; j < inherited[i].msg.nfds; ++j)
+	{
+	    close(inherited[i].fds[j]);
+	}
+    }
+    free(inherited);
+    inherited = 0;
+    ninherited = 0;
+    if (write(upgradefd, "R", 1) != 1)
+    {
+	PSC_Log_err(PSC_L_ERROR, "server: cannot notify previous instance");
+	close(upgradefd);
+	upgradefd = -1;
+	return;
+    }
+    fcntl(upgradefd, F_SETFL, fcntl(upgradefd, F_GETFL, 0) | O_NONBLOCK);
+    PSC_Event_register(PSC_Service_readyRead(), 0, upgradeDone, upgradefd);
+    PSC_Service_registerRead(upgradefd);
+}
+
+static int receiveListeners(int fd, InheritedListeners *il)
+{
+    union {
+	struct cmsghdr align;
+	char buf[CMSG_SPACE(MAXSOCKS * sizeof(int))];
+    } cbuf;
+    struct iovec iov = {
+	.iov_base = &il->msg,
+	.iov_len = sizeof il->msg
+    };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof mh);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf.buf;
+    mh.msg_controllen = sizeof cbuf.buf;
+    ssize_t rc;
+    do
+    {
+	rc = recvmsg(fd, &mh, MSG_WAITALL);
+    } while (rc < 0 && errno == EINTR);
+    if (rc != (ssize_t)sizeof il->msg) return -1;
+
+    size_t nfds = 0;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm;
+	    cm = CMSG_NXTHDR(&mh, cm))
+    {
+	if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+	{
+	    continue;
+	}
+	size_t n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	if (nfds + n > MAXSOCKS) n = MAXSOCKS - nfds;
+	memcpy(il->fds + nfds, CMSG_DATA(cm), n * sizeof(int));
+	nfds += n;
+    }
+    if (nfds != il->msg.nfds)
+    {
+	for (size_t i = 0; i < nfds; ++i) close(il->fds[i]);
+	return -1;
+    }
+    for (size_t i = 0; i < nfds; ++i)
+    {
+	fcntl(il->fds[i], F_SETFD, FD_CLOEXEC);
+	if (!PSC_Service_isValidFd(il->fds[i], "server"))
+	{
+	    for (size_t j = 0; j < nfds; ++j) close(il->fds[j]);
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+static void loadInherited(void)
+{
+    if (inheritedLoaded) return;
+    inheritedLoaded = 1;
+
+    const char *envfd = getenv(UPGRADEENV);
+    if (!envfd) return;
+    char *endp;
+    long fd = strtol(envfd, &endp, 10);
+    unsetenv(UPGRADEENV);
+    if (*endp || fd < 0 || fd > INT_MAX) return;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    size_t capa = 0;
+    for (;;)
+    {
+	if (ninherited == capa)
+	{
+	    capa += BINDCHUNK;
+	    inherited = PSC_realloc(inherited, capa * sizeof *inherited);
+	}
+	if (receiveListeners(fd, inherited + ninherited) < 0)
+	{
+	    PSC_Log_msg(PSC_L_ERROR,
+		    "server: cannot receive inherited listening sockets");
+	    break;
+	}
+	if (!inherited[ninherited].msg.nfds) break;
+	++ninherited;
+    }
+    upgradefd = fd;
+
+    /* confirm to the previous instance once the service loop runs, so
+     * all servers created during startup can adopt their sockets */
+    if (!(upgradeTimer = PSC_Timer_create()))
+    {
+	PSC_Log_msg(PSC_L_ERROR, "server: cannot create timer for "
+		"confirming upgrade");
+	return;
+    }
+    PSC_Timer_setMs(upgradeTimer, 1);
+    PSC_Event_register(PSC_Timer_expired(upgradeTimer), 0, upgradeReady, 0);
+    PSC_Timer_start(upgradeTimer, 0);
+}
+
+static size_t adoptInherited(const PSC_TcpServerOpts *opts, SockInfo **socks)
+{
+    loadInherited();
+    uint64_t bhash = bindhash(opts->bh_count, opts->bindhosts);
+    for (size_t i = 0; i < ninherited; ++i)
+    {
+	UpgradeMsg *msg = &inherited[i].msg;
+	if (!msg->nfds || msg->bhash != bhash || msg->port != opts->port
+		|| msg->proto != (int32_t)opts->proto) continue;
+	size_t nsocks = 0;
+	for (;;)
+	{
+	    *socks = PSC_realloc(*socks,
+		    (nsocks + msg->nfds) * sizeof **socks);
+	    for (size_t j = 0; j < msg->nfds; ++j)
+	    {
+		(*socks)[nsocks].fd = inherited[i].fds[j];
+		(*socks)[nsocks].spare = msg->spare[j];
+		(*socks)[nsocks++].st = msg->st[j];
+	    }
+	    msg->nfds = 0;
+	    if (!msg->more || ++i == ninherited) break;
+	    msg = &inherited[i].msg;
+	}
+	PSC_Log_fmt(PSC_L_INFO, "server: adopted %zu inherited listening "
+		"sockets for port %d", nsocks, opts->port);
+	return nsocks;
+    }
+    return 0;
+}
+
+static int sendUpgradeMsg(int fd, const UpgradeMsg *msg, const int *fds)
+{
+    union {
+	struct cmsghdr align;
+	char buf[CMSG_SPACE(MAXSOCKS * sizeof(int))];
+    } cbuf;
+    struct iovec iov = {
+	.iov_base = (void *)msg,
+	.iov_len = sizeof *msg
+    };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof mh);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (msg->nfds)
+    {
+	mh.msg_control = cbuf.buf;
+	mh.msg_controllen = CMSG_SPACE(msg->nfds * sizeof(int));
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(msg->nfds * sizeof(int));
+	memcpy(CMSG_DATA(cm), fds, msg->nfds * sizeof(int));
+    }
+    ssize_t rc;
+    do
+    {
+	rc = sendmsg(fd, &mh, 0);
+    } while (rc < 0 && errno == EINTR);
+    return rc == (ssize_t)sizeof *msg ? 0 : -1;
+}
+
+static int sendListeners(int fd, const PSC_Server *srv)
+{
+    UpgradeMsg msg;
+    memset(&msg, 0, sizeof msg);
+    int fds[MAXSOCKS];
+    if (!srv) return sendUpgradeMsg(fd, &msg, fds);
+
+    /* per-thread listeners are passed as well, so connections queued on
+     * them aren't lost. They're sent as spares, the new instance uses
+     * them for its own per-thread listeners. */
+    msg.bhash = srv->bhash;
+    msg.port = srv->port;
+    msg.proto = srv->proto;
+    for (size_t i = 0; i < srv->nsocks; ++i)
+    {
+	if (msg.nfds == MAXSOCKS)
+	{
+	    msg.more = 1;
+	    if (sendUpgradeMsg(fd, &msg, fds) < 0) return -1;
+	    msg.nfds = 0;
+	}
+	msg.st[msg.nfds] = srv->socks[i].st;
+	msg.spare[msg.nfds] = srv->socks[i].thr > 0 || srv->socks[i].spare;
+	fds[msg.nfds++] = srv->socks[i].fd;
+    }
+    msg.more = 0;
+    return msg.nfds ? sendUpgradeMsg(fd, &msg, fds) : 0;
+}
+
+static void upgradeReply(void *receiver, void *sender, void *args)
+{
+    (void)receiver;
+    (void)sender;
+    (void)args;
+
+    char reply;
+    ssize_t rc = read(upgradefd, &reply, 1);
+    if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    PSC_Service_unregisterRead(upgradefd);
+    PSC_Event_unregister(PSC_Service_readyRead(), 0, upgradeReply, upgradefd);
+    if (rc == 1 && reply == 'R')
+    {
+	/* keep the socket open until exiting, closing it tells the new
+	 * instance it can take over the pidfile */
+	PSC_Log_msg(PSC_L_INFO,
+		"server: new instance took over, shutting down");
+	PSC_Service_quit();
+	return;
+    }
+    PSC_Log_msg(PSC_L_ERROR, "server: new instance failed to start");
+    close(upgradefd);
+    upgradefd = -1;
+}
+
+SOEXPORT int PSC_Server_upgrade(const char *path, char *const argv[])
 {
-    SockInfo socks[MAXSOCKS];
+    if (upgradefd >= 0)
+    {
+	PSC_Log_msg(PSC_L_WARNING, "server: upgrade already in progress");
+	return -1;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+	PSC_Log_err(PSC_L_ERROR, "server: cannot create upgrade socket");
+	return -1;
+    }
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+
+    /* prepare the environment before forking, only async-signal-safe
+     * functions may be used in the child */
+    char envfd[sizeof UPGRADEENV + 16];
+    snprintf(envfd, sizeof envfd, UPGRADEENV "=%d", sv[1]);
+    size_t nenv = 0;
+    while (environ[nenv]) ++nenv;
+    char **envp = PSC_malloc((nenv + 2) * sizeof *envp);
+    size_t envpos = 0;
+    for (size_t i = 0; i < nenv; ++i)
+    {
+	if (!strncmp(environ[i], UPGRADEENV "=", sizeof UPGRADEENV)) continue;
+	envp[envpos++] = environ[i];
+    }
+    envp[envpos++] = envfd;
+    envp[envpos] = 0;
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+	PSC_Log_err(PSC_L_ERROR, "server: cannot fork for upgrade");
+	free(envp);
+	close(sv[0]);
+	close(sv[1]);
+	return -1;
+    }
+    if (!pid)
+    {
+	fcntl(sv[1], F_SETFD, 0);
+	execve(path, argv, envp);
+	_exit(127);
+    }
+    free(envp);
+    close(sv[1]);
+
+    for (PSC_Server *srv = tcpservers; srv; srv = srv->next)
+    {
+	if (sendListeners(sv[0], srv) < 0) goto error;
+    }
+    if (sendListeners(sv[0], 0) < 0) goto error;
+
+    PSC_Log_fmt(PSC_L_INFO, "server: started new instance with pid %d, "
+	    "waiting for it to take over", (int)pid);
+    upgradefd = sv[0];
+    fcntl(upgradefd, F_SETFL, fcntl(upgradefd, F_GETFL, 0) | O_NONBLOCK);
+    PSC_Event_register(PSC_Service_readyRead(), 0, upgradeReply, upgradefd);
+    PSC_Service_registerRead(upgradefd);
+    return 0;
+
+error:
+    PSC_Log_err(PSC_L_ERROR, "server: cannot pass listening sockets");
+    close(sv[0]);
+    return -1;
+}
 
+static size_t createListeners(const PSC_TcpServerOpts *opts,
+	SockInfo *socks)
+{
     struct addrinfo hints;
     memset(&hints, 0, sizeof hints);
     hints.ai_family = AF_UNSPEC;
@@ -811,7 +2248,6 @@ SOEXPORT PSC_Server *PSC_Server_createTcp(const PSC_TcpServerOpts *opts,
     struct addrinfo *res0;
     size_t nsocks = 0;
     size_t bi = 0;
-    int opt_true = 1;
     do
     {
 	res0 = 0;
@@ -832,57 +2268,12 @@ SOEXPORT PSC_Server *PSC_Server_createTcp(const PSC_TcpServerOpts *opts,
 		    && res->ai_family != AF_INET) continue;
 	    if (opts->proto == PSC_P_IPv6
 		    && res->ai_family != AF_INET6) continue;
-#ifdef HAVE_ACCEPT4
-	    socks[nsocks].fd = socket(res->ai_family,
-		    res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
-		    res->ai_protocol);
-#else
-	    socks[nsocks].fd = socket(res->ai_family, res->ai_socktype,
-		    res->ai_protocol);
-#endif
-	    if (socks[nsocks].fd < 0)
-	    {
-		PSC_Log_err(PSC_L_ERROR, "server: cannot create socket");
-		continue;
-	    }
-#ifndef HAVE_ACCEPT4
-	    fcntl(socks[nsocks].fd, F_SETFD, FD_CLOEXEC);
-	    fcntl(socks[nsocks].fd, F_SETFL,
-		    fcntl(socks[nsocks].fd, F_GETFL, 0) | O_NONBLOCK);
-#endif
-	    if (!PSC_Service_isValidFd(socks[nsocks].fd, "server"))
-	    {
-		close(socks[nsocks].fd);
-		break;
-	    }
-
-	    if (setsockopt(socks[nsocks].fd, SOL_SOCKET, SO_REUSEADDR,
-			&opt_true, sizeof opt_true) < 0)
-	    {
-		PSC_Log_err(PSC_L_ERROR, "server: cannot set socket option");
-		close(socks[nsocks].fd);
-		continue;
-	    }
-#ifdef IPV6_V6ONLY
-	    if (res->ai_family == AF_INET6)
-	    {
-		setsockopt(socks[nsocks].fd, IPPROTO_IPV6, IPV6_V6ONLY,
-			&opt_true, sizeof opt_true);
-	    }
-#endif
-	    if (bind(socks[nsocks].fd, res->ai_addr, res->ai_addrlen) < 0)
-	    {
-		PSC_Log_err(PSC_L_ERROR,
-			"server: cannot bind to specified address");
-		close(socks[nsocks].fd);
-		continue;
-	    }
-	    if (listen(socks[nsocks].fd, 128) < 0)
-	    {   
-		PSC_Log_err(PSC_L_ERROR, "server: cannot listen on socket");
-		close(socks[nsocks].fd);
-		continue;
-	    }
+	    int fd = createListener(res->ai_family,
+		    res->ai_addr, res->ai_addrlen, opts->reuseport);
+	    if (fd == -2) break;
+	    if (fd < 0) continue;
+	    socks[nsocks].fd = fd;
+	    socks[nsocks].spare = 0;
 	    const char *addrstr = "<unknown>";
 	    if (getnameinfo(res->ai_addr, res->ai_addrlen,
 			hostbuf, sizeof hostbuf,
@@ -898,19 +2289,40 @@ SOEXPORT PSC_Server *PSC_Server_createTcp(const PSC_TcpServerOpts *opts,
 	}
 	freeaddrinfo(res0);
     } while (++bi < opts->bh_count);
+    return nsocks;
+}
+
+SOEXPORT PSC_Server *PSC_Server_createTcp(const PSC_TcpServerOpts *opts,
+	void *owner, PSC_ClientConnectedCallback clientConnected,
+	void (*shutdownComplete)(void *))
+{
+    SockInfo *socks = 0;
+    size_t nsocks = adoptInherited(opts, &socks);
+    if (!nsocks)
+    {
+	socks = PSC_realloc(socks, MAXSOCKS * sizeof *socks);
+	nsocks = createListeners(opts, socks);
+    }
     if (!nsocks)
     {
 	PSC_Log_msg(PSC_L_FATAL, "server: could not create any sockets for "
 		"listening to incoming connections");
+	free(socks);
 	return 0;
     }
-    
+
     PSC_Server *self = PSC_Server_create(opts, nsocks, socks, 0, owner,
 	    clientConnected, shutdownComplete);
     if (!self) for (size_t i = 0; i < nsocks; ++i)
     {
 	close(socks[i].fd);
     }
+    else
+    {
+	self->next = tcpservers;
+	tcpservers = self;
+    }
+    free(socks);
     return self;
 }
 
@@ -921,7 +2333,24 @@ SOEXPORT int PSC_Server_configureTcp(PSC_Server *self,
     if (self->proto != opts->proto) return -1;
     if (self->port != opts->port) return -1;
     if (self->rdbufsz != opts->rdbufsz) return -1;
+    if (self->reuseport != opts->reuseport) return -1;
+    if (self->acceptbatch != (opts->acceptbatch ? opts->acceptbatch
+		: DEFACCEPTBATCH)) return -1;
+    if (self->maxconn != opts->maxconn) return -1;
+    if (self->maxthrconn != opts->maxthrconn) return -1;
+    if (self->maxtlspending != opts->maxtlspending) return -1;
+    if (self->maxrate != opts->maxrate) return -1;
+    if (self->overload != opts->overload) return -1;
+    if (self->placement != opts->placement) return -1;
+    if (self->placementHook != opts->placementHook
+	    || self->placementObj != opts->placementObj) return -1;
     if (self->bhash != bindhash(opts->bh_count, opts->bindhosts)) return -1;
+    if (self->nratelimits != opts->rl_count || (self->nratelimits
+		&& memcmp(self->ratelimits, opts->ratelimits, 2
+		    * self->nratelimits * sizeof *self->ratelimits)))
+    {
+	return -1;
+    }
 #ifdef WITH_TLS
     TlsConfig *tlscfg = initTls(opts);
     if (!tlscfg) return -1;
@@ -939,6 +2368,17 @@ SOEXPORT int PSC_Server_configureTcp(PSC_Server *self,
 	    memory_order_acq_rel);
     SharedObj_retire(oldcfg);
 #  endif
+#endif
+    Blocklist *blocklist = createBlocklist(opts);
+#ifdef NO_SHAREDOBJ
+    pthread_mutex_lock(&self->bllock);
+    destroyBlocklist(self->blocklist);
+    self->blocklist = blocklist;
+    pthread_mutex_unlock(&self->bllock);
+#else
+    Blocklist *oldbl = atomic_exchange_explicit(&self->blocklist, blocklist,
+	    memory_order_acq_rel);
+    if (oldbl) SharedObj_retire(oldbl);
 #endif
     return 0;
 }
@@ -1108,6 +2548,35 @@ SOEXPORT size_t PSC_Server_connections(const PSC_Server *self)
 #endif
 }
 
+SOEXPORT uint64_t PSC_Server_counter(const PSC_Server *self, int thrno,
+	PSC_ServerCounter counter)
+{
+    if (counter < 0 || counter >= NCOUNTERS) return 0;
+    if (self->nthr < 0) return 0;
+    int npools = self->nthr ? self->nthr : 1;
+    if (thrno >= npools) return 0;
+    int first = thrno < 0 ? 0 : thrno;
+    int last = thrno < 0 ? npools : thrno + 1;
+
+    uint64_t n = 0;
+#ifdef NO_SHAREDOBJ
+    pthread_mutex_lock(&((PSC_Server *)self)->lock);
+    for (int i = first; i < last; ++i) n += self->clients[i].counters[counter];
+    pthread_mutex_unlock(&((PSC_Server *)self)->lock);
+#elif defined(SRV_COUNTERLOCK)
+    pthread_mutex_lock(&((PSC_Server *)self)->countlock);
+    for (int i = first; i < last; ++i) n += self->clients[i].counters[counter];
+    pthread_mutex_unlock(&((PSC_Server *)self)->countlock);
+#else
+    for (int i = first; i < last; ++i)
+    {
+	n += atomic_load_explicit(&self->clients[i].counters[counter],
+		memory_order_relaxed);
+    }
+#endif
+    return n;
+}
+
 SOEXPORT void PSC_Server_shutdown(PSC_Server *self, unsigned timeout)
 {
     if (!self) return;
@@ -1118,14 +2587,7 @@ SOEXPORT void PSC_Server_shutdown(PSC_Server *self, unsigned timeout)
 	return;
     }
 
-    for (uint8_t i = 0; i < self->nsocks; ++i)
-    {
-	PSC_Service_unregisterRead(self->socks[i].fd);
-	PSC_Event_unregister(PSC_Service_readyRead(), self, acceptConnection,
-		self->socks[i].fd);
-	close(self->socks[i].fd);
-    }
-    self->nsocks = 0;
+    closeListeners(self);
 
     PSC_Event_register(PSC_Service_shutdown(), self, forceDestroy, 0);
     if (timeout)
@@ -1159,7 +2621,23 @@ SOEXPORT void PSC_Server_destroy(PSC_Server *self)
 {
     if (!self) return;
 
+    for (PSC_Server **srv = &tcpservers; *srv; srv = &(*srv)->next)
+    {
+	if (*srv == self)
+	{
+	    *srv = self->next;
+	    break;
+	}
+    }
+
     PSC_Timer_destroy(self->shutdownTimer);
+    if (!self->nsocks)
+    {
+	PSC_Event_unregister(PSC_Service_shutdown(), self, forceDestroy, 0);
+    }
+    else closeListeners(self);
+    destroyGate(&self->gate);
+    free(self->socks);
     if (self->nconn)
     {
 	if (self->nthr) for (int thr = 0; thr < self->nthr; ++thr)
@@ -1170,20 +2648,20 @@ SOEXPORT void PSC_Server_destroy(PSC_Server *self)
 	sem_wait(&self->allclosed);
 	free(self->clients);
     }
-    if (!self->nsocks)
-    {
-	PSC_Event_unregister(PSC_Service_shutdown(), self, forceDestroy, 0);
-    }
-    else for (uint8_t i = 0; i < self->nsocks; ++i)
-    {
-	PSC_Service_unregisterRead(self->socks[i].fd);
-	PSC_Event_unregister(PSC_Service_readyRead(), self, acceptConnection,
-		self->socks[i].fd);
-	close(self->socks[i].fd);
-    }
+    free(self->batches);
+    PSC_Hash_destroy(self->iphash);
+    PSC_RateLimit_destroy(self->ratelimit);
+    free(self->ratelimits);
     sem_destroy(&self->allclosed);
 #ifdef NO_SHAREDOBJ
     pthread_mutex_destroy(&self->lock);
+    pthread_mutex_destroy(&self->bllock);
+    destroyBlocklist(self->blocklist);
+#else
+    if (self->blocklist) SharedObj_retire(self->blocklist);
+#  ifdef SRV_COUNTERLOCK
+    pthread_mutex_destroy(&self->countlock);
+#  endif
 #endif
     if (self->shutdownComplete) self->shutdownComplete(self->owner);
     if (self->path)
@@ -26,6 +26,7 @@
 #include <sys/param.h>
 #include <sys/wait.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifndef NSIG
@@ -125,6 +126,10 @@ struct EpollWatch
 #define DEFLOGIDENT "posercore"
 #endif
 
+#ifndef LOADWINDOW
+#define LOADWINDOW 100000U
+#endif
+
 typedef enum ServiceLoopFlags
 {
     SLF_NONE	    = 0,
@@ -171,10 +176,25 @@ typedef struct SvcCommandQueue
 #endif
 } SvcCommandQueue;
 
+typedef struct LoadStat
+{
+    uint64_t windowStart;
+    uint64_t waitStart;
+    uint64_t idle;
+#ifdef NO_SHAREDOBJ
+    uint64_t idleSince;
+    unsigned load;
+#else
+    _Atomic uint64_t idleSince;
+    atomic_uint load;
+#endif
+} LoadStat;
+
 typedef struct SecondaryService
 {
     pthread_t handle;
     SvcCommandQueue cq;
+    LoadStat load;
     int threadno;
 } SecondaryService;
 
@@ -226,8 +246,12 @@ static SecondaryService *ssvc;
 static PSC_Timer *shutdownTimer;
 static int nssvc;
 static SvcCommandQueue cq;
+static LoadStat mainload;
+static THREADLOCAL uint64_t nowNs;
+static clockid_t loopclock = CLOCK_MONOTONIC;
 #ifdef NO_SHAREDOBJ
 sem_t shutdownrq;
+static pthread_mutex_t loadlock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
 static PSC_Event prestartup;
@@ -344,6 +368,80 @@ static void clearMustWake(void)
 #endif
 }
 
+static uint64_t readClock(clockid_t clk)
+{
+    struct timespec ts;
+    if (clock_gettime(clk, &ts) < 0) return 0;
+    return (uint64_t)ts.tv_sec * 1000000000U + ts.tv_nsec;
+}
+
+/* The service loop only reads the configured clock (which might be the
+ * coarse one), both for timestamps and for measuring its load. */
+static uint64_t monotonicUs(void)
+{
+    return readClock(loopclock) / 1000U;
+}
+
+static uint64_t updateClock(void)
+{
+    return nowNs = readClock(loopclock);
+}
+
+static LoadStat *loadStat(void)
+{
+    return svc->svcid ? &svc->svcid->load : &mainload;
+}
+
+static void loadWaitBegin(void)
+{
+    LoadStat *ls = loadStat();
+    ls->waitStart = monotonicUs();
+#ifdef NO_SHAREDOBJ
+    pthread_mutex_lock(&loadlock);
+    ls->idleSince = ls->waitStart;
+    pthread_mutex_unlock(&loadlock);
+#else
+    atomic_store_explicit(&ls->idleSince, ls->waitStart,
+	    memory_order_relaxed);
+#endif
+}
+
+static void loadWaitEnd(void)
+{
+    LoadStat *ls = loadStat();
+    uint64_t now = updateClock() / 1000U;
+    ls->idle += now - ls->waitStart;
+    uint64_t elapsed = now - ls->windowStart;
+    unsigned load = 0;
+    if (elapsed >= LOADWINDOW)
+    {
+	/* busy time in per mille of the last window, smoothed with a
+	 * moving average over roughly the last four windows */
+	unsigned busy = elapsed > ls->idle
+	    ? (unsigned)((elapsed - ls->idle) * 1000U / elapsed) : 0;
+	ls->windowStart = now;
+	ls->idle = 0;
+#ifdef NO_SHAREDOBJ
+	load = (3 * ls->load + busy) / 4;
+#else
+	load = (3 * atomic_load_explicit(&ls->load, memory_order_relaxed)
+		+ busy) / 4;
+#endif
+    }
+#ifdef NO_SHAREDOBJ
+    pthread_mutex_lock(&loadlock);
+    ls->idleSince = 0;
+    if (elapsed >= LOADWINDOW) ls->load = load;
+    pthread_mutex_unlock(&loadlock);
+#else
+    atomic_store_explicit(&ls->idleSince, 0, memory_order_relaxed);
+    if (elapsed >= LOADWINDOW)
+    {
+	atomic_store_explicit(&ls->load, load, memory_order_relaxed);
+    }
+#endif
+}
+
 #ifndef NO_SHAREDOBJ
 static void enqueueLockfree(SvcCommandQueue *q, SvcCommandNode *node)
 {
@@ -1205,6 +1303,7 @@ static int processEvents(void)
 	PSC_Log_err(PSC_L_ERROR, "port_getn() failed");
 	return -1;
     }
+    loadWaitEnd();
     clearMustWake();
     for (unsigned i = 0; i < nev; ++i)
     {
@@ -1262,6 +1361,7 @@ static int processEvents(void)
 	PSC_Log_err(PSC_L_ERROR, "kevent() failed");
 	return -1;
     }
+    loadWaitEnd();
     clearMustWake();
     svc->nchanges = 0;
     PSC_Timer *timer;
@@ -1340,6 +1440,7 @@ static int processEvents(void)
 	PSC_Log_err(PSC_L_ERROR, "epoll_pwait2() failed");
 	return -1;
     }
+    loadWaitEnd();
     clearMustWake();
     for (int i = 0; i < prc; ++i)
     {
@@ -1396,6 +1497,7 @@ static int processEvents(void)
 	PSC_Log_err(PSC_L_ERROR, "poll() failed");
 	return -1;
     }
+    loadWaitEnd();
     clearMustWake();
     for (size_t i = 0; prc > 0 && i < svc->nfds; ++i)
     {
@@ -1469,6 +1571,7 @@ static int processEvents(void)
 	PSC_Log_err(PSC_L_ERROR, "pselect() failed");
 	return -1;
     }
+    loadWaitEnd();
     clearMustWake();
     if (w) for (int i = 0; src > 0 && i < svc->nfds; ++i)
     {
@@ -1640,6 +1743,10 @@ static int serviceLoop(ServiceLoopFlags flags)
     {
 	objpoolinit();
 	opts = runOpts();
+	loopclock = CLOCK_MONOTONIC;
+#ifdef CLOCK_MONOTONIC_COARSE
+	if (opts->coarseClock) loopclock = CLOCK_MONOTONIC_COARSE;
+#endif
 
 	if (flags & SLF_SVCRUN)
 	{
@@ -1940,8 +2047,13 @@ static int serviceLoop(ServiceLoopFlags flags)
 
     svc->running = 1;
     svc->shutdownRef = -1;
+    LoadStat *ls = loadStat();
+    ls->windowStart = monotonicUs();
+    ls->idle = 0;
+    ls->load = 0;
     while (svc->shutdownRef != 0)
     {
+	loadWaitBegin();
 	if (processEvents() < 0)
 	{
 	    rc = EXIT_FAILURE;
@@ -1970,6 +2082,7 @@ static int serviceLoop(ServiceLoopFlags flags)
 
 shutdown:
     svc->running = 0;
+    nowNs = 0;
     if (flags & SLF_SVCMAIN)
     {
 	PSC_Timer_destroy(shutdownTimer);
@@ -2097,6 +2210,7 @@ done:
     }
 #endif
 
+    PSC_ThreadPool_threadDone();
     PSC_Event_destroyStatic(&svc->readyRead);
     PSC_Event_destroyStatic(&svc->readyWrite);
     PSC_Event_destroyStatic(&svc->eventsDone);
@@ -2226,6 +2340,48 @@ SOEXPORT int PSC_Service_threadNo(void)
     return svc->svcid->threadno;
 }
 
+SOEXPORT unsigned PSC_Service_threadLoad(int threadNo)
+{
+    LoadStat *ls;
+    if (threadNo < 0) ls = &mainload;
+    else if (threadNo < nssvc) ls = &ssvc[threadNo].load;
+    else return 0;
+
+    uint64_t idleSince;
+    unsigned load;
+#ifdef NO_SHAREDOBJ
+    pthread_mutex_lock(&loadlock);
+    idleSince = ls->idleSince;
+    load = ls->load;
+    pthread_mutex_unlock(&loadlock);
+#else
+    idleSince = atomic_load_explicit(&ls->idleSince, memory_order_relaxed);
+    load = atomic_load_explicit(&ls->load, memory_order_relaxed);
+#endif
+
+    /* a thread blocking for longer than a window doesn't update its load,
+     * so report it as idle */
+    if (idleSince && monotonicUs() - idleSince >= LOADWINDOW) return 0;
+    return load;
+}
+
+SOEXPORT uint64_t PSC_Service_now(void)
+{
+    return nowNs ? nowNs : readClock(loopclock);
+}
+
+SOEXPORT uint64_t PSC_Service_nowMs(void)
+{
+    return PSC_Service_now() / 1000000U;
+}
+
+SOLOCAL uint64_t PSC_Service_preciseNow(void)
+{
+    /* the coarse clock lags behind, timers would be found not yet due */
+    if (nowNs && loopclock == CLOCK_MONOTONIC) return nowNs;
+    return readClock(CLOCK_MONOTONIC);
+}
+
 SOEXPORT void PSC_Service_runOnThread(int threadNo,
 	PSC_OnThreadExec func, void *arg)
 {
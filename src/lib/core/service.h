@@ -3,8 +3,11 @@
 
 #include <poser/core/service.h>
 
+#include <stdint.h>
+
 int PSC_Service_running(void);
 int PSC_Service_shutsdown(void);
+uint64_t PSC_Service_preciseNow(void);
 
 #ifdef HAVE_EVPORTS
 #  undef HAVE_KQUEUE
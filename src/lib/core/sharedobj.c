@@ -9,6 +9,9 @@ static atomic_uint intDestroy;
 static atomic_uint epoch;
 static atomic_uint nthr;
 static atomic_uint *res;
+static atomic_flag freelock = ATOMIC_FLAG_INIT;
+static unsigned *freetids;
+static unsigned nfree;
 
 static THREADLOCAL unsigned tid;
 static THREADLOCAL unsigned ncreated;
@@ -79,9 +82,36 @@ SOLOCAL void SharedObj_retire(void *self)
     }
 }
 
+static void lockFree(void)
+{
+    while (atomic_flag_test_and_set_explicit(&freelock,
+		memory_order_acquire)) ;
+}
+
+static void unlockFree(void)
+{
+    atomic_flag_clear_explicit(&freelock, memory_order_release);
+}
+
 SOLOCAL void SOM_registerThread(void)
 {
-    tid = atomic_fetch_add_explicit(&nthr, 1, memory_order_acq_rel);
+    lockFree();
+    int reuse = nfree > 0;
+    if (reuse) tid = freetids[--nfree];
+    unlockFree();
+    if (!reuse) tid = atomic_fetch_add_explicit(&nthr, 1,
+	    memory_order_acq_rel);
+}
+
+SOLOCAL void SOM_unregisterThread(void)
+{
+    lockFree();
+    if (freetids)
+    {
+	SOM_release();
+	freetids[nfree++] = tid;
+    }
+    unlockFree();
 }
 
 SOLOCAL void SOM_init(unsigned nthreads,
@@ -90,6 +120,9 @@ SOLOCAL void SOM_init(unsigned nthreads,
     atomic_store_explicit(&intEpoch, epochInterval, memory_order_release);
     atomic_store_explicit(&intDestroy, destroyInterval, memory_order_release);
     res = PSC_malloc(nthreads * sizeof *res);
+    lockFree();
+    freetids = PSC_malloc(nthreads * sizeof *freetids);
+    unlockFree();
 }
 
 SOLOCAL void *SOM_reserve(void *_Atomic *ref)
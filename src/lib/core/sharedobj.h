@@ -31,12 +31,14 @@ void SharedObj_retire(void *self);
 void SOM_init(unsigned nthreads,
 	unsigned epochInterval, unsigned destroyInterval);
 void SOM_registerThread(void);
+void SOM_unregisterThread(void);
 void *SOM_reserve(void *_Atomic *ref);
 void SOM_release(void);
 
 #else
 
 #define SOM_registerThread()
+#define SOM_unregisterThread()
 
 #endif
 #endif
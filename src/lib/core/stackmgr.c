@@ -19,81 +19,244 @@
 #include "stackmgr.h"
 
 #include <poser/core/util.h>
-#include <pthread.h>
 #include <stdlib.h>
 
 #ifdef STACK_MFLAGS
 #  include <poser/core/service.h>
 #  include <sys/mman.h>
+#  include <unistd.h>
 #endif
 
-#define STACKSCHUNK 16
+#undef STACKMGR_NO_ATOMICS
+#if defined(NO_ATOMICS) || defined(__STDC_NO_ATOMICS__)
+#  define STACKMGR_NO_ATOMICS
+#else
+#  include <stdatomic.h>
+#  if ATOMIC_POINTER_LOCK_FREE != 2
+#    define STACKMGR_NO_ATOMICS
+#  endif
+#endif
+
+#ifdef STACKMGR_NO_ATOMICS
+#  include <pthread.h>
+#endif
 
-static size_t sz = 2U * 1024U * 1024U;
+#ifndef LOCALSTACKS
+#define LOCALSTACKS 4
+#endif
+
+/* Unused stacks are linked by a header at their top end, which is only
+ * overwritten once the stack is used again. Every thread keeps a few of
+ * them for reuse without any synchronization, others go to a global list
+ * per size class. That list is only ever pushed to or taken as a whole,
+ * so it can't suffer from ABA problems without locking. Stacks in the
+ * global list are released to the OS except for the page holding the
+ * header. */
+typedef struct StackHdr StackHdr;
+struct StackHdr
+{
+    StackHdr *next;
+};
 
-static void **stacks;
-static size_t nstacks;
-static size_t cstacks;
+static size_t sizes[NSTACKCLASSES] = {
+    2U * 1024U * 1024U,
+    64U * 1024U,
+    256U * 1024U,
+    8U * 1024U * 1024U
+};
+
+#ifdef STACKMGR_NO_ATOMICS
 static pthread_mutex_t stackslock = PTHREAD_MUTEX_INITIALIZER;
+static StackHdr *stacks[NSTACKCLASSES];
+static int used;
+#else
+static StackHdr *_Atomic stacks[NSTACKCLASSES];
+static atomic_int used;
+#endif
+
+static THREADLOCAL StackHdr *cache[NSTACKCLASSES];
+static THREADLOCAL unsigned ncached[NSTACKCLASSES];
+
+static StackHdr *header(void *stack, int cls)
+{
+    return (StackHdr *)((char *)stack + sizes[cls]) - 1;
+}
+
+static void *base(StackHdr *hdr, int cls)
+{
+    return (char *)(hdr + 1) - sizes[cls];
+}
+
+static void *allocStack(int cls)
+{
+#ifdef STACK_MFLAGS
+    /* one extra page below the stack is never accessible, so an overflow
+     * crashes instead of corrupting memory */
+    size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+    char *map = mmap(0, sizes[cls] + pagesz, PROT_READ|PROT_WRITE,
+	    STACK_MFLAGS, -1, 0);
+    if (map == MAP_FAILED) PSC_Service_panic("stack allocation failed.");
+    if (mprotect(map, pagesz, PROT_NONE) < 0)
+    {
+	PSC_Service_panic("stack guard page creation failed.");
+    }
+    return map + pagesz;
+#else
+    return PSC_malloc(sizes[cls]);
+#endif
+}
+
+static void freeStack(void *stack, int cls)
+{
+#ifdef STACK_MFLAGS
+    size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+    munmap((char *)stack - pagesz, sizes[cls] + pagesz);
+#else
+    (void)cls;
+    free(stack);
+#endif
+}
+
+static void pushGlobal(int cls, StackHdr *first, StackHdr *last)
+{
+#ifdef STACKMGR_NO_ATOMICS
+    pthread_mutex_lock(&stackslock);
+    last->next = stacks[cls];
+    stacks[cls] = first;
+    pthread_mutex_unlock(&stackslock);
+#else
+    StackHdr *head = atomic_load_explicit(stacks + cls,
+	    memory_order_relaxed);
+    do
+    {
+	last->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(stacks + cls, &head,
+		first, memory_order_release, memory_order_relaxed));
+#endif
+}
+
+static StackHdr *takeGlobal(int cls)
+{
+#ifdef STACKMGR_NO_ATOMICS
+    pthread_mutex_lock(&stackslock);
+    StackHdr *head = stacks[cls];
+    stacks[cls] = 0;
+    pthread_mutex_unlock(&stackslock);
+    return head;
+#else
+    return atomic_exchange_explicit(stacks + cls, 0, memory_order_acquire);
+#endif
+}
+
+static void releaseGlobal(StackHdr *hdr, int cls)
+{
+#if defined(STACK_MFLAGS) && defined(HAVE_MADVISE) && defined(HAVE_MADVFREE)
+    size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+    madvise(base(hdr, cls), sizes[cls] - pagesz, MADV_FREE);
+#endif
+    pushGlobal(cls, hdr, hdr);
+}
 
 SOLOCAL int StackMgr_setSize(size_t stacksz)
 {
-    if (stacks) return -1;
+#ifdef STACKMGR_NO_ATOMICS
+    pthread_mutex_lock(&stackslock);
+    int inuse = used;
+    pthread_mutex_unlock(&stackslock);
+#else
+    int inuse = atomic_load_explicit(&used, memory_order_relaxed);
+#endif
+    if (inuse) return -1;
     if (stacksz < 64U * 1024U) stacksz = 64U * 1024U;
     if (stacksz > 16U * 1024U * 1024U) stacksz = 16U * 1024U * 1024U;
-    sz = stacksz;
+    sizes[0] = (stacksz + 0xffffU) & ~(size_t)0xffffU;
     return 0;
 }
 
-SOLOCAL size_t StackMgr_size(void)
+SOLOCAL size_t StackMgr_size(int cls)
 {
-    return sz;
+    return sizes[cls];
 }
 
-SOLOCAL void *StackMgr_getStack(void)
+SOLOCAL void *StackMgr_getStack(int cls)
 {
-    void *stack = 0;
+    StackHdr *hdr = cache[cls];
+    if (hdr)
+    {
+	cache[cls] = hdr->next;
+	--ncached[cls];
+	return base(hdr, cls);
+    }
+    if ((hdr = takeGlobal(cls)))
+    {
+	/* keep some for this thread, give the rest back */
+	StackHdr *last = hdr->next;
+	unsigned n = 0;
+	cache[cls] = last;
+	while (last && ++n < LOCALSTACKS) last = last->next;
+	if (last && last->next)
+	{
+	    StackHdr *rest = last->next;
+	    last->next = 0;
+	    for (last = rest; last->next; last = last->next) ;
+	    pushGlobal(cls, rest, last);
+	}
+	ncached[cls] = n;
+	return base(hdr, cls);
+    }
+#ifdef STACKMGR_NO_ATOMICS
     pthread_mutex_lock(&stackslock);
-    if (nstacks) stack = stacks[--nstacks];
+    used = 1;
     pthread_mutex_unlock(&stackslock);
-    if (stack) return stack;
-#ifdef STACK_MFLAGS
-    stack = mmap(0, sz, PROT_READ|PROT_WRITE, STACK_MFLAGS, -1, 0);
-    if (stack == MAP_FAILED) PSC_Service_panic("stack allocation failed.");
 #else
-    stack = PSC_malloc(sz);
+    atomic_store_explicit(&used, 1, memory_order_relaxed);
 #endif
-    return stack;
+    return allocStack(cls);
 }
 
-SOLOCAL void StackMgr_returnStack(void *stack)
+SOLOCAL void StackMgr_returnStack(void *stack, int cls)
 {
     if (!stack) return;
-    pthread_mutex_lock(&stackslock);
-    if (nstacks == cstacks)
+    StackHdr *hdr = header(stack, cls);
+    if (ncached[cls] < LOCALSTACKS)
     {
-	cstacks += STACKSCHUNK;
-	stacks = PSC_realloc(stacks, cstacks * sizeof *stacks);
+	hdr->next = cache[cls];
+	cache[cls] = hdr;
+	++ncached[cls];
+    }
+    else releaseGlobal(hdr, cls);
+}
+
+SOLOCAL void StackMgr_threadDone(void)
+{
+    for (int cls = 0; cls < NSTACKCLASSES; ++cls)
+    {
+	while (cache[cls])
+	{
+	    StackHdr *hdr = cache[cls];
+	    cache[cls] = hdr->next;
+	    releaseGlobal(hdr, cls);
+	}
+	ncached[cls] = 0;
     }
-    stacks[nstacks++] = stack;
-#if defined(STACK_MFLAGS) && defined(HAVE_MADVISE) && defined(HAVE_MADVFREE)
-    madvise(stack, sz, MADV_FREE);
-#endif
-    pthread_mutex_unlock(&stackslock);
 }
 
 SOLOCAL void StackMgr_clean(void)
 {
-    for (size_t i = 0; i < nstacks; ++i)
+    StackMgr_threadDone();
+    for (int cls = 0; cls < NSTACKCLASSES; ++cls)
     {
-#ifdef STACK_MFLAGS
-	munmap(stacks[i], sz);
+	for (StackHdr *hdr = takeGlobal(cls), *next = 0; hdr; hdr = next)
+	{
+	    next = hdr->next;
+	    freeStack(base(hdr, cls), cls);
+	}
+    }
+#ifdef STACKMGR_NO_ATOMICS
+    pthread_mutex_lock(&stackslock);
+    used = 0;
+    pthread_mutex_unlock(&stackslock);
 #else
-	free(stacks[i]);
+    atomic_store_explicit(&used, 0, memory_order_relaxed);
 #endif
-    }
-    free(stacks);
-    nstacks = 0;
-    cstacks = 0;
 }
-
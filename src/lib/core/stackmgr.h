@@ -4,10 +4,13 @@
 #include <poser/decl.h>
 #include <stddef.h>
 
+#define NSTACKCLASSES 4
+
 int StackMgr_setSize(size_t stacksz);
-size_t StackMgr_size(void);
-void *StackMgr_getStack(void) ATTR_RETNONNULL;
-void StackMgr_returnStack(void *stack);
+size_t StackMgr_size(int cls) ATTR_PURE;
+void *StackMgr_getStack(int cls) ATTR_RETNONNULL;
+void StackMgr_returnStack(void *stack, int cls);
+void StackMgr_threadDone(void);
 void StackMgr_clean(void);
 
 #endif
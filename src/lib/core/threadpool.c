@@ -1,5 +1,6 @@
 #define _DEFAULT_SOURCE
 
+#include "context.h"
 #include "event.h"
 #include "sharedobj.h"
 
@@ -15,8 +16,10 @@
 #include <semaphore.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #undef THRP_NO_ATOMICS
@@ -34,9 +37,20 @@
 #  endif
 #endif
 
-#ifdef HAVE_UCONTEXT
+#undef THRP_FUTEX
+#if defined(HAVE_FUTEX) && !defined(THRP_NO_ATOMICS)
+#  define THRP_FUTEX
+#  include <limits.h>
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#endif
+
+#ifdef HAVE_EVENTFD
+#  include <sys/eventfd.h>
+#endif
+
+#ifdef HAVE_CONTEXT
 #  include "stackmgr.h"
-#  include <ucontext.h>
 #endif
 
 #ifndef DEFTHREADS
@@ -63,10 +77,31 @@
 #define QLENPERTHREAD 2
 #endif
 
+#ifndef JOBCACHESZ
+#define JOBCACHESZ 256
+#endif
+
+#ifndef SPAWNDELAY
+#define SPAWNDELAY 100
+#endif
+
+#ifndef IDLETIMEOUT
+#define IDLETIMEOUT 30000
+#endif
+
+#define NJOBCLASSES 4
+
+#define LOADWINDOW 100000U
+
+typedef struct SubmitQueue SubmitQueue;
+
 struct PSC_ThreadJob
 {
     PSC_Event finished;
+    PSC_ThreadJob *next;
+    SubmitQueue *queue;
     PSC_ThreadProc proc;
+    PSC_ThreadJobDone done;
     void *arg;
     PSC_Timer *timeout;
     PSC_AsyncTask *task;
@@ -74,17 +109,21 @@ struct PSC_ThreadJob
 #ifdef THRP_NO_ATOMICS
     pthread_mutex_t lock;
     int hasCompleted;
-    int pthrno;
+    int cancelwr;
 #else
     atomic_int hasCompleted;
-    atomic_int pthrno;
+    atomic_int cancelwr;
 #endif
+    int cancelrd;
+    uint64_t enqueued;
     int thrno;
     unsigned timeoutMs;
-#ifdef HAVE_UCONTEXT
-    ucontext_t caller;
-    void *stack;
+    PSC_ThreadJobClass cls;
     int async;
+#ifdef HAVE_CONTEXT
+    Context caller;
+    void *stack;
+    PSC_StackSize stacksz;
 #endif
 };
 
@@ -98,39 +137,175 @@ typedef struct PSC_ThreadOpts
     int maxQueueLen;
     int minQueueLen;
     int qLenPerThread;
+    int minThreads;
+    int spawnDelay;
+    int idleTimeout;
+    PSC_QueuePolicy queuePolicy;
+    int classWeight[NJOBCLASSES];
+    int classLimit[NJOBCLASSES];
 } PSC_ThreadOpts;
 
-typedef struct JobQueue
+/* Every thread submitting jobs (the main thread and each service worker
+ * thread) owns a Chase-Lev deque. Only the owner pushes at the bottom,
+ * pool threads steal from the top, so jobs of one submitter are still
+ * started in FIFO order.
+ *
+ * When growing, the owner copies the jobs to a larger ring. Thieves might
+ * still read from the old ring, so it is kept until the queue is
+ * destroyed. */
+typedef struct JobRing JobRing;
+struct JobRing
 {
-    unsigned sz;
+    JobRing *prev;
+    size_t sz;
+    PSC_ThreadJob *THRP_ATOMIC jobs[];
+};
+
+/* Jobs of each PSC_ThreadJobClass are kept in their own deque. */
+typedef struct JobDeque
+{
+#ifdef THRP_NO_ATOMICS
+    JobRing *ring;
+    size_t top;
+    size_t bottom;
+    int full;
+#else
+    JobRing *THRP_ATOMIC ring;
+    char _pad0[64];
+    atomic_size_t top;
+    atomic_int full;
+    char _pad1[64];
+    atomic_size_t bottom;
+    char _pad2[64];
+#endif
+} JobDeque;
+
+/* Jobs finished by the workers are collected in a stack per queue, and
+ * only the worker finding it empty schedules delivering them on the owner
+ * thread, so a burst of completions costs a single command. A scheduled
+ * delivery holds a reference, so the queue outlives the pool if needed. */
+struct SubmitQueue
+{
+    SubmitQueue *next;
+    int thrno;
 #ifdef THRP_NO_ATOMICS
-    unsigned avail;
-    unsigned enqpos;
-    unsigned deqpos;
     pthread_mutex_t lock;
+    PSC_ThreadJob *finished;
+    int refcnt;
 #else
-    char _pad0[64 - sizeof(unsigned)];
-    atomic_uint avail;
-    char _pad1[64 - sizeof(unsigned)];
-    atomic_uint enqpos;
-    char _pad2[64 - sizeof(unsigned)];
-    atomic_uint deqpos;
-    char _pad3[64 - sizeof(unsigned)];
+    PSC_ThreadJob *THRP_ATOMIC finished;
+    atomic_int refcnt;
 #endif
-    sem_t count;
-    PSC_ThreadJob *THRP_ATOMIC jobs[];
-} JobQueue;
+    JobDeque deques[NJOBCLASSES];
+};
+
+/* Idle pool threads park on an event count: a worker announces itself as
+ * a waiter, checks all queues once more and only then blocks until the
+ * epoch changes, so submitters only need to signal if there's a waiter at
+ * all. Where available, workers sleep on a futex on the epoch itself, so
+ * waking them needs no lock and exactly as many are woken as needed. */
+typedef struct Parker
+{
+#ifndef THRP_FUTEX
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+#ifdef THRP_NO_ATOMICS
+    unsigned epoch;
+    unsigned waiters;
+#else
+    atomic_uint epoch;
+    atomic_uint waiters;
+#endif
+} Parker;
 
 typedef struct Thread
 {
     pthread_t handle;
     sem_t stop;
-#ifdef HAVE_UCONTEXT
-    ucontext_t context;
+#ifdef HAVE_CONTEXT
+    Context context;
 #endif
+    SubmitQueue *stealpos[NJOBCLASSES];
+    int credit[NJOBCLASSES];
     int pthrno;
 } Thread;
 
+/* Statistics of a worker slot, only ever written by the worker thread
+ * currently using it, so updating doesn't need atomic read-modify-write
+ * operations. They are kept when an idle worker retires. */
+typedef struct WorkerStats
+{
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_t lock;
+    uint64_t wait[PSC_TP_HISTBUCKETS];
+    uint64_t run[PSC_TP_HISTBUCKETS];
+    uint64_t waitTotal;
+    uint64_t runTotal;
+    uint64_t busySince;
+    uint64_t idleSince;
+    unsigned load;
+#else
+    _Atomic uint64_t wait[PSC_TP_HISTBUCKETS];
+    _Atomic uint64_t run[PSC_TP_HISTBUCKETS];
+    _Atomic uint64_t waitTotal;
+    _Atomic uint64_t runTotal;
+    _Atomic uint64_t busySince;
+    _Atomic uint64_t idleSince;
+    atomic_uint load;
+#endif
+    uint64_t windowStart;
+    uint64_t busy;
+} WorkerStats;
+
+struct PSC_ThreadPoolStats
+{
+    uint64_t wait[PSC_TP_HISTBUCKETS];
+    uint64_t run[PSC_TP_HISTBUCKETS];
+    uint64_t waitTotal;
+    uint64_t runTotal;
+    uint64_t jobs;
+    uint64_t rejected;
+    uint64_t timeouts;
+    uint64_t canceled;
+    int nworkers;
+    unsigned busy[];
+};
+
+typedef struct ParallelWork ParallelWork;
+
+typedef struct ParallelPart
+{
+    ParallelWork *work;
+    void *result;
+    int hasResult;
+} ParallelPart;
+
+/* Work split by PSC_ThreadPool_parallelFor() and
+ * PSC_ThreadPool_parallelReduce(). All parts take ranges from a shared
+ * counter, each one a fraction of what's left, but at least the grain
+ * size, so ranges shrink towards the end and workers finish at about the
+ * same time. */
+struct ParallelWork
+{
+    PSC_RangeProc proc;
+    PSC_RangeMapProc map;
+    PSC_CombineProc combine;
+    PSC_ParallelDone done;
+    void *arg;
+    size_t count;
+    size_t grain;
+    size_t nparts;
+    size_t pending;
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_t lock;
+    size_t next;
+#else
+    atomic_size_t next;
+#endif
+    ParallelPart parts[];
+};
+
 struct PSC_AsyncTask
 {
     PSC_AsyncTaskJob job;
@@ -139,294 +314,1339 @@ struct PSC_AsyncTask
     void *arg;
     void *result;
     sem_t complete;
-#ifdef HAVE_UCONTEXT
-    ucontext_t resume;
+#ifdef HAVE_CONTEXT
+    Context resume;
 #endif
 };
 
 static PSC_ThreadOpts opts;
 static Thread *threads;
-static JobQueue *jobQueue;
+static WorkerStats *workerStats;
+static SubmitQueue *THRP_ATOMIC submitQueues;
+static Parker parker;
+static int queuesize;
+static unsigned generation;
 static int nthreads;
+static int minthreads;
 static int rthreads;
+static int stopping;
+static PSC_Timer *loadTimer;
+static size_t lastBacklog;
+static int backlogTicks;
+#ifdef THRP_NO_ATOMICS
+static pthread_mutex_t queueslock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t classlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t workerslock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t statslock = PTHREAD_MUTEX_INITIALIZER;
+static int busy[NJOBCLASSES];
+static int nworkers;
+static int nblocked;
+static uint64_t nrejected;
+static uint64_t ntimeouts;
+static uint64_t ncanceled;
+#else
+static atomic_int busy[NJOBCLASSES];
+static atomic_int nworkers;
+static atomic_int nblocked;
+static _Atomic uint64_t nrejected;
+static _Atomic uint64_t ntimeouts;
+static _Atomic uint64_t ncanceled;
+#endif
 
 static THREADLOCAL int mainthread;
 static THREADLOCAL jmp_buf panicjmp;
 static THREADLOCAL const char *panicmsg;
 static THREADLOCAL Thread *currentThread;
 static THREADLOCAL PSC_ThreadJob *currentJob;
+static THREADLOCAL SubmitQueue *submitQueue;
+static THREADLOCAL unsigned submitGeneration;
+static THREADLOCAL PSC_ThreadJob *deferredJobs;
+static THREADLOCAL PSC_ThreadJob *lastDeferredJob;
+static THREADLOCAL PSC_ThreadJob *inlineJobs;
+static THREADLOCAL PSC_ThreadJob *lastInlineJob;
+static THREADLOCAL int overflowing;
+static THREADLOCAL PSC_Event queueFullEvent;
+static THREADLOCAL PSC_Event queueAvailableEvent;
+static THREADLOCAL PSC_ThreadJob *jobCache;
+static THREADLOCAL unsigned jobCacheSize;
 
 static void panicHandler(const char *msg) ATTR_NONNULL((1));
 static void stopThreads(int nthr);
 static void threadJobDone(void *arg);
 static void *worker(void *arg);
-static void workerInterrupt(int signum);
-
-static void workerInterrupt(int signum)
-{
-    (void) signum;
-}
 
-#ifdef HAVE_UCONTEXT
+#ifdef HAVE_CONTEXT
 static void runThreadJob(void)
 {
     PSC_ThreadJob *job = currentJob;
     job->proc(job->arg);
-    setcontext(&job->caller);
+    Context_jump(&job->caller);
+}
+#endif
+
+static uint64_t nowUs(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) return 0;
+    return (uint64_t)ts.tv_sec * 1000000U + ts.tv_nsec / 1000U;
+}
+
+#ifdef THRP_NO_ATOMICS
+static void countStat(uint64_t *counter)
+{
+    pthread_mutex_lock(&statslock);
+    ++*counter;
+    pthread_mutex_unlock(&statslock);
+}
+
+static uint64_t readStat(uint64_t *counter)
+{
+    pthread_mutex_lock(&statslock);
+    uint64_t val = *counter;
+    pthread_mutex_unlock(&statslock);
+    return val;
+}
+#else
+static void countStat(_Atomic uint64_t *counter)
+{
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static uint64_t readStat(_Atomic uint64_t *counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
 }
 #endif
 
-static JobQueue *JobQueue_create(unsigned sz)
+static JobRing *JobRing_create(JobRing *prev, size_t sz)
 {
-    JobQueue *self = PSC_malloc(sizeof *self + sz * sizeof *self->jobs);
+    JobRing *self = PSC_malloc(sizeof *self + sz * sizeof *self->jobs);
+    self->prev = prev;
     self->sz = sz;
-    self->avail = sz;
-    self->enqpos = 0;
-    self->deqpos = 0;
-    if (sem_init(&self->count, 0, 0) != 0)
-    {
-	free(self);
-	return 0;
-    }
+    return self;
+}
+
+static SubmitQueue *SubmitQueue_create(size_t sz)
+{
+    SubmitQueue *self = PSC_malloc(sizeof *self);
+    memset(self, 0, sizeof *self);
 #ifdef THRP_NO_ATOMICS
     if (pthread_mutex_init(&self->lock, 0) != 0)
     {
-	sem_destroy(&self->count);
 	free(self);
 	return 0;
     }
+#endif
+    for (int i = 0; i < NJOBCLASSES; ++i)
+    {
+	self->deques[i].ring = JobRing_create(0, sz);
+    }
+    self->thrno = PSC_Service_threadNo();
+    self->refcnt = 1;
+    return self;
+}
+
+static SubmitQueue *SubmitQueue_get(void)
+{
+    /* queues are freed when the pool stops, so a queue created for an
+     * earlier pool must never be touched again */
+    if (submitQueue && submitGeneration == generation) return submitQueue;
+    SubmitQueue *self = SubmitQueue_create(queuesize);
+    if (!self) return 0;
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&queueslock);
+    self->next = submitQueues;
+    submitQueues = self;
+    pthread_mutex_unlock(&queueslock);
 #else
-    memset(self->jobs, 0, sz * sizeof *self->jobs);
+    SubmitQueue *head = atomic_load_explicit(&submitQueues,
+	    memory_order_relaxed);
+    do
+    {
+	self->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&submitQueues, &head,
+		self, memory_order_release, memory_order_relaxed));
 #endif
+    submitQueue = self;
+    submitGeneration = generation;
     return self;
 }
 
+static SubmitQueue *SubmitQueue_first(void)
+{
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&queueslock);
+    SubmitQueue *first = submitQueues;
+    pthread_mutex_unlock(&queueslock);
+    return first;
+#else
+    return atomic_load_explicit(&submitQueues, memory_order_acquire);
+#endif
+}
+
 #ifdef THRP_NO_ATOMICS
-static int JobQueue_enqueue(JobQueue *self, PSC_ThreadJob *job)
+static JobRing *JobDeque_grow(JobDeque *self)
+{
+    JobRing *ring = self->ring;
+    self->ring = JobRing_create(ring, 2 * ring->sz);
+    for (size_t i = self->top; i != self->bottom; ++i)
+    {
+	self->ring->jobs[i % self->ring->sz] = ring->jobs[i % ring->sz];
+    }
+    return self->ring;
+}
+
+static size_t SubmitQueue_pushBatch(SubmitQueue *self,
+	PSC_ThreadJob **jobs, size_t n, int grow)
 {
+    size_t i = 0;
+    uint64_t now = nowUs();
     pthread_mutex_lock(&self->lock);
-    if (!self->avail)
+    for (; i < n; ++i)
     {
-	pthread_mutex_unlock(&self->lock);
-	return -1;
+	PSC_ThreadJob *job = jobs[i];
+	JobDeque *d = self->deques + job->cls;
+	JobRing *ring = d->ring;
+	if (d->bottom - d->top >= ring->sz)
+	{
+	    if (!grow) break;
+	    ring = JobDeque_grow(d);
+	}
+	job->queue = self;
+	job->enqueued = now;
+	if (job->timeoutMs) PSC_Timer_start(job->timeout, 0);
+	ring->jobs[d->bottom++ % ring->sz] = job;
     }
-    if (job->timeout) PSC_Timer_start(job->timeout, 0);
-    --self->avail;
-    self->jobs[self->enqpos++] = job;
-    if (self->enqpos == self->sz) self->enqpos = 0;
-    sem_post(&self->count);
     pthread_mutex_unlock(&self->lock);
-    return 0;
+    return i;
 }
 
-static PSC_ThreadJob *JobQueue_dequeue(JobQueue *self)
+static int SubmitQueue_push(SubmitQueue *self, PSC_ThreadJob *job, int grow)
 {
-    if (sem_wait(&self->count) < 0) return 0;
+    return SubmitQueue_pushBatch(self, &job, 1, grow) ? 0 : -1;
+}
+
+static PSC_ThreadJob *SubmitQueue_steal(SubmitQueue *self, int cls,
+	int *wasfull)
+{
+    JobDeque *d = self->deques + cls;
+    PSC_ThreadJob *job = 0;
     pthread_mutex_lock(&self->lock);
-    PSC_ThreadJob *job = self->jobs[self->deqpos++];
-    if (self->deqpos == self->sz) self->deqpos = 0;
-    ++self->avail;
+    if (d->top < d->bottom)
+    {
+	job = d->ring->jobs[d->top++ % d->ring->sz];
+	*wasfull = d->full;
+	d->full = 0;
+    }
     pthread_mutex_unlock(&self->lock);
     return job;
 }
+
+static int SubmitQueue_markFull(SubmitQueue *self, int cls)
+{
+    JobDeque *d = self->deques + cls;
+    pthread_mutex_lock(&self->lock);
+    int full = d->bottom - d->top >= d->ring->sz;
+    d->full = full;
+    pthread_mutex_unlock(&self->lock);
+    return full;
+}
+
+static size_t SubmitQueue_pending(SubmitQueue *self)
+{
+    size_t n = 0;
+    pthread_mutex_lock(&self->lock);
+    for (int c = 0; c < NJOBCLASSES; ++c)
+    {
+	n += self->deques[c].bottom - self->deques[c].top;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return n;
+}
 #else
-static int JobQueue_enqueue(JobQueue *self, PSC_ThreadJob *job)
+static JobRing *JobDeque_grow(JobDeque *self, JobRing *ring,
+	size_t t, size_t b)
 {
-    unsigned avail = atomic_load_explicit(&self->avail, memory_order_consume);
-    do
+    JobRing *grown = JobRing_create(ring, 2 * ring->sz);
+    for (size_t i = t; i != b; ++i)
     {
-	if (!avail) return -1;
-    } while (!atomic_compare_exchange_strong_explicit(&self->avail, &avail,
-		avail - 1, memory_order_release, memory_order_consume));
+	atomic_store_explicit(grown->jobs + i % grown->sz,
+		atomic_load_explicit(ring->jobs + i % ring->sz,
+		    memory_order_relaxed), memory_order_relaxed);
+    }
+    atomic_store_explicit(&self->ring, grown, memory_order_release);
+    return grown;
+}
 
-    if (job->timeout) PSC_Timer_start(job->timeout, 0);
-    unsigned next;
-    unsigned enqpos = atomic_load_explicit(&self->enqpos,
-	    memory_order_consume);
-    do
+static int SubmitQueue_push(SubmitQueue *self, PSC_ThreadJob *job, int grow)
+{
+    JobDeque *d = self->deques + job->cls;
+    size_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    size_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    JobRing *ring = atomic_load_explicit(&d->ring, memory_order_relaxed);
+    if (b - t >= ring->sz)
     {
-	next = enqpos + 1;
-	if (next == self->sz) next = 0;
-    } while (!atomic_compare_exchange_strong_explicit(&self->enqpos, &enqpos,
-		next, memory_order_release, memory_order_consume));
-    atomic_store_explicit(self->jobs + enqpos, job, memory_order_release);
-    sem_post(&self->count);
+	if (!grow) return -1;
+	ring = JobDeque_grow(d, ring, t, b);
+    }
+    job->queue = self;
+    job->enqueued = nowUs();
+    if (job->timeoutMs) PSC_Timer_start(job->timeout, 0);
+    atomic_store_explicit(ring->jobs + b % ring->sz, job,
+	    memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
     return 0;
 }
 
-static PSC_ThreadJob *JobQueue_dequeue(JobQueue *self)
+/* Push several jobs, publishing them to the thieves at once. Stops at the
+ * first job not fitting, returns the number of jobs pushed. */
+static size_t SubmitQueue_pushBatch(SubmitQueue *self,
+	PSC_ThreadJob **jobs, size_t n, int grow)
 {
-    if (sem_wait(&self->count) < 0) return 0;
-    unsigned next;
-    unsigned deqpos = atomic_load_explicit(&self->deqpos,
-	    memory_order_consume);
-    do
+    size_t b[NJOBCLASSES];
+    size_t t[NJOBCLASSES];
+    JobRing *ring[NJOBCLASSES];
+    for (int c = 0; c < NJOBCLASSES; ++c)
     {
-	next = deqpos + 1;
-	if (next == self->sz) next = 0;
-    } while (!atomic_compare_exchange_strong_explicit(&self->deqpos, &deqpos,
-		next, memory_order_release, memory_order_consume));
-    PSC_ThreadJob *job;
-    while (!(job = atomic_exchange_explicit(self->jobs + deqpos, 0,
-		    memory_order_acq_rel))) ;
-    atomic_fetch_add_explicit(&self->avail, 1, memory_order_release);
-    return job;
+	JobDeque *d = self->deques + c;
+	b[c] = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+	t[c] = atomic_load_explicit(&d->top, memory_order_acquire);
+	ring[c] = atomic_load_explicit(&d->ring, memory_order_relaxed);
+    }
+    size_t i = 0;
+    uint64_t now = nowUs();
+    for (; i < n; ++i)
+    {
+	PSC_ThreadJob *job = jobs[i];
+	int c = job->cls;
+	if (b[c] - t[c] >= ring[c]->sz)
+	{
+	    t[c] = atomic_load_explicit(&self->deques[c].top,
+		    memory_order_acquire);
+	    if (b[c] - t[c] >= ring[c]->sz)
+	    {
+		if (!grow) break;
+		ring[c] = JobDeque_grow(self->deques + c, ring[c], t[c], b[c]);
+	    }
+	}
+	job->queue = self;
+	job->enqueued = now;
+	if (job->timeoutMs) PSC_Timer_start(job->timeout, 0);
+	atomic_store_explicit(ring[c]->jobs + b[c]++ % ring[c]->sz, job,
+		memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release);
+    for (int c = 0; c < NJOBCLASSES; ++c)
+    {
+	atomic_store_explicit(&self->deques[c].bottom, b[c],
+		memory_order_relaxed);
+    }
+    return i;
+}
+
+static PSC_ThreadJob *SubmitQueue_steal(SubmitQueue *self, int cls,
+	int *wasfull)
+{
+    JobDeque *d = self->deques + cls;
+    size_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    for (;;)
+    {
+	atomic_thread_fence(memory_order_seq_cst);
+	size_t b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+	if (t >= b) return 0;
+	JobRing *ring = atomic_load_explicit(&d->ring, memory_order_acquire);
+	PSC_ThreadJob *job = atomic_load_explicit(ring->jobs + t % ring->sz,
+		memory_order_relaxed);
+	if (atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+		    memory_order_seq_cst, memory_order_relaxed))
+	{
+	    *wasfull = atomic_load_explicit(&d->full, memory_order_seq_cst)
+		&& atomic_exchange_explicit(&d->full, 0,
+			memory_order_seq_cst);
+	    return job;
+	}
+    }
+}
+
+/* Announce the deque being full to the thieves, the first one taking a
+ * job afterwards will notify the owner. Returns 0 if the deque isn't
+ * full (any more), so there's nothing to wait for. */
+static int SubmitQueue_markFull(SubmitQueue *self, int cls)
+{
+    JobDeque *d = self->deques + cls;
+    atomic_store_explicit(&d->full, 1, memory_order_seq_cst);
+    size_t t = atomic_load_explicit(&d->top, memory_order_seq_cst);
+    size_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    JobRing *ring = atomic_load_explicit(&d->ring, memory_order_relaxed);
+    if (b - t < ring->sz && atomic_exchange_explicit(&d->full, 0,
+		memory_order_seq_cst)) return 0;
+    return 1;
+}
+
+/* Only an estimate, as jobs might be taken or added concurrently */
+static size_t SubmitQueue_pending(SubmitQueue *self)
+{
+    size_t n = 0;
+    for (int c = 0; c < NJOBCLASSES; ++c)
+    {
+	size_t t = atomic_load_explicit(&self->deques[c].top,
+		memory_order_relaxed);
+	size_t b = atomic_load_explicit(&self->deques[c].bottom,
+		memory_order_relaxed);
+	if (b > t) n += b - t;
+    }
+    return n;
 }
 #endif
 
-static void JobQueue_destroy(JobQueue *self)
+static void SubmitQueue_destroy(SubmitQueue *self)
 {
     if (!self) return;
 #ifdef THRP_NO_ATOMICS
     pthread_mutex_destroy(&self->lock);
 #endif
-    sem_destroy(&self->count);
+    for (int i = 0; i < NJOBCLASSES; ++i)
+    {
+#ifdef THRP_NO_ATOMICS
+	JobRing *ring = self->deques[i].ring;
+#else
+	JobRing *ring = atomic_load_explicit(&self->deques[i].ring,
+		memory_order_relaxed);
+#endif
+	while (ring)
+	{
+	    JobRing *prev = ring->prev;
+	    free(ring);
+	    ring = prev;
+	}
+    }
     free(self);
 }
 
-static void workerDone(void *arg)
-{
-    Thread *t = arg;
-    t->pthrno = -1;
-    pthread_join(t->handle, 0);
-    sem_destroy(&t->stop);
-    if (--rthreads) return;
-    free(threads);
-    threads = 0;
-    JobQueue_destroy(jobQueue);
-    PSC_Service_unregisterPanic(panicHandler);
-    mainthread = 0;
-#ifdef HAVE_UCONTEXT
-    StackMgr_clean();
-#endif
-    PSC_Service_shutdownUnlock();
-}
+static void queueSpace(void *arg);
 
-static int checkpanic(void)
+static PSC_ThreadJob *stealJob(Thread *t, int cls)
 {
-    if (setjmp(panicjmp))
+    SubmitQueue *first = SubmitQueue_first();
+    if (!first) return 0;
+
+    /* continue after the queue of the last successful steal, so no
+     * submitter is starved by others */
+    SubmitQueue *start = t->stealpos[cls] && t->stealpos[cls]->next
+	? t->stealpos[cls]->next : first;
+    SubmitQueue *q = start;
+    do
     {
-	if (currentJob)
+	int wasfull = 0;
+	PSC_ThreadJob *job = SubmitQueue_steal(q, cls, &wasfull);
+	if (job)
 	{
-	    currentJob->panicmsg = panicmsg;
-	    PSC_Service_runOnThread(currentJob->thrno,
-		    threadJobDone, currentJob);
+	    if (wasfull) PSC_Service_runOnThread(q->thrno, queueSpace, q);
+	    t->stealpos[cls] = q;
+	    return job;
 	}
-	return 1;
-    }
+	if (!(q = q->next)) q = first;
+    } while (q != start);
     return 0;
 }
 
-static void *worker(void *arg)
+static int Parker_init(Parker *self)
 {
-    Thread *t = arg;
-    currentThread = t;
-    SOM_registerThread();
-
-    struct sigaction handler;
-    memset(&handler, 0, sizeof handler);
-    handler.sa_handler = workerInterrupt;
-    sigemptyset(&handler.sa_mask);
-    sigaddset(&handler.sa_mask, SIGUSR1);
-    if (sigaction(SIGUSR1, &handler, 0) < 0) return 0;
-    if (pthread_sigmask(SIG_UNBLOCK, &handler.sa_mask, 0) < 0) return 0;
-
-    if (!checkpanic()) for (;;)
+#ifndef THRP_FUTEX
+    if (pthread_mutex_init(&self->lock, 0) != 0) return -1;
+    if (pthread_cond_init(&self->cond, 0) != 0)
     {
-	currentJob = JobQueue_dequeue(jobQueue);
-	int stopped = 0;
-	sem_getvalue(&t->stop, &stopped);
-	if (stopped) break;
-	if (!currentJob) continue;
-#ifdef THRP_NO_ATOMICS
-	pthread_mutex_lock(&currentJob->lock);
-	if (currentJob->hasCompleted)
-	{
-	    currentJob->pthrno = t->pthrno;
-	    pthread_mutex_unlock(&currentJob->lock);
-#else
-	if (atomic_load_explicit(&currentJob->hasCompleted,
-		    memory_order_consume))
-	{
-	    atomic_store_explicit(&currentJob->pthrno, t->pthrno,
-		    memory_order_release);
+	pthread_mutex_destroy(&self->lock);
+	return -1;
+    }
 #endif
-#ifdef HAVE_UCONTEXT
-	    if (!currentJob->async) currentJob->proc(currentJob->arg);
-	    else if (currentJob->task)
-	    {
-		swapcontext(&currentJob->caller, &currentJob->task->resume);
-	    }
-	    else
-	    {
-		getcontext(&t->context);
-		if (!currentJob->stack) currentJob->stack = StackMgr_getStack();
-		t->context.uc_stack.ss_sp = currentJob->stack;
-		t->context.uc_stack.ss_size = StackMgr_size();
-		t->context.uc_link = 0;
-		makecontext(&t->context, runThreadJob, 0);
-		swapcontext(&currentJob->caller, &t->context);
-	    }
+    self->epoch = 0;
+    self->waiters = 0;
+    return 0;
+}
+
+static unsigned Parker_prepare(Parker *self)
+{
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&self->lock);
+    ++self->waiters;
+    unsigned epoch = self->epoch;
+    pthread_mutex_unlock(&self->lock);
+    return epoch;
 #else
-	    currentJob->proc(currentJob->arg);
+    atomic_fetch_add_explicit(&self->waiters, 1, memory_order_seq_cst);
+    return atomic_load_explicit(&self->epoch, memory_order_seq_cst);
 #endif
+}
+
+static void Parker_cancel(Parker *self)
+{
 #ifdef THRP_NO_ATOMICS
-	    pthread_mutex_lock(&currentJob->lock);
-	    currentJob->pthrno = -1;
-	    pthread_mutex_unlock(&currentJob->lock);
+    pthread_mutex_lock(&self->lock);
+    --self->waiters;
+    pthread_mutex_unlock(&self->lock);
 #else
-	    atomic_store_explicit(&currentJob->pthrno, -1,
-		    memory_order_release);
+    atomic_fetch_sub_explicit(&self->waiters, 1, memory_order_seq_cst);
 #endif
-	}
+}
+
+static unsigned Parker_epoch(Parker *self)
+{
 #ifdef THRP_NO_ATOMICS
-	else pthread_mutex_unlock(&currentJob->lock);
+    return self->epoch;
+#else
+    return atomic_load_explicit(&self->epoch, memory_order_relaxed);
 #endif
-	PSC_Service_runOnThread(currentJob->thrno, threadJobDone, currentJob);
-	currentJob = 0;
-    }
-
-    PSC_Service_runOnThread(-1, workerDone, t);
-    return 0;
 }
 
-SOEXPORT PSC_ThreadJob *PSC_ThreadJob_create(
-	PSC_ThreadProc proc, void *arg, int timeoutMs)
+/* Waits until notified, or at most timeoutMs milliseconds if that's
+ * positive. Returns -1 if the wait timed out without a notification. */
+static int Parker_wait(Parker *self, unsigned epoch, int timeoutMs)
 {
-    if (PSC_Service_threadNo() < -1)
+    struct timespec until;
+    if (timeoutMs > 0)
     {
-	PSC_Log_msg(PSC_L_ERROR, "threadpool: cannot create thread job from "
-		"within a pool thread");
-	return 0;
+#ifdef THRP_FUTEX
+	clock_gettime(CLOCK_MONOTONIC, &until);
+#else
+	clock_gettime(CLOCK_REALTIME, &until);
+#endif
+	until.tv_sec += timeoutMs / 1000;
+	until.tv_nsec += (timeoutMs % 1000) * 1000000L;
+	if (until.tv_nsec >= 1000000000L)
+	{
+	    ++until.tv_sec;
+	    until.tv_nsec -= 1000000000L;
+	}
     }
-    PSC_ThreadJob *self = PSC_malloc(sizeof *self);
-    memset(self, 0, sizeof *self);
-#ifdef THRP_NO_ATOMICS
-    if (pthread_mutex_init(&self->lock, 0) != 0)
+    int rc = 0;
+#ifdef THRP_FUTEX
+    /* the kernel only puts us to sleep if the epoch still matches */
+    while (Parker_epoch(self) == epoch)
     {
-	PSC_Log_msg(PSC_L_ERROR, "threadpool: cannot create thread job lock");
-	free(self);
-	return 0;
+	if (syscall(SYS_futex, &self->epoch, FUTEX_WAIT_BITSET_PRIVATE,
+		    epoch, timeoutMs > 0 ? &until : 0, 0,
+		    FUTEX_BITSET_MATCH_ANY) < 0 && errno == ETIMEDOUT)
+	{
+	    if (Parker_epoch(self) == epoch) rc = -1;
+	    break;
+	}
     }
-#endif
-    self->proc = proc;
+    atomic_fetch_sub_explicit(&self->waiters, 1, memory_order_seq_cst);
+#else
+    pthread_mutex_lock(&self->lock);
+    while (Parker_epoch(self) == epoch)
+    {
+	if (timeoutMs <= 0) pthread_cond_wait(&self->cond, &self->lock);
+	else if (pthread_cond_timedwait(&self->cond, &self->lock, &until)
+		== ETIMEDOUT)
+	{
+	    if (Parker_epoch(self) == epoch) rc = -1;
+	    break;
+	}
+    }
+#ifdef THRP_NO_ATOMICS
+    --self->waiters;
+#else
+    atomic_fetch_sub_explicit(&self->waiters, 1, memory_order_seq_cst);
+#endif
+    pthread_mutex_unlock(&self->lock);
+#endif
+    return rc;
+}
+
+static unsigned Parker_waiters(Parker *self)
+{
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&self->lock);
+    unsigned waiters = self->waiters;
+    pthread_mutex_unlock(&self->lock);
+    return waiters;
+#else
+    return atomic_load_explicit(&self->waiters, memory_order_relaxed);
+#endif
+}
+
+static void Parker_notify(Parker *self, unsigned n)
+{
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&self->lock);
+    unsigned waiters = self->waiters;
+    if (waiters) ++self->epoch;
+#elif defined(THRP_FUTEX)
+    atomic_thread_fence(memory_order_seq_cst);
+    unsigned waiters = atomic_load_explicit(&self->waiters,
+	    memory_order_seq_cst);
+    if (!waiters) return;
+    atomic_fetch_add_explicit(&self->epoch, 1, memory_order_seq_cst);
+    syscall(SYS_futex, &self->epoch, FUTEX_WAKE_PRIVATE,
+	    n >= waiters ? INT_MAX : (int)n, 0, 0, 0);
+#else
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(&self->waiters, memory_order_seq_cst)) return;
+    pthread_mutex_lock(&self->lock);
+    unsigned waiters = atomic_load_explicit(&self->waiters,
+	    memory_order_relaxed);
+    atomic_fetch_add_explicit(&self->epoch, 1, memory_order_relaxed);
+#endif
+#ifndef THRP_FUTEX
+    if (n >= waiters) pthread_cond_broadcast(&self->cond);
+    else while (n--) pthread_cond_signal(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+#endif
+}
+
+static void Parker_destroy(Parker *self)
+{
+#ifdef THRP_FUTEX
+    (void)self;
+#else
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->lock);
+#endif
+}
+
+static int reserveClass(int cls)
+{
+    int limit = opts.classLimit[cls];
+    if (!limit) return 1;
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&classlock);
+    int ok = busy[cls] < limit;
+    if (ok) ++busy[cls];
+    pthread_mutex_unlock(&classlock);
+    return ok;
+#else
+    int n = atomic_load_explicit(busy + cls, memory_order_relaxed);
+    do
+    {
+	if (n >= limit) return 0;
+    } while (!atomic_compare_exchange_weak_explicit(busy + cls, &n, n + 1,
+		memory_order_seq_cst, memory_order_relaxed));
+    return 1;
+#endif
+}
+
+static void releaseClass(int cls)
+{
+    if (!opts.classLimit[cls]) return;
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&classlock);
+    --busy[cls];
+    pthread_mutex_unlock(&classlock);
+#else
+    atomic_fetch_sub_explicit(busy + cls, 1, memory_order_seq_cst);
+#endif
+    /* a worker might have parked while the class was at its limit */
+    Parker_notify(&parker, 1);
+}
+
+/* Pick the job class by smooth weighted round-robin: every class earns
+ * its weight in credit for each job taken, the class the job is taken
+ * from pays the sum of all weights. Classes are tried in the order of
+ * their credit, skipping those without jobs or at their limit. */
+static PSC_ThreadJob *takeJob(Thread *t)
+{
+    int order[NJOBCLASSES];
+    int total = 0;
+    for (int i = 0; i < NJOBCLASSES; ++i)
+    {
+	int j = i;
+	for (; j > 0 && t->credit[order[j-1]] < t->credit[i]; --j)
+	{
+	    order[j] = order[j-1];
+	}
+	order[j] = i;
+	total += opts.classWeight[i];
+    }
+    for (int i = 0; i < NJOBCLASSES; ++i)
+    {
+	int cls = order[i];
+	if (!reserveClass(cls)) continue;
+	PSC_ThreadJob *job = stealJob(t, cls);
+	if (!job)
+	{
+	    releaseClass(cls);
+	    continue;
+	}
+	for (int j = 0; j < NJOBCLASSES; ++j)
+	{
+	    t->credit[j] += opts.classWeight[j];
+	    if (j == cls) t->credit[j] -= total;
+	    /* bound the credit idle classes can accumulate */
+	    if (t->credit[j] > total) t->credit[j] = total;
+	    else if (t->credit[j] < -total) t->credit[j] = -total;
+	}
+	return job;
+    }
+    return 0;
+}
+
+static int isStopped(Thread *t)
+{
+    int stopped = 0;
+    sem_getvalue(&t->stop, &stopped);
+    return stopped;
+}
+
+/* Sets *idle if the worker waited for the idle timeout without getting
+ * any job, so it might retire. */
+static PSC_ThreadJob *dequeueJob(Thread *t, int *idle)
+{
+    PSC_ThreadJob *job = takeJob(t);
+    if (job) return job;
+    unsigned epoch = Parker_prepare(&parker);
+    if ((job = takeJob(t)) || isStopped(t))
+    {
+	Parker_cancel(&parker);
+	return job;
+    }
+    if (Parker_wait(&parker, epoch,
+		minthreads < nthreads ? opts.idleTimeout : 0) < 0) *idle = 1;
+    return 0;
+}
+
+static int retireWorker(void)
+{
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&workerslock);
+    int ok = nworkers > minthreads;
+    if (ok) --nworkers;
+    pthread_mutex_unlock(&workerslock);
+    return ok;
+#else
+    int n = atomic_load_explicit(&nworkers, memory_order_relaxed);
+    do
+    {
+	if (n <= minthreads) return 0;
+    } while (!atomic_compare_exchange_weak_explicit(&nworkers, &n, n - 1,
+		memory_order_acq_rel, memory_order_relaxed));
+    return 1;
+#endif
+}
+
+static int pushJob(SubmitQueue *q, PSC_ThreadJob *job, int grow)
+{
+    if (SubmitQueue_push(q, job, grow) < 0) return -1;
+    Parker_notify(&parker, 1);
+    return 0;
+}
+
+static void queueSpace(void *arg)
+{
+    SubmitQueue *q = arg;
+    if (q != submitQueue || submitGeneration != generation) return;
+    while (deferredJobs)
+    {
+	/* once pushed, the job might already be finished and relinked */
+	PSC_ThreadJob *next = deferredJobs->next;
+	if (pushJob(q, deferredJobs, 0) < 0)
+	{
+	    if (SubmitQueue_markFull(q, deferredJobs->cls)) return;
+	    continue;
+	}
+	if (!(deferredJobs = next)) lastDeferredJob = 0;
+    }
+    if (overflowing)
+    {
+	overflowing = 0;
+	if (queueAvailableEvent.pool)
+	{
+	    PSC_Event_raise(&queueAvailableEvent, 0, 0);
+	}
+    }
+}
+
+static void completeInline(void *receiver, void *sender, void *args)
+{
+    (void)receiver;
+    (void)sender;
+    (void)args;
+
+    PSC_Event_unregister(PSC_Service_eventsDone(), 0, completeInline, 0);
+    PSC_ThreadJob *job = inlineJobs;
+    inlineJobs = 0;
+    lastInlineJob = 0;
+    while (job)
+    {
+	PSC_ThreadJob *next = job->next;
+	threadJobDone(job);
+	job = next;
+    }
+}
+
+static int runInline(PSC_ThreadJob *job)
+{
+    /* a job that might await a task would block the service loop */
+    if (job->async) return -1;
+
+    /* it runs to completion right here, so it can't time out */
+    if (job->timeout) PSC_Timer_stop(job->timeout);
+    currentJob = job;
+    job->proc(job->arg);
+    currentJob = 0;
+
+    /* like for jobs on pool threads, the finished event fires later */
+    job->next = 0;
+    if (lastInlineJob) lastInlineJob->next = job;
+    else
+    {
+	inlineJobs = job;
+	PSC_Event_register(PSC_Service_eventsDone(), 0, completeInline, 0);
+    }
+    lastInlineJob = job;
+    return 0;
+}
+
+static int enqueueJob(PSC_ThreadJob *job)
+{
+    SubmitQueue *q = SubmitQueue_get();
+    if (!q) return -1;
+    if (!deferredJobs && pushJob(q, job,
+		opts.queuePolicy == PSC_QP_GROW) == 0) return 0;
+
+    if (!overflowing)
+    {
+	overflowing = 1;
+	if (queueFullEvent.pool) PSC_Event_raise(&queueFullEvent, 0, 0);
+    }
+    int rc = -1;
+    switch (opts.queuePolicy)
+    {
+	case PSC_QP_DEFER:
+	    job->next = 0;
+	    if (lastDeferredJob) lastDeferredJob->next = job;
+	    else deferredJobs = job;
+	    lastDeferredJob = job;
+	    rc = 0;
+	    break;
+
+	case PSC_QP_INLINE:
+	    rc = runInline(job);
+	    break;
+
+	default:
+	    break;
+    }
+    if (rc < 0) countStat(&nrejected);
+    if (!SubmitQueue_markFull(q, job->cls)) queueSpace(q);
+    return rc;
+}
+
+#ifdef HAVE_CONTEXT
+static void requeueAsync(void *arg)
+{
+    /* a job that already started must never be dropped, so ignore the
+     * queue size here */
+    SubmitQueue *q = SubmitQueue_get();
+    if (!q || pushJob(q, arg, 1) < 0)
+    {
+	PSC_Log_msg(PSC_L_ERROR, "threadpool: cannot requeue async job");
+    }
+}
+
+static void resumeAsync(PSC_ThreadJob *job)
+{
+    /* the job must go back to the queue of the thread it was submitted
+     * from, which also owns its timeout timer */
+    if (PSC_Service_threadNo() == job->thrno) requeueAsync(job);
+    else PSC_Service_runOnThread(job->thrno, requeueAsync, job);
+}
+#endif
+
+static int SubmitQueue_release(SubmitQueue *self)
+{
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&self->lock);
+    int refcnt = --self->refcnt;
+    pthread_mutex_unlock(&self->lock);
+#else
+    int refcnt = atomic_fetch_sub_explicit(&self->refcnt, 1,
+	    memory_order_acq_rel) - 1;
+#endif
+    if (refcnt) return 0;
+    SubmitQueue_destroy(self);
+    return 1;
+}
+
+static void deliverFinished(void *arg)
+{
+    SubmitQueue *q = arg;
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&q->lock);
+    PSC_ThreadJob *job = q->finished;
+    q->finished = 0;
+    pthread_mutex_unlock(&q->lock);
+#else
+    PSC_ThreadJob *job = atomic_exchange_explicit(&q->finished, 0,
+	    memory_order_acquire);
+#endif
+    PSC_ThreadJob *fifo = 0;
+    while (job)
+    {
+	PSC_ThreadJob *next = job->next;
+	job->next = fifo;
+	fifo = job;
+	job = next;
+    }
+    while (fifo)
+    {
+	PSC_ThreadJob *next = fifo->next;
+	threadJobDone(fifo);
+	fifo = next;
+    }
+    SubmitQueue_release(q);
+}
+
+static void finishJob(PSC_ThreadJob *job)
+{
+    SubmitQueue *q = job->queue;
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&q->lock);
+    PSC_ThreadJob *head = q->finished;
+    job->next = head;
+    q->finished = job;
+    if (!head) ++q->refcnt;
+    pthread_mutex_unlock(&q->lock);
+#else
+    PSC_ThreadJob *head = atomic_load_explicit(&q->finished,
+	    memory_order_relaxed);
+    do
+    {
+	job->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&q->finished, &head,
+		job, memory_order_release, memory_order_relaxed));
+    if (!head) atomic_fetch_add_explicit(&q->refcnt, 1, memory_order_relaxed);
+#endif
+    /* the job might already be delivered here, don't touch it again */
+    if (!head) PSC_Service_runOnThread(q->thrno, deliverFinished, q);
+}
+
+static void destroyQueues(void)
+{
+    for (SubmitQueue *q = SubmitQueue_first(), *n = 0; q; q = n)
+    {
+	n = q->next;
+	SubmitQueue_release(q);
+    }
+    submitQueues = 0;
+    ++generation;
+    Parker_destroy(&parker);
+}
+
+static void freeWorkerStats(void)
+{
+    if (!workerStats) return;
+#ifdef THRP_NO_ATOMICS
+    for (int i = 0; i < nthreads; ++i)
+    {
+	pthread_mutex_destroy(&workerStats[i].lock);
+    }
+#endif
+    free(workerStats);
+    workerStats = 0;
+}
+
+static int startWorker(int i)
+{
+    Thread *t = threads + i;
+    memset(t, 0, sizeof *t);
+    t->pthrno = -1;
+    if (sem_init(&t->stop, 0, 0) < 0)
+    {
+	PSC_Log_msg(PSC_L_ERROR, "threadpool: error creating semaphore");
+	return -1;
+    }
+    t->pthrno = i;
+    if (pthread_create(&t->handle, 0, worker, t) != 0)
+    {
+	PSC_Log_msg(PSC_L_ERROR, "threadpool: error creating thread");
+	t->pthrno = -1;
+	sem_destroy(&t->stop);
+	return -1;
+    }
+    ++rthreads;
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&workerslock);
+    ++nworkers;
+    pthread_mutex_unlock(&workerslock);
+#else
+    atomic_fetch_add_explicit(&nworkers, 1, memory_order_acq_rel);
+#endif
+    return 0;
+}
+
+static void spawnWorker(void)
+{
+    int i = 0;
+    while (i < nthreads && threads[i].pthrno >= 0) ++i;
+    if (i == nthreads) return;
+
+    sigset_t blockmask;
+    sigset_t mask;
+    sigfillset(&blockmask);
+    if (sigprocmask(SIG_BLOCK, &blockmask, &mask) < 0)
+    {
+	PSC_Log_err(PSC_L_ERROR, "threadpool: cannot set signal mask");
+	return;
+    }
+    int rc = startWorker(i);
+    if (sigprocmask(SIG_SETMASK, &mask, 0) < 0)
+    {
+	PSC_Log_err(PSC_L_ERROR, "threadpool: cannot restore signal mask");
+    }
+    if (rc == 0) PSC_Log_fmt(PSC_L_DEBUG, "threadpool: jobs are waiting, "
+	    "started worker %d", i);
+}
+
+static int blockedWorkers(void)
+{
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&workerslock);
+    int n = nblocked;
+    pthread_mutex_unlock(&workerslock);
+    return n;
+#else
+    return atomic_load_explicit(&nblocked, memory_order_relaxed);
+#endif
+}
+
+/* Add a worker when jobs are waiting, no worker is idle and the backlog
+ * didn't shrink for a full check interval, so jobs wait at least that
+ * long. Workers blocked in PSC_AsyncTask_await() can't take other jobs,
+ * so they don't count and a worker is added right away. */
+static void checkLoad(void *receiver, void *sender, void *args)
+{
+    (void)receiver;
+    (void)sender;
+    (void)args;
+
+    if (!threads || stopping) return;
+    size_t backlog = 0;
+    for (SubmitQueue *q = SubmitQueue_first(); q; q = q->next)
+    {
+	backlog += SubmitQueue_pending(q);
+    }
+    int grow = 0;
+    if (!backlog || Parker_waiters(&parker)) backlogTicks = 0;
+    else if (blockedWorkers()) grow = 1;
+    else if (backlog < lastBacklog) backlogTicks = 0;
+    else if (++backlogTicks > 1) grow = 1;
+    lastBacklog = backlog;
+    if (!grow) return;
+    backlogTicks = 0;
+    spawnWorker();
+}
+
+static void startLoadTimer(void *receiver, void *sender, void *args)
+{
+    (void)receiver;
+    (void)sender;
+    (void)args;
+
+    if (!threads || stopping || loadTimer) return;
+    loadTimer = PSC_Timer_create();
+    PSC_Timer_setMs(loadTimer, opts.spawnDelay);
+    PSC_Event_register(PSC_Timer_expired(loadTimer), 0, checkLoad, 0);
+    PSC_Timer_start(loadTimer, 1);
+}
+
+static void workerDone(void *arg)
+{
+    Thread *t = arg;
+    t->pthrno = -1;
+    pthread_join(t->handle, 0);
+    sem_destroy(&t->stop);
+    if (!stopping) PSC_Log_fmt(PSC_L_DEBUG, "threadpool: worker %d was "
+	    "idle, retired", (int)(t - threads));
+    if (--rthreads) return;
+    free(threads);
+    threads = 0;
+    freeWorkerStats();
+    nworkers = 0;
+    if (minthreads < nthreads)
+    {
+	PSC_Event_unregister(PSC_Service_startup(), 0, startLoadTimer, 0);
+    }
+    destroyQueues();
+    PSC_Service_unregisterPanic(panicHandler);
+    mainthread = 0;
+#ifdef HAVE_CONTEXT
+    StackMgr_clean();
+#endif
+    PSC_Service_shutdownUnlock();
+}
+
+static unsigned histBucket(uint64_t us)
+{
+    unsigned bucket = 0;
+    while (us && bucket < PSC_TP_HISTBUCKETS - 1)
+    {
+	us >>= 1;
+	++bucket;
+    }
+    return bucket;
+}
+
+static void WorkerStats_setState(WorkerStats *self,
+	uint64_t busySince, uint64_t idleSince)
+{
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&self->lock);
+    self->busySince = busySince;
+    self->idleSince = idleSince;
+    pthread_mutex_unlock(&self->lock);
+#else
+    atomic_store_explicit(&self->busySince, busySince,
+	    memory_order_relaxed);
+    atomic_store_explicit(&self->idleSince, idleSince,
+	    memory_order_relaxed);
+#endif
+}
+
+/* Busy time in per mille of the last window is smoothed with a moving
+ * average over roughly the last four windows, like the service thread
+ * load. */
+static void WorkerStats_finish(WorkerStats *self, uint64_t wait,
+	uint64_t start, uint64_t end, int ran)
+{
+    unsigned wb = histBucket(wait);
+    unsigned rb = histBucket(end - start);
+    self->busy += end - start;
+    uint64_t elapsed = end - self->windowStart;
+    unsigned permille = 0;
+    if (elapsed >= LOADWINDOW)
+    {
+	permille = self->busy >= elapsed ? 1000U
+	    : (unsigned)(self->busy * 1000U / elapsed);
+	self->windowStart = end;
+	self->busy = 0;
+    }
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&self->lock);
+    ++self->wait[wb];
+    self->waitTotal += wait;
+    if (ran)
+    {
+	++self->run[rb];
+	self->runTotal += end - start;
+    }
+    if (elapsed >= LOADWINDOW) self->load = (3 * self->load + permille) / 4;
+    self->busySince = 0;
+    self->idleSince = end;
+    pthread_mutex_unlock(&self->lock);
+#else
+    atomic_store_explicit(self->wait + wb, atomic_load_explicit(
+		self->wait + wb, memory_order_relaxed) + 1,
+	    memory_order_relaxed);
+    atomic_store_explicit(&self->waitTotal, atomic_load_explicit(
+		&self->waitTotal, memory_order_relaxed) + wait,
+	    memory_order_relaxed);
+    if (ran)
+    {
+	atomic_store_explicit(self->run + rb, atomic_load_explicit(
+		    self->run + rb, memory_order_relaxed) + 1,
+		memory_order_relaxed);
+	atomic_store_explicit(&self->runTotal, atomic_load_explicit(
+		    &self->runTotal, memory_order_relaxed) + end - start,
+		memory_order_relaxed);
+    }
+    if (elapsed >= LOADWINDOW)
+    {
+	atomic_store_explicit(&self->load, (3 * atomic_load_explicit(
+			&self->load, memory_order_relaxed) + permille) / 4,
+		memory_order_relaxed);
+    }
+    atomic_store_explicit(&self->busySince, 0, memory_order_relaxed);
+    atomic_store_explicit(&self->idleSince, end, memory_order_relaxed);
+#endif
+}
+
+static int checkpanic(void)
+{
+    if (setjmp(panicjmp))
+    {
+	if (currentJob)
+	{
+	    currentJob->panicmsg = panicmsg;
+	    PSC_Service_runOnThread(currentJob->thrno,
+		    threadJobDone, currentJob);
+	}
+	return 1;
+    }
+    return 0;
+}
+
+static void *worker(void *arg)
+{
+    Thread *t = arg;
+    currentThread = t;
+    SOM_registerThread();
+
+    WorkerStats *ws = workerStats + t->pthrno;
+    ws->windowStart = nowUs();
+    ws->busy = 0;
+    WorkerStats_setState(ws, 0, ws->windowStart);
+
+    if (!checkpanic()) for (;;)
+    {
+	int idle = 0;
+	currentJob = dequeueJob(t, &idle);
+	if (isStopped(t)) break;
+	if (!currentJob)
+	{
+	    if (idle && retireWorker()) break;
+	    continue;
+	}
+	int cls = currentJob->cls;
+	uint64_t start = nowUs();
+	uint64_t wait = start > currentJob->enqueued
+	    ? start - currentJob->enqueued : 0;
+	WorkerStats_setState(ws, start, 0);
+#ifdef THRP_NO_ATOMICS
+	pthread_mutex_lock(&currentJob->lock);
+	int ran = currentJob->hasCompleted;
+	pthread_mutex_unlock(&currentJob->lock);
+#else
+	int ran = atomic_load_explicit(&currentJob->hasCompleted,
+		memory_order_acquire);
+#endif
+	if (ran)
+	{
+#ifdef HAVE_CONTEXT
+	    if (!currentJob->async) currentJob->proc(currentJob->arg);
+	    else if (currentJob->task)
+	    {
+		Context_switch(&currentJob->caller,
+			&currentJob->task->resume);
+	    }
+	    else
+	    {
+		if (!currentJob->stack)
+		{
+		    currentJob->stack = StackMgr_getStack(
+			    currentJob->stacksz);
+		}
+		Context_init(&t->context, currentJob->stack,
+			StackMgr_size(currentJob->stacksz), runThreadJob);
+		Context_switch(&currentJob->caller, &t->context);
+	    }
+	    if (currentJob->async && !currentJob->task)
+	    {
+		/* job finished, so the stack can be reused right here */
+		StackMgr_returnStack(currentJob->stack, currentJob->stacksz);
+		currentJob->stack = 0;
+	    }
+#else
+	    currentJob->proc(currentJob->arg);
+#endif
+	}
+	WorkerStats_finish(ws, wait, start, ran ? nowUs() : start, ran);
+	releaseClass(cls);
+	finishJob(currentJob);
+	currentJob = 0;
+    }
+
+#ifdef HAVE_CONTEXT
+    StackMgr_threadDone();
+#endif
+    SOM_unregisterThread();
+    PSC_Service_runOnThread(-1, workerDone, t);
+    return 0;
+}
+
+/* Destroyed jobs are kept in a per-thread cache for reuse, together with
+ * their lock and timeout timer, so creating a job normally doesn't need
+ * any allocation. */
+static PSC_ThreadJob *allocJob(PSC_ThreadProc proc, void *arg)
+{
+    if (PSC_Service_threadNo() < -1)
+    {
+	PSC_Log_msg(PSC_L_ERROR, "threadpool: cannot create thread job from "
+		"within a pool thread");
+	return 0;
+    }
+    PSC_ThreadJob *self = jobCache;
+    if (self)
+    {
+	jobCache = self->next;
+	--jobCacheSize;
+    }
+    else
+    {
+	self = PSC_malloc(sizeof *self);
+	memset(self, 0, sizeof *self);
+#ifdef THRP_NO_ATOMICS
+	if (pthread_mutex_init(&self->lock, 0) != 0)
+	{
+	    PSC_Log_msg(PSC_L_ERROR,
+		    "threadpool: cannot create thread job lock");
+	    free(self);
+	    return 0;
+	}
+#endif
+    }
+    self->next = 0;
+    self->proc = proc;
+    self->done = 0;
     self->arg = arg;
+    self->task = 0;
+    self->panicmsg = 0;
+    self->hasCompleted = 1;
+    self->cancelwr = -1;
+    self->cancelrd = -1;
+    self->timeoutMs = 0;
+    self->cls = PSC_JC_DEFAULT;
+    self->async = 0;
+#ifdef HAVE_CONTEXT
+    self->stack = 0;
+    self->stacksz = PSC_SS_DEFAULT;
+#endif
+    return self;
+}
+
+static void freeJob(PSC_ThreadJob *self)
+{
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_destroy(&self->lock);
+#endif
+    PSC_Timer_destroy(self->timeout);
+    free(self);
+}
+
+SOEXPORT PSC_ThreadJob *PSC_ThreadJob_create(
+	PSC_ThreadProc proc, void *arg, int timeoutMs)
+{
+    PSC_ThreadJob *self = allocJob(proc, arg);
+    if (!self) return 0;
     PSC_Event_initStatic(&self->finished, self);
     self->timeoutMs = timeoutMs;
-    self->hasCompleted = 1;
-    self->pthrno = -1;
     return self;
 }
 
-SOEXPORT void PSC_ThreadJob_setAsync(PSC_ThreadJob *self)
+SOEXPORT void PSC_ThreadJob_setAsync(PSC_ThreadJob *self)
+{
+    self->async = 1;
+}
+
+SOEXPORT void PSC_ThreadJob_setStackSize(PSC_ThreadJob *self,
+	PSC_StackSize size)
 {
-#ifdef HAVE_UCONTEXT
-    self->async = 1;
+#ifdef HAVE_CONTEXT
+    self->stacksz = size;
 #else
     (void)self;
+    (void)size;
 #endif
 }
 
+SOEXPORT void PSC_ThreadJob_setClass(PSC_ThreadJob *self,
+	PSC_ThreadJobClass cls)
+{
+    self->cls = cls;
+}
+
 SOEXPORT PSC_Event *PSC_ThreadJob_finished(PSC_ThreadJob *self)
 {
     return &self->finished;
@@ -440,15 +1660,23 @@ SOEXPORT int PSC_ThreadJob_hasCompleted(const PSC_ThreadJob *self)
 SOEXPORT void PSC_ThreadJob_destroy(PSC_ThreadJob *self)
 {
     if (!self) return;
-#ifdef HAVE_UCONTEXT
-    StackMgr_returnStack(self->stack);
-#endif
-#ifdef THRP_NO_ATOMICS
-    pthread_mutex_destroy(&self->lock);
+#ifdef HAVE_CONTEXT
+    StackMgr_returnStack(self->stack, self->stacksz);
 #endif
-    PSC_Timer_destroy(self->timeout);
+    if (self->cancelrd >= 0)
+    {
+	if (self->cancelwr != self->cancelrd) close(self->cancelwr);
+	close(self->cancelrd);
+    }
     PSC_Event_destroyStatic(&self->finished);
-    free(self);
+    if (jobCacheSize < JOBCACHESZ)
+    {
+	if (self->timeout) PSC_Timer_stop(self->timeout);
+	self->next = jobCache;
+	jobCache = self;
+	++jobCacheSize;
+    }
+    else freeJob(self);
 }
 
 SOEXPORT int PSC_ThreadJob_canceled(void)
@@ -457,9 +1685,61 @@ SOEXPORT int PSC_ThreadJob_canceled(void)
     return !PSC_ThreadJob_hasCompleted(currentJob);
 }
 
+static void signalCancel(int fd)
+{
+#ifdef HAVE_EVENTFD
+    uint64_t v = 1;
+#else
+    char v = 1;
+#endif
+    if (write(fd, &v, sizeof v) < 0 && errno != EAGAIN)
+    {
+	PSC_Log_msg(PSC_L_WARNING,
+		"threadpool: cannot signal job cancellation");
+    }
+}
+
+SOEXPORT int PSC_ThreadJob_cancelFd(void)
+{
+    PSC_ThreadJob *job = currentJob;
+    if (!job) return -1;
+    if (job->cancelrd >= 0) return job->cancelrd;
+#ifdef HAVE_EVENTFD
+    int rfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (rfd < 0) return -1;
+    int wfd = rfd;
+#else
+    int fds[2];
+    if (pipe(fds) < 0) return -1;
+    for (int i = 0; i < 2; ++i)
+    {
+	fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    }
+    int rfd = fds[0];
+    int wfd = fds[1];
+#endif
+    job->cancelrd = rfd;
+
+    /* Publish the fd before checking for cancellation, cancelJob() does
+     * it the other way around, so at least one of both signals it. */
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&job->lock);
+    job->cancelwr = wfd;
+    int canceled = !job->hasCompleted;
+    pthread_mutex_unlock(&job->lock);
+#else
+    atomic_store_explicit(&job->cancelwr, wfd, memory_order_seq_cst);
+    int canceled = !atomic_load_explicit(&job->hasCompleted,
+	    memory_order_seq_cst);
+#endif
+    if (canceled) signalCancel(wfd);
+    return rfd;
+}
+
 SOEXPORT int PSC_AsyncTask_awaitIsBlocking(void)
 {
-#ifdef HAVE_UCONTEXT
+#ifdef HAVE_CONTEXT
     return 0;
 #else
     return 1;
@@ -479,15 +1759,22 @@ SOEXPORT PSC_AsyncTask *PSC_AsyncTask_create(PSC_AsyncTaskJob job)
 
 SOEXPORT void *PSC_AsyncTask_await(PSC_AsyncTask *self, void *arg)
 {
+    if (!currentThread)
+    {
+	PSC_Log_msg(PSC_L_ERROR, "threadpool: cannot await async task "
+		"outside of a pool thread, skipping execution!");
+	free(self);
+	return 0;
+    }
     self->thread = currentThread;
     self->threadJob = currentJob;
     self->threadJob->task = self;
     self->arg = arg;
 
-#ifdef HAVE_UCONTEXT
+#ifdef HAVE_CONTEXT
     if (self->threadJob->async)
     {
-	swapcontext(&self->resume, &self->threadJob->caller);
+	Context_switch(&self->resume, &self->threadJob->caller);
     }
     else
 #endif
@@ -499,13 +1786,27 @@ SOEXPORT void *PSC_AsyncTask_await(PSC_AsyncTask *self, void *arg)
 	    free(self);
 	    return 0;
 	}
+#ifdef THRP_NO_ATOMICS
+	pthread_mutex_lock(&workerslock);
+	++nblocked;
+	pthread_mutex_unlock(&workerslock);
+#else
+	atomic_fetch_add_explicit(&nblocked, 1, memory_order_relaxed);
+#endif
 	PSC_Service_runOnThread(self->threadJob->thrno,
 		threadJobDone, self->threadJob);
 	sem_wait(&self->complete);
+#ifdef THRP_NO_ATOMICS
+	pthread_mutex_lock(&workerslock);
+	--nblocked;
+	pthread_mutex_unlock(&workerslock);
+#else
+	atomic_fetch_sub_explicit(&nblocked, 1, memory_order_relaxed);
+#endif
     }
     void *result = self->result;
     self->threadJob->task = 0;
-#ifdef HAVE_UCONTEXT
+#ifdef HAVE_CONTEXT
     if (!self->threadJob->async)
 #endif
     {
@@ -523,8 +1824,8 @@ SOEXPORT void *PSC_AsyncTask_arg(PSC_AsyncTask *self)
 SOEXPORT void PSC_AsyncTask_complete(PSC_AsyncTask *self, void *result)
 {
     self->result = result;
-#ifdef HAVE_UCONTEXT
-    if (self->threadJob->async) JobQueue_enqueue(jobQueue, self->threadJob);
+#ifdef HAVE_CONTEXT
+    if (self->threadJob->async) resumeAsync(self->threadJob);
     else
 #endif
     {
@@ -536,12 +1837,23 @@ static void stopThreads(int nthr)
 {
     for (int i = 0; i < nthr; ++i)
     {
-	if (threads[i].pthrno >= 0)
-	{
-	    sem_post(&threads[i].stop);
-	    pthread_kill(threads[i].handle, SIGUSR1);
-	}
+	if (threads[i].pthrno >= 0) sem_post(&threads[i].stop);
     }
+    Parker_notify(&parker, nthr);
+}
+
+static void cancelJob(PSC_ThreadJob *job)
+{
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&job->lock);
+    job->hasCompleted = 0;
+    int fd = job->cancelwr;
+    pthread_mutex_unlock(&job->lock);
+#else
+    atomic_store_explicit(&job->hasCompleted, 0, memory_order_seq_cst);
+    int fd = atomic_load_explicit(&job->cancelwr, memory_order_seq_cst);
+#endif
+    if (fd >= 0) signalCancel(fd);
 }
 
 static void jobTimeout(void *receiver, void *sender, void *args)
@@ -549,7 +1861,8 @@ static void jobTimeout(void *receiver, void *sender, void *args)
     (void)sender;
     (void)args;
 
-    PSC_ThreadPool_cancel(receiver);
+    countStat(&ntimeouts);
+    cancelJob(receiver);
 }
 
 static void threadJobDone(void *arg)
@@ -568,7 +1881,11 @@ static void threadJobDone(void *arg)
     }
     else
     {
-	PSC_Event_raise(&job->finished, 0, job->arg);
+	if (job->finished.pool) PSC_Event_raise(&job->finished, 0, job->arg);
+	else if (job->done)
+	{
+	    job->done(job->arg, PSC_ThreadJob_hasCompleted(job));
+	}
 	PSC_ThreadJob_destroy(job);
     }
 }
@@ -589,6 +1906,12 @@ SOEXPORT void PSC_ThreadOpts_init(int defThreads)
     opts.maxQueueLen = MAXQUEUELEN;
     opts.minQueueLen = MINQUEUELEN;
     opts.qLenPerThread = QLENPERTHREAD;
+    opts.spawnDelay = SPAWNDELAY;
+    opts.idleTimeout = IDLETIMEOUT;
+    opts.classWeight[PSC_JC_DEFAULT] = 4;
+    opts.classWeight[PSC_JC_CRITICAL] = 8;
+    opts.classWeight[PSC_JC_RESOLVE] = 2;
+    opts.classWeight[PSC_JC_BACKGROUND] = 1;
 }
 
 SOEXPORT void PSC_ThreadOpts_fixedThreads(int n)
@@ -626,6 +1949,36 @@ SOEXPORT void PSC_ThreadOpts_minQueue(int n)
     opts.minQueueLen = n;
 }
 
+SOEXPORT void PSC_ThreadOpts_elastic(int minThreads)
+{
+    opts.minThreads = minThreads;
+}
+
+SOEXPORT void PSC_ThreadOpts_spawnDelay(int ms)
+{
+    opts.spawnDelay = ms;
+}
+
+SOEXPORT void PSC_ThreadOpts_idleTimeout(int ms)
+{
+    opts.idleTimeout = ms;
+}
+
+SOEXPORT void PSC_ThreadOpts_queuePolicy(PSC_QueuePolicy policy)
+{
+    opts.queuePolicy = policy;
+}
+
+SOEXPORT void PSC_ThreadOpts_classWeight(PSC_ThreadJobClass cls, int weight)
+{
+    opts.classWeight[cls] = weight;
+}
+
+SOEXPORT void PSC_ThreadOpts_classLimit(PSC_ThreadJobClass cls, int n)
+{
+    opts.classLimit[cls] = n;
+}
+
 SOEXPORT int PSC_ThreadPool_init(void)
 {
     sigset_t blockmask;
@@ -663,7 +2016,6 @@ SOEXPORT int PSC_ThreadPool_init(void)
 	nthreads = opts.defNThreads;
 #endif
     }
-    int queuesize;
     if (opts.queueLen)
     {
 	queuesize = opts.queueLen;
@@ -674,37 +2026,52 @@ SOEXPORT int PSC_ThreadPool_init(void)
 	if (queuesize < opts.minQueueLen) queuesize = opts.minQueueLen;
     }
     else queuesize = opts.maxQueueLen;
+    if (opts.minThreads > 0 && opts.minThreads < nthreads)
+    {
+	minthreads = opts.minThreads;
+	PSC_Log_fmt(PSC_L_DEBUG, "threadpool: starting with %d of up to %d "
+		"threads and queues for %d jobs per submitting thread",
+		minthreads, nthreads, queuesize);
+    }
+    else
+    {
+	minthreads = nthreads;
+	PSC_Log_fmt(PSC_L_DEBUG, "threadpool: starting with %d threads and "
+		"queues for %d jobs per submitting thread",
+		nthreads, queuesize);
+    }
 
-    PSC_Log_fmt(PSC_L_DEBUG, "threadpool: starting with %d threads and a "
-	    "queue for %d jobs", nthreads, queuesize);
-
+    if (Parker_init(&parker) < 0)
+    {
+	PSC_Log_msg(PSC_L_ERROR, "threadpool: error creating wait queue");
+	goto done;
+    }
+    ++generation;
     threads = PSC_malloc(nthreads * sizeof *threads);
     memset(threads, 0, nthreads * sizeof *threads);
-    jobQueue = JobQueue_create(queuesize);
+    for (int i = 0; i < nthreads; ++i) threads[i].pthrno = -1;
+    workerStats = PSC_malloc(nthreads * sizeof *workerStats);
+    memset(workerStats, 0, nthreads * sizeof *workerStats);
+#ifdef THRP_NO_ATOMICS
+    for (int i = 0; i < nthreads; ++i)
+    {
+	pthread_mutex_init(&workerStats[i].lock, 0);
+    }
+#endif
+    nrejected = 0;
+    ntimeouts = 0;
+    ncanceled = 0;
 
     rthreads = 0;
-    for (int i = 0; i < nthreads; ++i)
+    nworkers = 0;
+    stopping = 0;
+    for (int i = 0; i < minthreads; ++i)
     {
-	if (sem_init(&threads[i].stop, 0, 0) < 0)
-	{
-	    PSC_Log_msg(PSC_L_ERROR,
-		    "threadpool: error creating semaphore");
-	    goto rollback;
-	}
-	if (pthread_create(&threads[i].handle, 0, worker, threads+i) != 0)
+	if (startWorker(i) < 0)
 	{
-	    PSC_Log_msg(PSC_L_ERROR, "threadpool: error creating thread");
-	    goto rollback_cancel;
+	    stopThreads(i);
+	    goto done;
 	}
-	threads[i].pthrno = i;
-	++rthreads;
-	continue;
-
-rollback_cancel:
-	sem_destroy(&threads[i].stop);
-rollback:
-	stopThreads(i);
-	goto done;
     }
     rc = 0;
 
@@ -720,13 +2087,20 @@ done:
     {
 	mainthread = 1;
 	PSC_Service_registerPanic(panicHandler);
+	if (minthreads < nthreads)
+	{
+	    /* timers need the running service */
+	    lastBacklog = 0;
+	    backlogTicks = 0;
+	    PSC_Event_register(PSC_Service_startup(), 0, startLoadTimer, 0);
+	}
     }
     else
     {
+	if (threads) destroyQueues();
 	free(threads);
 	threads = 0;
-	JobQueue_destroy(jobQueue);
-	jobQueue = 0;
+	freeWorkerStats();
     }
 
     return rc;
@@ -737,7 +2111,22 @@ SOEXPORT int PSC_ThreadPool_active(void)
     return !!threads;
 }
 
-SOEXPORT int PSC_ThreadPool_enqueue(PSC_ThreadJob *job)
+SOEXPORT PSC_Event *PSC_ThreadPool_queueFull(void)
+{
+    if (!queueFullEvent.pool) PSC_Event_initStatic(&queueFullEvent, 0);
+    return &queueFullEvent;
+}
+
+SOEXPORT PSC_Event *PSC_ThreadPool_queueAvailable(void)
+{
+    if (!queueAvailableEvent.pool)
+    {
+	PSC_Event_initStatic(&queueAvailableEvent, 0);
+    }
+    return &queueAvailableEvent;
+}
+
+static int prepareJob(PSC_ThreadJob *job)
 {
     job->thrno = PSC_Service_threadNo();
     if (job->thrno < -1)
@@ -746,34 +2135,380 @@ SOEXPORT int PSC_ThreadPool_enqueue(PSC_ThreadJob *job)
 		"within a pool thread");
 	return -1;
     }
-    if (job->timeoutMs && !job->timeout)
+    if (job->timeoutMs)
     {
-	job->timeout = PSC_Timer_create();
-	if (!job->timeout) return -1;
+	if (!job->timeout)
+	{
+	    job->timeout = PSC_Timer_create();
+	    if (!job->timeout) return -1;
+	    PSC_Event_register(PSC_Timer_expired(job->timeout), job,
+		    jobTimeout, 0);
+	}
 	PSC_Timer_setMs(job->timeout, job->timeoutMs);
-	PSC_Event_register(PSC_Timer_expired(job->timeout), job,
-		jobTimeout, 0);
     }
-    if (JobQueue_enqueue(jobQueue, job) < 0) return -1;
     return 0;
 }
 
-SOEXPORT void PSC_ThreadPool_cancel(PSC_ThreadJob *job)
+SOEXPORT int PSC_ThreadPool_enqueue(PSC_ThreadJob *job)
+{
+    if (prepareJob(job) < 0) return -1;
+    return enqueueJob(job);
+}
+
+SOEXPORT size_t PSC_ThreadPool_enqueueBatch(PSC_ThreadJob **jobs, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+	if (prepareJob(jobs[i]) < 0)
+	{
+	    n = i;
+	    break;
+	}
+    }
+    SubmitQueue *q = SubmitQueue_get();
+    if (!q) return 0;
+    size_t enqueued = 0;
+    if (!deferredJobs)
+    {
+	enqueued = SubmitQueue_pushBatch(q, jobs, n,
+		opts.queuePolicy == PSC_QP_GROW);
+	if (enqueued) Parker_notify(&parker, enqueued);
+    }
+    while (enqueued < n && enqueueJob(jobs[enqueued]) == 0) ++enqueued;
+    return enqueued;
+}
+
+SOEXPORT int PSC_ThreadPool_submit(PSC_ThreadProc proc, void *arg,
+	PSC_ThreadJobDone done)
+{
+    PSC_ThreadJob *job = allocJob(proc, arg);
+    if (!job) return -1;
+    job->done = done;
+    job->thrno = PSC_Service_threadNo();
+    if (enqueueJob(job) < 0)
+    {
+	PSC_ThreadJob_destroy(job);
+	return -1;
+    }
+    return 0;
+}
+
+static int nextRange(ParallelWork *work, size_t *begin, size_t *end)
 {
+    size_t b;
+    size_t sz;
 #ifdef THRP_NO_ATOMICS
-    pthread_mutex_lock(&job->lock);
-    job->hasCompleted = 0;
-    if (job->pthrno >= 0) pthread_kill(threads[job->pthrno].handle, SIGUSR1);
-    pthread_mutex_unlock(&job->lock);
+    pthread_mutex_lock(&work->lock);
+    b = work->next;
+    if (b >= work->count)
+    {
+	pthread_mutex_unlock(&work->lock);
+	return 0;
+    }
+    sz = (work->count - b) / (2 * work->nparts);
+    if (sz < work->grain) sz = work->grain;
+    if (sz > work->count - b) sz = work->count - b;
+    work->next = b + sz;
+    pthread_mutex_unlock(&work->lock);
 #else
-    atomic_store_explicit(&job->hasCompleted, 0, memory_order_release);
-    int pthrno;
-    if ((pthrno = atomic_load_explicit(
-		    &job->pthrno, memory_order_consume)) >= 0)
+    b = atomic_load_explicit(&work->next, memory_order_relaxed);
+    do
+    {
+	if (b >= work->count) return 0;
+	sz = (work->count - b) / (2 * work->nparts);
+	if (sz < work->grain) sz = work->grain;
+	if (sz > work->count - b) sz = work->count - b;
+    } while (!atomic_compare_exchange_weak_explicit(&work->next, &b, b + sz,
+		memory_order_relaxed, memory_order_relaxed));
+#endif
+    *begin = b;
+    *end = b + sz;
+    return 1;
+}
+
+static void parallelProc(void *arg)
+{
+    ParallelPart *part = arg;
+    ParallelWork *work = part->work;
+    size_t begin;
+    size_t end;
+    while (nextRange(work, &begin, &end))
+    {
+	if (!work->map)
+	{
+	    work->proc(work->arg, begin, end);
+	    continue;
+	}
+	void *result = work->map(work->arg, begin, end);
+	if (part->hasResult)
+	{
+	    result = work->combine(work->arg, part->result, result);
+	}
+	part->result = result;
+	part->hasResult = 1;
+    }
+}
+
+static void parallelPartDone(void *arg, int completed)
+{
+    (void)completed;
+
+    ParallelPart *part = arg;
+    ParallelWork *work = part->work;
+    if (--work->pending) return;
+
+    void *result = 0;
+    int hasResult = 0;
+    for (size_t i = 0; i < work->nparts; ++i)
+    {
+	if (!work->parts[i].hasResult) continue;
+	result = hasResult ? work->combine(work->arg, result,
+		work->parts[i].result) : work->parts[i].result;
+	hasResult = 1;
+    }
+    PSC_ParallelDone done = work->done;
+    void *doneArg = work->arg;
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_destroy(&work->lock);
+#endif
+    free(work);
+    if (done) done(doneArg, result);
+}
+
+static int parallel(size_t count, size_t grain, PSC_RangeProc proc,
+	PSC_RangeMapProc map, PSC_CombineProc combine, void *arg,
+	PSC_ParallelDone done)
+{
+    if (PSC_Service_threadNo() < -1)
+    {
+	PSC_Log_msg(PSC_L_ERROR, "threadpool: cannot start parallel work "
+		"from within a pool thread");
+	return -1;
+    }
+    if (!grain) grain = 1;
+    size_t nparts = 1;
+    if (threads)
+    {
+	nparts = count / grain + !!(count % grain);
+	if (nparts > (size_t)nthreads) nparts = nthreads;
+	if (!nparts) nparts = 1;
+    }
+
+    ParallelWork *work = PSC_malloc(sizeof *work
+	    + nparts * sizeof *work->parts);
+    memset(work, 0, sizeof *work + nparts * sizeof *work->parts);
+#ifdef THRP_NO_ATOMICS
+    if (pthread_mutex_init(&work->lock, 0) != 0)
+    {
+	PSC_Log_msg(PSC_L_ERROR, "threadpool: cannot create lock for "
+		"parallel work");
+	free(work);
+	return -1;
+    }
+#endif
+    work->proc = proc;
+    work->map = map;
+    work->combine = combine;
+    work->done = done;
+    work->arg = arg;
+    work->count = count;
+    work->grain = grain;
+    work->nparts = nparts;
+    for (size_t i = 0; i < nparts; ++i) work->parts[i].work = work;
+
+    size_t enqueued = 0;
+    if (threads && count)
+    {
+	PSC_ThreadJob **jobs = PSC_malloc(nparts * sizeof *jobs);
+	size_t njobs = 0;
+	while (njobs < nparts)
+	{
+	    PSC_ThreadJob *job = allocJob(parallelProc, work->parts + njobs);
+	    if (!job) break;
+	    job->done = parallelPartDone;
+	    jobs[njobs++] = job;
+	}
+	work->pending = njobs;
+	enqueued = PSC_ThreadPool_enqueueBatch(jobs, njobs);
+	for (size_t i = enqueued; i < njobs; ++i)
+	{
+	    PSC_ThreadJob_destroy(jobs[i]);
+	}
+	free(jobs);
+
+	/* the parts enqueued take care of the whole range anyways, their
+	 * completion is only delivered later on this thread */
+	work->pending = enqueued;
+    }
+    if (!enqueued)
     {
-	pthread_kill(threads[pthrno].handle, SIGUSR1);
+	work->pending = 1;
+	parallelProc(work->parts);
+	parallelPartDone(work->parts, 1);
     }
+    return 0;
+}
+
+SOEXPORT int PSC_ThreadPool_parallelFor(size_t count, size_t grain,
+	PSC_RangeProc proc, void *arg, PSC_ParallelDone done)
+{
+    return parallel(count, grain, proc, 0, 0, arg, done);
+}
+
+SOEXPORT int PSC_ThreadPool_parallelReduce(size_t count, size_t grain,
+	PSC_RangeMapProc map, PSC_CombineProc combine, void *arg,
+	PSC_ParallelDone done)
+{
+    return parallel(count, grain, 0, map, combine, arg, done);
+}
+
+SOEXPORT void PSC_ThreadPool_cancel(PSC_ThreadJob *job)
+{
+    countStat(&ncanceled);
+    cancelJob(job);
+}
+
+SOEXPORT int PSC_ThreadPool_size(void)
+{
+    if (!threads) return 0;
+#ifdef THRP_NO_ATOMICS
+    pthread_mutex_lock(&workerslock);
+    int n = nworkers;
+    pthread_mutex_unlock(&workerslock);
+    return n;
+#else
+    return atomic_load_explicit(&nworkers, memory_order_relaxed);
+#endif
+}
+
+SOEXPORT PSC_ThreadPoolStats *PSC_ThreadPool_stats(void)
+{
+    int nw = threads ? nthreads : 0;
+    PSC_ThreadPoolStats *self = PSC_malloc(sizeof *self
+	    + nw * sizeof *self->busy);
+    memset(self, 0, sizeof *self + nw * sizeof *self->busy);
+    self->nworkers = nw;
+    self->rejected = readStat(&nrejected);
+    self->timeouts = readStat(&ntimeouts);
+    self->canceled = readStat(&ncanceled);
+    uint64_t now = nowUs();
+    for (int i = 0; i < nw; ++i)
+    {
+	WorkerStats *ws = workerStats + i;
+	uint64_t busySince;
+	uint64_t idleSince;
+	unsigned load;
+#ifdef THRP_NO_ATOMICS
+	pthread_mutex_lock(&ws->lock);
+	for (int b = 0; b < PSC_TP_HISTBUCKETS; ++b)
+	{
+	    self->wait[b] += ws->wait[b];
+	    self->run[b] += ws->run[b];
+	}
+	self->waitTotal += ws->waitTotal;
+	self->runTotal += ws->runTotal;
+	busySince = ws->busySince;
+	idleSince = ws->idleSince;
+	load = ws->load;
+	pthread_mutex_unlock(&ws->lock);
+#else
+	for (int b = 0; b < PSC_TP_HISTBUCKETS; ++b)
+	{
+	    self->wait[b] += atomic_load_explicit(ws->wait + b,
+		    memory_order_relaxed);
+	    self->run[b] += atomic_load_explicit(ws->run + b,
+		    memory_order_relaxed);
+	}
+	self->waitTotal += atomic_load_explicit(&ws->waitTotal,
+		memory_order_relaxed);
+	self->runTotal += atomic_load_explicit(&ws->runTotal,
+		memory_order_relaxed);
+	busySince = atomic_load_explicit(&ws->busySince,
+		memory_order_relaxed);
+	idleSince = atomic_load_explicit(&ws->idleSince,
+		memory_order_relaxed);
+	load = atomic_load_explicit(&ws->load, memory_order_relaxed);
 #endif
+	/* a worker busy with a single job or idle for longer than a window
+	 * doesn't update its load */
+	if (busySince && now - busySince >= LOADWINDOW) load = 1000U;
+	else if (idleSince && now - idleSince >= LOADWINDOW) load = 0;
+	self->busy[i] = load;
+    }
+    for (int b = 0; b < PSC_TP_HISTBUCKETS; ++b) self->jobs += self->run[b];
+    return self;
+}
+
+SOEXPORT uint64_t PSC_ThreadPoolStats_jobs(const PSC_ThreadPoolStats *self)
+{
+    return self->jobs;
+}
+
+SOEXPORT uint64_t PSC_ThreadPoolStats_rejected(
+	const PSC_ThreadPoolStats *self)
+{
+    return self->rejected;
+}
+
+SOEXPORT uint64_t PSC_ThreadPoolStats_timeouts(
+	const PSC_ThreadPoolStats *self)
+{
+    return self->timeouts;
+}
+
+SOEXPORT uint64_t PSC_ThreadPoolStats_canceled(
+	const PSC_ThreadPoolStats *self)
+{
+    return self->canceled;
+}
+
+SOEXPORT uint64_t PSC_ThreadPoolStats_bucketLimit(unsigned bucket)
+{
+    if (bucket >= PSC_TP_HISTBUCKETS - 1) return UINT64_MAX;
+    return (uint64_t)1U << bucket;
+}
+
+SOEXPORT uint64_t PSC_ThreadPoolStats_queueWait(
+	const PSC_ThreadPoolStats *self, unsigned bucket)
+{
+    if (bucket >= PSC_TP_HISTBUCKETS) return 0;
+    return self->wait[bucket];
+}
+
+SOEXPORT uint64_t PSC_ThreadPoolStats_queueWaitTotal(
+	const PSC_ThreadPoolStats *self)
+{
+    return self->waitTotal;
+}
+
+SOEXPORT uint64_t PSC_ThreadPoolStats_runTime(
+	const PSC_ThreadPoolStats *self, unsigned bucket)
+{
+    if (bucket >= PSC_TP_HISTBUCKETS) return 0;
+    return self->run[bucket];
+}
+
+SOEXPORT uint64_t PSC_ThreadPoolStats_runTimeTotal(
+	const PSC_ThreadPoolStats *self)
+{
+    return self->runTotal;
+}
+
+SOEXPORT int PSC_ThreadPoolStats_workers(const PSC_ThreadPoolStats *self)
+{
+    return self->nworkers;
+}
+
+SOEXPORT unsigned PSC_ThreadPoolStats_busy(const PSC_ThreadPoolStats *self,
+	int worker)
+{
+    if (worker < 0 || worker >= self->nworkers) return 0;
+    return self->busy[worker];
+}
+
+SOEXPORT void PSC_ThreadPoolStats_destroy(PSC_ThreadPoolStats *self)
+{
+    free(self);
 }
 
 SOLOCAL int PSC_ThreadPool_nthreads(void)
@@ -781,9 +2516,31 @@ SOLOCAL int PSC_ThreadPool_nthreads(void)
     return nthreads;
 }
 
+SOLOCAL void PSC_ThreadPool_threadDone(void)
+{
+    while (jobCache)
+    {
+	PSC_ThreadJob *next = jobCache->next;
+	freeJob(jobCache);
+	jobCache = next;
+    }
+    jobCacheSize = 0;
+#ifdef HAVE_CONTEXT
+    StackMgr_threadDone();
+#endif
+    PSC_Event_destroyStatic(&queueFullEvent);
+    PSC_Event_destroyStatic(&queueAvailableEvent);
+}
+
 SOEXPORT void PSC_ThreadPool_done(void)
 {
     if (!threads) return;
+    stopping = 1;
+    if (loadTimer)
+    {
+	PSC_Timer_destroy(loadTimer);
+	loadTimer = 0;
+    }
     stopThreads(nthreads);
     PSC_Service_shutdownLock();
 }
@@ -4,5 +4,6 @@
 #include <poser/core/threadpool.h>
 
 int PSC_ThreadPool_nthreads(void);
+void PSC_ThreadPool_threadDone(void);
 
 #endif
@@ -21,15 +21,16 @@
 #  endif
 #  include "service.h"
 #elif defined(HAVE_TIMERFD)
+#  include "service.h"
 #  include <poser/core/event.h>
 #  include <poser/core/log.h>
-#  include <poser/core/service.h>
 #  include <fcntl.h>
 #  include <stdint.h>
 #  include <sys/timerfd.h>
 #  include <time.h>
 #  include <unistd.h>
-void expired(void *receiver, void *sender, void *args);
+
+#  define HEAPCHUNK 16
 #else
 #  include <poser/core/log.h>
 #  include <poser/core/service.h>
@@ -54,6 +55,13 @@ typedef struct TimerPool
 {
     PSC_Timer *first;
     PSC_Timer *last;
+#ifdef HAVE_TIMERFD
+    PSC_Timer **heap;
+    size_t heapsz;
+    size_t heapcapa;
+    uint64_t armed;
+    int tfd;
+#endif
 #ifndef NDEBUG
     void *thr;
 #endif
@@ -70,7 +78,9 @@ struct PSC_Timer
     timer_t timerid;
 #  endif
 #  ifdef HAVE_TIMERFD
-    int tfd;
+    uint64_t due;
+    uint64_t deadline;
+    size_t heappos;
 #  endif
     int job;
 #else
@@ -78,6 +88,7 @@ struct PSC_Timer
     PSC_TimerJob *job;
 #endif
     unsigned ms;
+    unsigned slack;
     int periodic;
 };
 
@@ -88,28 +99,12 @@ static void enableTimer(PSC_Timer *self)
     PSC_Event_initStatic(&self->expired, self);
     self->job = 0;
     self->ms = 1000;
+    self->slack = 0;
     self->periodic = 0;
 }
 
 static PSC_Timer *createTimer(TimerPool *p)
 {
-#ifdef HAVE_TIMERFD
-#  if defined(TFD_NONBLOCK) && defined(TFD_CLOEXEC)
-    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
-#  else
-    int tfd = timerfd_create(CLOCK_MONOTONIC, 0);
-    if (tfd >= 0)
-    {
-	fcntl(tfd, F_SETFD, FD_CLOEXEC);
-	fcntl(tfd, F_SETFL, fcntl(tfd, F_GETFL) | O_NONBLOCK);
-    }
-#  endif
-    if (tfd < 0)
-    {
-	PSC_Log_err(PSC_L_ERROR, "timer: cannot create timerfd");
-	return 0;
-    }
-#endif
 #if !defined(HAVE_EVPORTS) && !defined(HAVE_KQUEUE) && !defined(HAVE_TIMERFD)
     pthread_mutex_lock(&lock);
     if (!initialized)
@@ -121,11 +116,6 @@ static PSC_Timer *createTimer(TimerPool *p)
 #endif
     PSC_Timer *self = PSC_malloc(sizeof *self);
     self->pool = p;
-#ifdef HAVE_TIMERFD
-    self->tfd = tfd;
-    PSC_Event_register(PSC_Service_readyRead(), self, expired, tfd);
-    PSC_Service_registerRead(tfd);
-#endif
 #ifdef HAVE_EVPORTS
     port_notify_t pnot = {
 	.portnfy_port = PSC_Service_epfd(),
@@ -153,7 +143,7 @@ static PSC_Timer *createTimer(TimerPool *p)
 
 static void disableTimer(PSC_Timer *self)
 {
-#if !defined(HAVE_EVPORTS) && !defined(HAVE_TIMERFD)
+#ifndef HAVE_EVPORTS
     if (self->job) PSC_Timer_stop(self);
 #endif
     PSC_Event_destroyStatic(&self->expired);
@@ -163,24 +153,59 @@ static void destroyTimer(PSC_Timer *self)
 {
 #ifdef HAVE_EVPORTS
     if (self->job >= 0) timer_delete(self->timerid);
-#elif defined(HAVE_TIMERFD)
+#endif
+    free(self);
+}
+
+#ifdef HAVE_TIMERFD
+static void poolExpired(void *receiver, void *sender, void *args);
+
+static int initTimerfd(TimerPool *self)
+{
+#  if defined(TFD_NONBLOCK) && defined(TFD_CLOEXEC)
+    self->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+#  else
+    self->tfd = timerfd_create(CLOCK_MONOTONIC, 0);
     if (self->tfd >= 0)
     {
-	PSC_Service_unregisterRead(self->tfd);
-	PSC_Event_unregister(PSC_Service_readyRead(), self,
-		expired, self->tfd);
-	close(self->tfd);
+	fcntl(self->tfd, F_SETFD, FD_CLOEXEC);
+	fcntl(self->tfd, F_SETFL, fcntl(self->tfd, F_GETFL) | O_NONBLOCK);
     }
-#endif
-    free(self);
+#  endif
+    if (self->tfd < 0)
+    {
+	PSC_Log_err(PSC_L_ERROR, "timer: cannot create timerfd");
+	return -1;
+    }
+    PSC_Event_register(PSC_Service_readyRead(), self, poolExpired, self->tfd);
+    PSC_Service_registerRead(self->tfd);
+    return 0;
 }
 
+static void doneTimerfd(TimerPool *self)
+{
+    PSC_Service_unregisterRead(self->tfd);
+    PSC_Event_unregister(PSC_Service_readyRead(), self,
+	    poolExpired, self->tfd);
+    close(self->tfd);
+    free(self->heap);
+}
+#endif
+
 static TimerPool *TimerPool_init(void)
 {
     if (!pool)
     {
 	pool = PSC_malloc(sizeof *pool);
 	memset(pool, 0, sizeof *pool);
+#ifdef HAVE_TIMERFD
+	if (initTimerfd(pool) < 0)
+	{
+	    free(pool);
+	    pool = 0;
+	    return 0;
+	}
+#endif
 #ifndef NDEBUG
 	pool->thr = (void *)pthread_self();
 #endif
@@ -199,6 +224,9 @@ static void TimerPool_done(TimerPool *self)
 	    n = t->next;
 	    destroyTimer(t);
 	}
+#ifdef HAVE_TIMERFD
+	doneTimerfd(self);
+#endif
 	free(self);
     }
 }
@@ -229,6 +257,7 @@ static void TimerPool_return(TimerPool *self, PSC_Timer *timer)
 SOEXPORT PSC_Timer *PSC_Timer_create(void)
 {
     TimerPool *p = TimerPool_init();
+    if (!p) return 0;
     PSC_Timer *self = TimerPool_get(p);
     if (!self) TimerPool_done(p);
     return self;
@@ -239,7 +268,12 @@ SOEXPORT PSC_Event *PSC_Timer_expired(PSC_Timer *self)
     return &self->expired;
 }
 
-#if defined(HAVE_EVPORTS) || defined(HAVE_KQUEUE) || defined(HAVE_TIMERFD)
+SOEXPORT void PSC_Timer_setSlack(PSC_Timer *self, unsigned ms)
+{
+    self->slack = ms;
+}
+
+#if defined(HAVE_EVPORTS) || defined(HAVE_KQUEUE)
 SOEXPORT void PSC_Timer_setMs(PSC_Timer *self, unsigned ms)
 {
     if (self->job)
@@ -320,43 +354,180 @@ SOEXPORT void PSC_Timer_stop(PSC_Timer *self)
 
 #elif defined(HAVE_TIMERFD)
 
-void expired(void *receiver, void *sender, void *args)
+/* All timers of a service thread are kept in a 4-ary min-heap ordered by
+ * their deadline, sharing a single timerfd that is armed for the earliest
+ * one. Stopping the earliest timer doesn't disarm the timerfd, a wakeup
+ * without expired timers just re-arms it, so starting and stopping a timer
+ * only needs a system call when it becomes the new earliest one.
+ *
+ * With slack, deadlines are rounded up to a multiple of the slack, so
+ * timers due around the same time expire together in a single wakeup. */
+
+/* Deadlines of started timers are based on the current time, not on the
+ * time cached for the service loop iteration, which might be outdated */
+static uint64_t clockNow(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+    {
+	return PSC_Service_preciseNow();
+    }
+    return (uint64_t)ts.tv_sec * 1000000000U + ts.tv_nsec;
+}
+
+static uint64_t withSlack(const PSC_Timer *self, uint64_t due)
+{
+    if (!self->slack) return due;
+    uint64_t slack = self->slack * UINT64_C(1000000);
+    return (due + slack - 1) / slack * slack;
+}
+
+static void heapSet(TimerPool *self, size_t pos, PSC_Timer *timer)
+{
+    self->heap[pos] = timer;
+    timer->heappos = pos;
+}
+
+static void siftUp(TimerPool *self, size_t pos)
+{
+    PSC_Timer *timer = self->heap[pos];
+    while (pos)
+    {
+	size_t parent = (pos - 1) / 4;
+	if (self->heap[parent]->deadline <= timer->deadline) break;
+	heapSet(self, pos, self->heap[parent]);
+	pos = parent;
+    }
+    heapSet(self, pos, timer);
+}
+
+static void siftDown(TimerPool *self, size_t pos)
+{
+    PSC_Timer *timer = self->heap[pos];
+    for (;;)
+    {
+	size_t child = 4 * pos + 1;
+	if (child >= self->heapsz) break;
+	size_t end = child + 4 < self->heapsz ? child + 4 : self->heapsz;
+	size_t min = child;
+	for (size_t i = child + 1; i < end; ++i)
+	{
+	    if (self->heap[i]->deadline < self->heap[min]->deadline) min = i;
+	}
+	if (timer->deadline <= self->heap[min]->deadline) break;
+	heapSet(self, pos, self->heap[min]);
+	pos = min;
+    }
+    heapSet(self, pos, timer);
+}
+
+static void heapInsert(TimerPool *self, PSC_Timer *timer)
+{
+    if (self->heapsz == self->heapcapa)
+    {
+	self->heapcapa += HEAPCHUNK;
+	self->heap = PSC_realloc(self->heap,
+		self->heapcapa * sizeof *self->heap);
+    }
+    heapSet(self, self->heapsz++, timer);
+    siftUp(self, timer->heappos);
+}
+
+static void heapRemove(TimerPool *self, PSC_Timer *timer)
+{
+    size_t pos = timer->heappos;
+    PSC_Timer *last = self->heap[--self->heapsz];
+    if (last == timer) return;
+    heapSet(self, pos, last);
+    if (pos && last->deadline < self->heap[(pos - 1) / 4]->deadline)
+    {
+	siftUp(self, pos);
+    }
+    else siftDown(self, pos);
+}
+
+static void arm(TimerPool *self)
+{
+    if (!self->heapsz) return;
+    uint64_t deadline = self->heap[0]->deadline;
+    if (self->armed && self->armed <= deadline) return;
+    struct itimerspec its = { {0, 0}, {0, 0} };
+    its.it_value.tv_sec = deadline / 1000000000U;
+    its.it_value.tv_nsec = deadline % 1000000000U;
+    timerfd_settime(self->tfd, TFD_TIMER_ABSTIME, &its, 0);
+    self->armed = deadline;
+}
+
+static void poolExpired(void *receiver, void *sender, void *args)
 {
     (void)sender;
     (void)args;
 
-    PSC_Timer *self = receiver;
+    TimerPool *self = receiver;
     uint64_t times;
-    if (self->tfd < 0 || read(self->tfd, &times, sizeof times) != sizeof times)
+    if (read(self->tfd, &times, sizeof times) != sizeof times) return;
+    self->armed = 0;
+
+    /* handlers might destroy the last timer of this pool */
+    ++self->refcnt;
+    uint64_t now = PSC_Service_preciseNow();
+    while (self->heapsz && self->heap[0]->deadline <= now)
     {
-	return;
+	PSC_Timer *timer = self->heap[0];
+	uint64_t count = 1;
+	if (timer->periodic)
+	{
+	    uint64_t period = timer->ms * UINT64_C(1000000);
+	    count += (now - timer->due) / period;
+	    timer->due += count * period;
+	    timer->deadline = withSlack(timer, timer->due);
+	    siftDown(self, 0);
+	}
+	else
+	{
+	    heapRemove(self, timer);
+	    timer->job = 0;
+	}
+	uint64_t deadline = timer->deadline;
+	for (uint64_t i = 0; i < count; ++i)
+	{
+	    PSC_Event_raise(&timer->expired, 0, 0);
+	    if (!timer->job || timer->deadline != deadline) break;
+	}
     }
-    for (uint64_t i = 0; i < times; ++i)
+    arm(self);
+    TimerPool_done(self);
+}
+
+SOEXPORT void PSC_Timer_setMs(PSC_Timer *self, unsigned ms)
+{
+    self->ms = ms;
+    if (self->job)
     {
-	PSC_Event_raise(&self->expired, 0, 0);
+	PSC_Timer_stop(self);
+	PSC_Timer_start(self, self->periodic);
     }
-    if (!self->periodic) self->job = 0;
 }
 
 SOEXPORT void PSC_Timer_start(PSC_Timer *self, int periodic)
 {
-    if (self->tfd >= 0 && !self->job && self->ms)
+    if (!self->job && self->ms)
     {
-	struct itimerspec its = { {0, 0}, {0, 0} };
-	its.it_value.tv_sec = self->ms / 1000U;
-	its.it_value.tv_nsec = 1000000U * (self->ms % 1000U);
-	if (periodic) its.it_interval = its.it_value;
-	timerfd_settime(self->tfd, 0, &its, 0);
+	assert(self->pool->thr == (void *)pthread_self());
+	self->periodic = periodic;
+	self->due = clockNow() + self->ms * UINT64_C(1000000);
+	self->deadline = withSlack(self, self->due);
+	heapInsert(self->pool, self);
+	arm(self->pool);
 	self->job = 1;
     }
 }
 
 SOEXPORT void PSC_Timer_stop(PSC_Timer *self)
 {
-    if (self->tfd >= 0 && self->job)
+    if (self->job)
     {
-	struct itimerspec its = { {0, 0}, {0, 0} };
-	timerfd_settime(self->tfd, 0, &its, 0);
+	heapRemove(self->pool, self);
 	self->job = 0;
     }
 }